@@ -0,0 +1,23 @@
+#version 330
+
+uniform sampler2D color_texture;
+
+in vec2 tex_coord;
+out vec4 fragColor;
+
+uniform vec2 u_direction;           //(1,0) poziomo, (0,1) pionowo
+uniform float u_blur_scale;         //rozstaw probek w tekselach
+
+// Rozdzielny filtr Gaussa 9 tap, 5 probek dzieki filtrowaniu dwuliniowemu
+void main()
+{
+    vec2 dir = u_direction * u_blur_scale / vec2(textureSize(color_texture, 0));
+
+    vec3 sum = texture(color_texture, tex_coord).rgb * 0.2270270270;
+    sum += texture(color_texture, tex_coord + dir * 1.3846153846).rgb * 0.3162162162;
+    sum += texture(color_texture, tex_coord - dir * 1.3846153846).rgb * 0.3162162162;
+    sum += texture(color_texture, tex_coord + dir * 3.2307692308).rgb * 0.0702702703;
+    sum += texture(color_texture, tex_coord - dir * 3.2307692308).rgb * 0.0702702703;
+
+    fragColor = vec4(sum, 1.0);
+}
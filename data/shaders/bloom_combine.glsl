@@ -0,0 +1,13 @@
+uniform float u_bloom_intensity;    //sila poswiaty
+
+// Poziomy lancucha mip sa powiekszane filtrowaniem dwuliniowym i sumowane
+vec4 bloom_combine(vec4 color)
+{
+    vec3 bloom = texture(bloom_texture0, tex_coord).rgb;
+    bloom += texture(bloom_texture1, tex_coord).rgb;
+    bloom += texture(bloom_texture2, tex_coord).rgb;
+    bloom += texture(bloom_texture3, tex_coord).rgb;
+    bloom *= 0.25;
+
+    return vec4(color.rgb + bloom * u_bloom_intensity, 1.0);
+}
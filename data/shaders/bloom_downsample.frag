@@ -0,0 +1,19 @@
+#version 330
+
+uniform sampler2D color_texture;
+
+in vec2 tex_coord;
+out vec4 fragColor;
+
+// Kolejny poziom lancucha mip: 4 probki dwuliniowe = filtr 4x4 poziomu wyzej
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(color_texture, 0));
+
+    vec3 sum = texture(color_texture, tex_coord + vec2(-texel.x, -texel.y)).rgb;
+    sum += texture(color_texture, tex_coord + vec2( texel.x, -texel.y)).rgb;
+    sum += texture(color_texture, tex_coord + vec2(-texel.x,  texel.y)).rgb;
+    sum += texture(color_texture, tex_coord + vec2( texel.x,  texel.y)).rgb;
+
+    fragColor = vec4(sum * 0.25, 1.0);
+}
@@ -0,0 +1,31 @@
+#version 330
+
+uniform sampler2D color_texture;
+
+in vec2 tex_coord;
+out vec4 fragColor;
+
+uniform float u_threshold;          //hard threshold
+uniform float u_knee;               //lagodzi przejscie
+
+//filtr poswiaty
+vec3 get_bloom(vec2 uv) {
+    vec3 col = texture(color_texture, uv).rgb;
+    float luma = dot(col, vec3(0.2126, 0.7152, 0.0722));
+    //soft threshold
+    float weight = clamp((luma - u_threshold + u_knee) / (u_knee* 2.0), 0.0, 1.0);
+    return col * weight;
+}
+
+// Wyjscie ma polowe rozdzielczosci: kazdy piksel to srednia bloku 2x2 wejscia
+void main()
+{
+    vec2 texel = 0.5 / vec2(textureSize(color_texture, 0));
+
+    vec3 bloom = get_bloom(tex_coord + vec2(-texel.x, -texel.y));
+    bloom += get_bloom(tex_coord + vec2( texel.x, -texel.y));
+    bloom += get_bloom(tex_coord + vec2(-texel.x,  texel.y));
+    bloom += get_bloom(tex_coord + vec2( texel.x,  texel.y));
+
+    fragColor = vec4(bloom * 0.25, 1.0);
+}
@@ -0,0 +1,47 @@
+#version 330
+
+/**
+ * DOF, przebieg 2 (polowa rozdzielczosci): rozmycie zbierajace probki z
+ * dysku o promieniu CoC srodkowego piksela.
+ */
+
+uniform sampler2D color_texture;
+uniform vec2 u_resolution;
+
+uniform float u_max_blur;
+uniform float u_blur_ramp;
+
+in vec2 tex_coord;
+out vec4 fragColor;
+
+const int NUM_TAPS = 12;
+
+// Dwa pierscienie: 4 probki w polowie promienia i 8 na brzegu
+const vec2 DISK[NUM_TAPS] = vec2[](
+    vec2( 0.5,    0.0),   vec2( 0.0,    0.5),
+    vec2(-0.5,    0.0),   vec2( 0.0,   -0.5),
+    vec2( 0.924,  0.383), vec2( 0.383,  0.924),
+    vec2(-0.383,  0.924), vec2(-0.924,  0.383),
+    vec2(-0.924, -0.383), vec2(-0.383, -0.924),
+    vec2( 0.383, -0.924), vec2( 0.924, -0.383));
+
+void main() {
+    vec4 center = texture(color_texture, tex_coord);
+
+    // CoC w pikselach tego (zmniejszonego) bufora
+    float radius = center.a * u_max_blur * u_blur_ramp * 0.5;
+    if (radius < 0.25) { fragColor = center; return; }
+
+    vec3 sum = center.rgb;
+    float weight_sum = 1.0;
+    for (int i = 0; i < NUM_TAPS; ++i) {
+        vec4 s = texture(color_texture, tex_coord + DISK[i] * radius / u_resolution);
+
+        // Ostre probki nie rozlewaja sie na rozmyte tlo
+        float weight = clamp(s.a / center.a, 0.0, 1.0);
+        sum += s.rgb * weight;
+        weight_sum += weight;
+    }
+
+    fragColor = vec4(sum / weight_sum, center.a);
+}
@@ -0,0 +1,45 @@
+#version 330
+
+/**
+ * DOF, przebieg 1 (polowa rozdzielczosci): zmniejszenie obrazu 2x2 i
+ * promien rozmycia (CoC) z bufora glebi, zapisany w kanale alfa.
+ */
+
+uniform sampler2D color_texture;
+uniform sampler2D depth_texture;
+uniform vec2 u_resolution;
+
+uniform float u_max_blur;
+uniform float u_blur_ramp;
+uniform float u_focus_range;
+
+in vec2 tex_coord;
+out vec4 fragColor;
+
+// Promien rozmycia w pikselach pelnej rozdzielczosci
+float coc(float depth) {
+    // Fokus na bliskiej plaszczyznie, bezpieczna strefa zostaje ostra
+    float factor = clamp(depth - u_focus_range, 0.0, u_max_blur);
+    return factor * u_blur_ramp;
+}
+
+void main() {
+    // Srodki czterech pikseli pelnej rozdzielczosci pod tym pikselem
+    vec2 offset = 0.25 / u_resolution;
+    vec2 taps[4] = vec2[](vec2(-offset.x, -offset.y),
+                          vec2( offset.x, -offset.y),
+                          vec2(-offset.x,  offset.y),
+                          vec2( offset.x,  offset.y));
+
+    vec3 color = vec3(0.0);
+    float max_coc = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        color += texture(color_texture, tex_coord + taps[i]).rgb;
+        // Maksimum, zeby rozmycie siegalo krawedzi obiektow
+        max_coc = max(max_coc, coc(texture(depth_texture, tex_coord + taps[i]).r));
+    }
+
+    // Bufor ma 8 bitow na kanal, wiec CoC jest znormalizowany
+    float range = max(u_max_blur * u_blur_ramp, 1e-4);
+    fragColor = vec4(color * 0.25, max_coc / range);
+}
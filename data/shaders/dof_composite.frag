@@ -0,0 +1,36 @@
+#version 330
+
+/**
+ * DOF, przebieg 3 (pelna rozdzielczosc): zlozenie obrazu z rozmyta kopia.
+ * Piksele ostre konczy jeden odczyt glebi, bez siegania po rozmycie.
+ */
+
+uniform sampler2D color_texture;
+uniform sampler2D depth_texture;
+uniform sampler2D dof_texture;
+
+uniform float u_max_blur;
+uniform float u_blur_ramp;
+uniform float u_focus_range;
+
+in vec2 tex_coord;
+out vec4 fragColor;
+
+// Ponizej pol piksela rozmycie i tak nie jest widoczne
+const float COC_THRESHOLD = 0.5;
+
+float coc(float depth) {
+    float factor = clamp(depth - u_focus_range, 0.0, u_max_blur);
+    return factor * u_blur_ramp;
+}
+
+void main() {
+    vec4 color = texture(color_texture, tex_coord);
+
+    float radius = coc(texture(depth_texture, tex_coord).r);
+    if (radius < COC_THRESHOLD) { fragColor = color; return; }
+
+    vec3 blurred = texture(dof_texture, tex_coord).rgb;
+    float blend = smoothstep(COC_THRESHOLD, 1.5, radius);
+    fragColor = vec4(mix(color.rgb, blurred, blend), color.a);
+}
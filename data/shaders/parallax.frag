@@ -2,8 +2,23 @@ uniform sampler2D baseTexture;
 uniform sampler2D heightMap;
 varying vec2 texCoord;
 varying vec3 viewDir;
+varying float eyeDist;
+
+// LOD shadera: 0 = wg odleglosci, 1 = zawsze pelny, 2 = zawsze tani
+uniform int shaderLodMode;
+uniform float shaderLodDistance;
 
 void main() {
+    // Tani wariant: jeden odczyt tekstury, oswietlenie jak plaskiego terenu.
+    // Dla normalnej (0,0,1) pelna sciezka daje pow(0.41, 3) < 0.3, czyli
+    // minimum 0.3, a odblask pow(0.41, 64) jest pomijalny
+    if (shaderLodMode == 2
+        || (shaderLodMode == 0 && eyeDist > shaderLodDistance)) {
+        vec4 flatColor = texture2D(baseTexture, texCoord);
+        gl_FragColor = vec4(flatColor.rgb * 0.3, flatColor.a);
+        return;
+    }
+
     float parallaxScale = 0.08; 
     float normalStrength = 15.0; 
     
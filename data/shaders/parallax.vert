@@ -1,5 +1,6 @@
 varying vec2 texCoord;
 varying vec3 viewDir;
+varying float eyeDist;
 uniform float texCoordScale;
 uniform float animStrength;
 uniform float animSpeed;
@@ -8,5 +9,6 @@ void main() {
     texCoord = gl_Vertex.xy * texCoordScale;
     vec4 eyePos = gl_ModelViewMatrix * gl_Vertex;
     viewDir = normalize(eyePos.xyz);
+    eyeDist = length(eyePos.xyz);
     gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
 }
\ No newline at end of file
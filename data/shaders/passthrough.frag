@@ -1,11 +0,0 @@
-#version 420 compatibility
-
-uniform sampler2D color_texture;
-uniform sampler2D depth_texture;
-
-in vec2 tex_coord;
-out vec4 fragColor;
-
-void main() {
-    fragColor = texture(color_texture, tex_coord);
-}
\ No newline at end of file
@@ -0,0 +1,4 @@
+vec4 passthrough(vec4 color)
+{
+    return color;
+}
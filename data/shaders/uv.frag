@@ -1,8 +0,0 @@
-#version 420 compatibility
-
-in vec2 tex_coord;
-out vec4 fragColor;
-
-void main() {
-	fragColor = vec4(tex_coord, 0.0, 1.0);
-}
\ No newline at end of file
@@ -0,0 +1,4 @@
+vec4 uv(vec4 color)
+{
+    return vec4(tex_coord, 0.0, 1.0);
+}
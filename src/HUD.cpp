@@ -1,5 +1,6 @@
 ﻿#include "HUD.h"
 #include "common.h"
+#include "feature_index.h"
 
 // hud.vert
 static const char* hudVertShader = R"(
@@ -145,116 +146,147 @@ void hudSetText(const std::string& text)
     }
 }
 
-static inline void ltrim(std::string& s)
+std::string translateFclass(const std::string& fclass)
 {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-                return !std::isspace(ch);
-            }));
+    auto it = fclassPL.find(fclass);
+    if (it != fclassPL.end()) return it->second;
+    return fclass;
 }
-static inline void rtrim(std::string& s)
+
+
+/****************************************************************************/
+
+LandInfoQuery::LandInfoQuery(): _generation(0), _delivered(0), _quit(false)
 {
-    s.erase(std::find_if(s.rbegin(), s.rend(),
-                         [](unsigned char ch) { return !std::isspace(ch); })
-                .base(),
-            s.end());
+    _worker = std::thread(&LandInfoQuery::run, this);
 }
-static inline void trim(std::string& s)
+
+LandInfoQuery::~LandInfoQuery()
 {
-    ltrim(s);
-    rtrim(s);
+    _quit = true;
+    _wake.notify_one();
+    if (_worker.joinable()) _worker.join();
 }
 
-std::string translateFclass(const std::string& fclass)
+void LandInfoQuery::submit(osg::Group* layers,
+                           const osg::Matrixd& localToWorld)
 {
-    auto it = fclassPL.find(fclass);
-    if (it != fclassPL.end()) return it->second;
-    return fclass;
+    Request& request = _requests.back();
+    if (!snapshot(layers, localToWorld, request)) return;
+
+    request.generation = ++_generation;
+    _requests.publish();
+    _wake.notify_one();
 }
 
+bool LandInfoQuery::poll(std::string& text)
+{
+    _results.fetch();
+    const Result& result = _results.front();
+
+    // Wynik nieaktualny (kamera ruszyla sie ponownie) albo juz pokazany
+    if (result.generation != _generation || result.generation == _delivered)
+        return false;
+
+    _delivered = result.generation;
+    text = result.text;
+    return true;
+}
+
+bool LandInfoQuery::snapshot(osg::Group* layers,
+                             const osg::Matrixd& localToWorld,
+                             Request& request)
+{
+    osg::Camera* camera = viewer->getCamera();
+    osg::Viewport* viewport = camera->getViewport();
+    if (!layers || !viewport) return false;
+
+    request.indices.clear();
+    for (unsigned i = 0; i < layers->getNumChildren(); ++i)
+    {
+        FeatureIndex* index = getFeatureIndex(layers->getChild(i));
+        if (index) request.indices.push_back(index);
+    }
+
+    request.windowToLocal = osg::Matrixd::inverse(
+        localToWorld * camera->getViewMatrix()
+        * camera->getProjectionMatrix() * viewport->computeWindowMatrix());
+    request.viewport.set(viewport->x(), viewport->y(), viewport->width(),
+                         viewport->height());
+    return true;
+}
 
-std::string getLandInfoAtIntersection(osg::Node* sceneRoot,
-                                      const osg::Vec3d& hitPoint)
+std::string LandInfoQuery::query(const Request& request)
 {
+    const osg::Matrixd& windowToLocal = request.windowToLocal;
+    const osg::Vec4d& viewport = request.viewport;
+
+    // Promien przez srodek okna, przeciety z plaszczyzna terenu (z = 0)
+    double x = viewport.x() + viewport.z() * 0.5;
+    double y = viewport.y() + viewport.w() * 0.5;
+
+    auto groundPoint = [&](double wx, double wy, osg::Vec2& out) {
+        osg::Vec3d nearPoint = osg::Vec3d(wx, wy, 0.0) * windowToLocal;
+        osg::Vec3d farPoint = osg::Vec3d(wx, wy, 1.0) * windowToLocal;
+        double dz = farPoint.z() - nearPoint.z();
+        if (std::abs(dz) < 1e-9) return false;
+        double t = -nearPoint.z() / dz;
+        if (t < 0.0) return false;
+        osg::Vec3d p = nearPoint + (farPoint - nearPoint) * t;
+        out.set(p.x(), p.y());
+        return true;
+    };
+
+    // Promien wyszukiwania odpowiada 5% szerokosci okna
+    osg::Vec2 center, edge;
+    if (!groundPoint(x, y, center)) return "";
+    float radius = 25.0f;
+    if (groundPoint(x + viewport.z() * 0.025, y, edge))
+        radius = (edge - center).length();
+
     std::ostringstream allInfo;
-    int hitCount = 0;
-
-    // Define a box around the hit point
-    osg::Viewport* viewport = viewer->getCamera()->getViewport();
-    double dx = viewport->width() * 0.05;
-    double dy = viewport->height() * 0.05;
-    double y = viewport->x() + viewport->width() * 0.5;
-    double x = viewport->x() + viewport->height() * 0.5;
-    osg::ref_ptr<osgUtil::PolytopeIntersector> picker =
-        new osgUtil::PolytopeIntersector(osgUtil::Intersector::WINDOW,
-                                         x - dx * 0.5, y - dy * 0.5,
-                                         x + dx * 0.5, y + dy * 0.5);
-    osgUtil::IntersectionVisitor iv(picker.get());
-    viewer->getCamera()->accept(iv);
-
-    if (picker->containsIntersections())
+    std::set<std::pair<std::string, std::string>> globalRecords;
+    constexpr std::size_t MAX_RECORDS = 3;
+    std::size_t collectedCount = 0;
+    std::vector<FeatureIndex::Hit> hits;
+    for (const osg::ref_ptr<FeatureIndex>& index : request.indices)
     {
-        std::set<osgSim::ShapeAttributeList*> processedSAL;
-        std::set<std::pair<std::string, std::string>> globalRecords;
-        constexpr std::size_t MAX_RECORDS = 3;
-        std::size_t collectedCount = 0;
-        for (const auto& intersection : picker->getIntersections())
+        index->query(center, radius, hits);
+        for (const FeatureIndex::Hit& hit : hits)
         {
-            if (intersection.drawable.valid())
-            {
-                osgSim::ShapeAttributeList* sal =
-                    dynamic_cast<osgSim::ShapeAttributeList*>(
-                        intersection.drawable->getUserData());
-                if (sal && processedSAL.find(sal) == processedSAL.end())
-                {
-                    processedSAL.insert(sal);
-                    hitCount++;
-                    bool hasData = false;
-                    std::string fclass;
-                    for (unsigned j = 0; j < sal->size(); j++)
-                    {
-                        const osgSim::ShapeAttribute& attr = (*sal)[j];
-                        std::string attrName = attr.getName();
-                        if (attrName != "fclass") continue;
-                        if (attr.getType() == osgSim::ShapeAttribute::STRING)
-                        {
-                            fclass = attr.getString();
-                            trim(fclass);
-                        }
-                        break;
-                    }
-                    if (fclass.empty()) continue;
-                    for (unsigned j = 0; j < sal->size(); j++)
-                    {
-                        const osgSim::ShapeAttribute& attr = (*sal)[j];
-                        std::string attrName = attr.getName();
-                        if (attrName != "name") continue;
-                        if (attr.getType() == osgSim::ShapeAttribute::STRING)
-                        {
-                            std::string att = attr.getString();
-                            trim(att);
-                            if (!att.empty())
-                            {
-                                if (collectedCount >= MAX_RECORDS)
-                                    break; // stop processing intersections
-                                auto key = std::make_pair(fclass, att);
-
-                                if (!globalRecords.insert(key).second) continue;
-
-                                std::string fclassPL = translateFclass(fclass);
-                                allInfo << fclassPL << ": " << att;
-                                ++collectedCount;
-                                hasData = true;
-                            }
-                        }
-                        break;
-                    }
-                    if (hasData) allInfo << "\n";
-                }
-            }
+            if (collectedCount >= MAX_RECORDS) break;
+
+            const FeatureIndex::Feature& feature =
+                index->getFeature(hit.feature);
+            auto key = std::make_pair(feature.fclass, feature.name);
+            if (!globalRecords.insert(key).second) continue;
+
+            allInfo << translateFclass(feature.fclass) << ": " << feature.name
+                    << "\n";
+            ++collectedCount;
         }
     }
 
-    if (hitCount > 0) return allInfo.str();
+    return allInfo.str();
+}
 
-    return "";
+void LandInfoQuery::run()
+{
+    while (!_quit)
+    {
+        if (!_requests.fetch())
+        {
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            _wake.wait_for(lock, std::chrono::milliseconds(20));
+            continue;
+        }
+
+        const Request& request = _requests.front();
+        if (request.generation != _generation) continue;
+
+        Result& result = _results.back();
+        result.generation = request.generation;
+        result.text = query(request);
+        _results.publish();
+    }
 }
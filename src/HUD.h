@@ -15,6 +15,14 @@
 #include <codecvt>
 #include <locale>
 #include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "feature_index.h"
+#include "triple_buffer.h"
 
 extern osg::ref_ptr<osgText::Text> g_hudText;
 extern osg::ref_ptr<osg::Uniform> g_hudAlpha;
@@ -25,8 +33,68 @@ extern float g_currentAlpha;
 osg::Camera* createHUD(const std::string& logoFile, float scale = 0.3f,
                        int winWidth = 1920, int winHeight = 1080);
 void hudSetText(const std::string& text);
-std::string getLandInfoAtIntersection(osg::Node* sceneRoot,
-                                      const osg::Vec3d& hitPoint);
+// Polish name of a feature class, the class itself if not translated
+std::string translateFclass(const std::string& fclass);
+
+/**
+ * Runs the land info queries of the HUD on a worker thread.
+ *
+ * submit() takes a snapshot of the camera pose and of the layer indices, so
+ * the worker never touches the scene graph; the text is picked up with
+ * poll() on a later frame. Every submit() or cancel() starts a new
+ * generation and results of older generations are dropped, so a query
+ * which finishes after the camera moved again is never shown.
+ */
+class LandInfoQuery : public osg::Referenced {
+public:
+    LandInfoQuery();
+
+    // Main thread: queries the ground point in the middle of the window
+    void submit(osg::Group* layers, const osg::Matrixd& localToWorld);
+
+    // Main thread: drops the pending query (camera started moving)
+    void cancel() { ++_generation; }
+
+    // Main thread: true once per submit() when its text is ready
+    bool poll(std::string& text);
+
+protected:
+    ~LandInfoQuery();
+
+private:
+    struct Request
+    {
+        unsigned generation = 0;
+        std::vector<osg::ref_ptr<FeatureIndex>> indices;
+        osg::Matrixd windowToLocal;
+        osg::Vec4d viewport; // x, y, width, height
+    };
+
+    struct Result
+    {
+        unsigned generation = 0;
+        std::string text;
+    };
+
+    // Indices of the layers and the window to local matrix of the view
+    static bool snapshot(osg::Group* layers, const osg::Matrixd& localToWorld,
+                         Request& request);
+    // Named features near the ground point in the middle of the window; only
+    // reads the immutable indices, safe to call from any thread
+    static std::string query(const Request& request);
+
+    void run();
+
+    std::atomic<unsigned> _generation;
+    unsigned _delivered;
+
+    std::thread _worker;
+    std::atomic<bool> _quit;
+    std::mutex _wakeMutex;
+    std::condition_variable _wake;
+    TripleBuffer<Request> _requests;
+    TripleBuffer<Result> _results;
+};
 const std::unordered_map<std::string, std::string> fclassPL = {
     { "residential", "osiedle" },
     { "living_street", "ulica mieszkalna" },
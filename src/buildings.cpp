@@ -19,6 +19,7 @@
 #include <osgUtil/Tessellator>
 
 #include <osg/Texture2D>
+#include <osg/TextureBuffer>
 #include <osg/StateSet>
 
 #include <filesystem>
@@ -29,8 +30,13 @@
 #include <algorithm>
 #include <random>
 #include <cmath>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
 
 #include "common.h"
+#include "feature_index.h"
+#include "partition.h"
 
 using namespace osg;
 
@@ -102,6 +108,34 @@ void main() {
 }
 )";
 
+// Wariant vertex shadera dla instancingu: transformacja instancji (xyz +
+// obrot wokol Z) czytana z bufora tekstury po gl_InstanceID
+const char* instancedVertSource = R"(
+#version 420 compatibility
+
+uniform samplerBuffer instanceData;
+
+out vec3 v_texCoord;
+out vec3 v_normal;
+out vec3 v_ecp;
+
+void main() {
+    vec4 inst = texelFetch(instanceData, gl_InstanceID);
+    float c = cos(inst.w);
+    float s = sin(inst.w);
+    mat2 rot = mat2(c, s, -s, c);
+
+    vec4 vertex = vec4(rot * gl_Vertex.xy + inst.xy, gl_Vertex.z + inst.z, 1.0);
+
+    v_texCoord = gl_MultiTexCoord0.xyz;
+    v_ecp = vec3(gl_ModelViewMatrix * vertex);
+    v_normal = vec3(rot * gl_Normal.xy, gl_Normal.z);
+    gl_Position = gl_ModelViewProjectionMatrix * vertex;
+}
+)";
+
+osg::ref_ptr<osg::Program> g_instancedProgram;
+
 osg::ref_ptr<osg::StateSet> loadRoofTexture(const std::string& texPath)
 {
     osg::ref_ptr<osg::Image> img = osgDB::readRefImageFile(texPath);
@@ -259,11 +293,297 @@ void extrude_simple(osg::Geode* geode, osg::Geometry* baseGeom, float hMeters,
     geode->addDrawable(roof);
 }
 
+/* ============================================================
+   Instancing powtarzalnych obrysow
+   ============================================================ */
+
+// krok kwantyzacji wierzcholkow i wysokosci (10 cm)
+constexpr float kFootprintQuantum = 0.1f;
+// mniejsze grupy nie oplacaja sie jako osobny draw call
+constexpr unsigned kMinInstances = 4;
+// limit instancji na jeden bufor (GL_MAX_TEXTURE_BUFFER_SIZE >= 65536)
+constexpr unsigned kMaxInstancesPerDraw = 4096;
+// bok komorki siatki, w ktorej zbierane sa instancje (jak kafel-lisc),
+// zeby kazda grupa miala maly bound i wlasny maly bufor
+constexpr float kInstanceCellSize = 500.0f;
+
+struct FootprintKey
+{
+    int roofIdx = -1;
+    long heightQ = 0;
+    std::vector<long> coords; // skwantyzowany, kanoniczny obrys (x0,y0,x1..)
+
+    bool operator==(const FootprintKey& other) const
+    {
+        return roofIdx == other.roofIdx && heightQ == other.heightQ
+            && coords == other.coords;
+    }
+};
+
+struct FootprintKeyHash
+{
+    size_t operator()(const FootprintKey& key) const
+    {
+        // FNV-1a
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&h](uint64_t v) {
+            h ^= v;
+            h *= 1099511628211ull;
+        };
+        mix((uint64_t)(int64_t)key.roofIdx);
+        mix((uint64_t)(int64_t)key.heightQ);
+        for (long c : key.coords) mix((uint64_t)(int64_t)c);
+        return (size_t)h;
+    }
+};
+
+struct FootprintInstance
+{
+    osg::Vec3 origin; // srodek obrysu w ukladzie lokalnym
+    float angle = 0.f; // obrot kanonicznego obrysu wokol Z
+    unsigned geomIdx = 0;
+};
+
+typedef std::unordered_map<FootprintKey, std::vector<FootprintInstance>,
+                           FootprintKeyHash>
+    FootprintGroups;
+
+/**
+ * Sprowadza obrys budynku do postaci kanonicznej niezaleznej od przesuniecia
+ * i obrotu: srodek obrysu w poczatku ukladu, najdluzsza krawedz wzdluz osi X,
+ * wierzcholki skwantyzowane. Przy kilku rownie dlugich krawedziach wybierany
+ * jest leksykograficznie najmniejszy zapis, dzieki czemu dwa przystajace
+ * obrysy zawsze daja ten sam klucz.
+ */
+bool canonicalize_footprint(const osg::Vec3Array& v, FootprintKey& key,
+                            FootprintInstance& inst)
+{
+    unsigned n = v.size();
+    // pierscien z shp jest zamkniety powtorzonym pierwszym wierzcholkiem
+    if (n > 1 && (v[0] - v[n - 1]).length2() < 1e-8f) --n;
+    if (n < 3) return false;
+
+    osg::Vec3 center;
+    for (unsigned i = 0; i < n; ++i) center += v[i];
+    center /= (float)n;
+    center.z() = v[0].z();
+
+    float maxLen = 0.f;
+    for (unsigned i = 0; i < n; ++i)
+        maxLen = std::max(maxLen, (v[(i + 1) % n] - v[i]).length());
+    if (maxLen < kFootprintQuantum) return false;
+
+    bool found = false;
+    std::vector<long> coords;
+    coords.reserve(n * 2);
+
+    for (unsigned e = 0; e < n; ++e)
+    {
+        osg::Vec3 edge = v[(e + 1) % n] - v[e];
+        if (maxLen - edge.length() > kFootprintQuantum) continue;
+
+        float angle = std::atan2(edge.y(), edge.x());
+        float c = std::cos(-angle);
+        float s = std::sin(-angle);
+
+        coords.clear();
+        for (unsigned k = 0; k < n; ++k)
+        {
+            osg::Vec3 p = v[(e + k) % n] - center;
+            coords.push_back(std::lround((p.x() * c - p.y() * s)
+                                         / kFootprintQuantum));
+            coords.push_back(std::lround((p.x() * s + p.y() * c)
+                                         / kFootprintQuantum));
+        }
+
+        if (!found || coords < key.coords)
+        {
+            key.coords = coords;
+            inst.angle = angle;
+            found = true;
+        }
+    }
+
+    inst.origin = center;
+    return found;
+}
+
+/**
+ * Buduje jedna geometrie budynku w ukladzie kanonicznym i rysuje ja
+ * instancyjnie dla calej grupy przystajacych obrysow. Transformacje instancji
+ * trafiaja do bufora tekstury czytanego w vertex shaderze.
+ */
+osg::Geode* create_instanced_group(osg::Geometry* baseGeom, float hMeters,
+                                   int roofIdx,
+                                   const FootprintInstance* instances,
+                                   unsigned count)
+{
+    const FootprintInstance& ref = instances[0];
+
+    osg::ref_ptr<osg::Geometry> proto =
+        new osg::Geometry(*baseGeom, osg::CopyOp::DEEP_COPY_ALL);
+    proto->setUserData(nullptr);
+
+    osg::Vec3Array* pv = dynamic_cast<osg::Vec3Array*>(proto->getVertexArray());
+    if (!pv) return nullptr;
+
+    float c = std::cos(-ref.angle);
+    float s = std::sin(-ref.angle);
+    float radius = 0.f;
+    for (unsigned i = 0; i < pv->size(); ++i)
+    {
+        osg::Vec3 p = (*pv)[i] - ref.origin;
+        (*pv)[i].set(p.x() * c - p.y() * s, p.x() * s + p.y() * c, p.z());
+        radius = std::max(
+            radius, osg::Vec2((*pv)[i].x(), (*pv)[i].y()).length());
+    }
+    pv->dirty();
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    extrude_simple(geode, proto, hMeters, roofIdx, 8.0f);
+
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->allocateImage(count, 1, 1, GL_RGBA, GL_FLOAT);
+    float* data = (float*)image->data();
+
+    osg::BoundingBox bb;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const FootprintInstance& inst = instances[i];
+        data[i * 4 + 0] = inst.origin.x();
+        data[i * 4 + 1] = inst.origin.y();
+        data[i * 4 + 2] = inst.origin.z();
+        data[i * 4 + 3] = inst.angle;
+
+        bb.expandBy(inst.origin - osg::Vec3(radius, radius, 0.f));
+        bb.expandBy(inst.origin + osg::Vec3(radius, radius, hMeters));
+    }
+
+    osg::ref_ptr<osg::TextureBuffer> tbo = new osg::TextureBuffer(image);
+    tbo->setInternalFormat(GL_RGBA32F_ARB);
+
+    for (unsigned i = 0; i < geode->getNumDrawables(); ++i)
+    {
+        osg::Geometry* g = geode->getDrawable(i)->asGeometry();
+        if (!g) continue;
+        for (unsigned j = 0; j < g->getNumPrimitiveSets(); ++j)
+            g->getPrimitiveSet(j)->setNumInstances(count);
+        // bound prototypu lezy w poczatku ukladu - culling musi widziec
+        // wszystkie instancje
+        g->setInitialBound(bb);
+        g->setUseDisplayList(false);
+        g->setUseVertexBufferObjects(true);
+    }
+
+    osg::StateSet* ss = geode->getOrCreateStateSet();
+    ss->setAttribute(g_instancedProgram, osg::StateAttribute::ON
+                                             | osg::StateAttribute::OVERRIDE);
+    ss->setTextureAttribute(1, tbo);
+    ss->addUniform(new osg::Uniform("instanceData", 1));
+
+    return geode.release();
+}
+
+/**
+ * Wykrywa przystajace obrysy (ten sam ksztalt, wysokosc i dach) i rysuje je
+ * instancyjnie, osobno w kazdej komorce siatki kInstanceCellSize: podzial
+ * warstwy na komorki i kafle przenosi grupe instancji w calosci, wiec nie
+ * moze ona obejmowac calego miasta. Zwraca liczbe budynkow obsluzonych przez
+ * instancing; ich indeksy sa zaznaczane w `instanced`.
+ */
+unsigned
+instance_footprints(const std::vector<osg::ref_ptr<osg::Geometry>>& geoms,
+                    const std::vector<float>& heights,
+                    const std::vector<int>& roofIdx, osg::Group* parent,
+                    std::vector<bool>& instanced)
+{
+    FootprintGroups groups;
+
+    for (unsigned i = 0; i < roofIdx.size(); ++i)
+    {
+        if (heights[i] <= 0.f) continue;
+        // tylko proste obrysy bez otworow
+        if (geoms[i]->getNumPrimitiveSets() != 1) continue;
+
+        osg::Vec3Array* v =
+            dynamic_cast<osg::Vec3Array*>(geoms[i]->getVertexArray());
+        if (!v) continue;
+
+        FootprintKey key;
+        FootprintInstance inst;
+        if (!canonicalize_footprint(*v, key, inst)) continue;
+
+        key.roofIdx = roofIdx[i];
+        key.heightQ = std::lround(heights[i] / kFootprintQuantum);
+        inst.geomIdx = i;
+        groups[std::move(key)].push_back(inst);
+    }
+
+    if (!g_instancedProgram.valid())
+    {
+        g_instancedProgram = new osg::Program;
+        g_instancedProgram->addShader(
+            new osg::Shader(osg::Shader::VERTEX, instancedVertSource));
+        g_instancedProgram->addShader(
+            new osg::Shader(osg::Shader::FRAGMENT, fragSource));
+    }
+
+    unsigned numInstanced = 0, numGroups = 0, savedVerts = 0;
+    for (const auto& group : groups)
+    {
+        if (group.second.size() < kMinInstances) continue;
+
+        std::map<std::pair<int, int>, std::vector<FootprintInstance>> cells;
+        for (const FootprintInstance& inst : group.second)
+        {
+            int x = (int)std::floor(inst.origin.x() / kInstanceCellSize);
+            int y = (int)std::floor(inst.origin.y() / kInstanceCellSize);
+            cells[{ x, y }].push_back(inst);
+        }
+
+        // W komorkach z malo kopiami budynki zostaja zwykla geometria
+        for (const auto& cell : cells)
+        {
+            const std::vector<FootprintInstance>& insts = cell.second;
+            if (insts.size() < kMinInstances) continue;
+
+            unsigned first = insts[0].geomIdx;
+            unsigned protoVerts =
+                geoms[first]->getVertexArray()->getNumElements();
+
+            for (unsigned start = 0; start < insts.size();
+                 start += kMaxInstancesPerDraw)
+            {
+                unsigned count = std::min<unsigned>(kMaxInstancesPerDraw,
+                                                    insts.size() - start);
+                osg::Geode* geode = create_instanced_group(
+                    geoms[insts[start].geomIdx].get(), heights[first],
+                    group.first.roofIdx, &insts[start], count);
+                if (!geode) continue;
+                parent->addChild(geode);
+                ++numGroups;
+            }
+
+            for (const FootprintInstance& inst : insts)
+                instanced[inst.geomIdx] = true;
+
+            numInstanced += insts.size();
+            // dach + 6 wierzcholkow scian na krawedz
+            savedVerts += (insts.size() - 1) * protoVerts * 7;
+        }
+    }
+
+    std::cout << "[BUILDINGS] Instancing: " << numInstanced
+              << " budynkow w " << numGroups << " grupach, ~" << savedVerts
+              << " wierzcholkow mniej\n";
+    return numInstanced;
+}
+
 /* ============================================================
    Metadata + extrusion loop
    ============================================================ */
 
-void parse_meta_data(osg::Node* model)
+void parse_meta_data(osg::Node* model, osg::Group* instances)
 {
     osg::Group* group = model ? model->asGroup() : nullptr;
     if (!group) return;
@@ -316,28 +636,36 @@ void parse_meta_data(osg::Node* model)
     std::cout << "[INFO] Extruding buildings...\n";
     geode->removeChildren(0, geode->getNumChildren());
 
+    // losowe wybieranie tekstur dachów
+    std::vector<int> roofIndices(K, -1);
     for (unsigned i = 0; i < K; ++i)
     {
         float h = heights[i];
-        if (h <= 0.f) continue;
+        if (h <= 0.f || g_roofTextures.empty()) continue;
 
-        // losowe wybieranie tekstur dachów
-        int roofIdx = -1;
-        if (!g_roofTextures.empty())
-        {
-            uint32_t seed = 2166136261u;
+        uint32_t seed = 2166136261u;
 
 
-            seed ^= (uint32_t)i + 0x9e3779b9u + (seed << 6) + (seed >> 2);
+        seed ^= (uint32_t)i + 0x9e3779b9u + (seed << 6) + (seed >> 2);
 
 
-            uint32_t hc = (uint32_t)std::lround(h * 100.0f);
-            seed ^= hc + 0x9e3779b9u + (seed << 6) + (seed >> 2);
+        uint32_t hc = (uint32_t)std::lround(h * 100.0f);
+        seed ^= hc + 0x9e3779b9u + (seed << 6) + (seed >> 2);
 
-            roofIdx = (int)(seed % (uint32_t)g_roofTextures.size() - 1);
-        }
+        roofIndices[i] = (int)(seed % (uint32_t)g_roofTextures.size() - 1);
+    }
 
-        extrude_simple(geode, geoms[i].get(), h, roofIdx, 8.0f);
+    // przystajace obrysy rysowane instancyjnie, reszta ekstrudowana osobno
+    std::vector<bool> instanced(K, false);
+    if (instances)
+        instance_footprints(geoms, heights, roofIndices, instances, instanced);
+
+    for (unsigned i = 0; i < K; ++i)
+    {
+        float h = heights[i];
+        if (h <= 0.f || instanced[i]) continue;
+
+        extrude_simple(geode, geoms[i].get(), h, roofIndices[i], 8.0f);
 
 
         if (i > 0 && (i % 10000) == 0)
@@ -367,8 +695,9 @@ osg::Node* process_buildings(osg::Matrixd& ltw, const std::string& file_path)
                   << buildings_file_path << std::endl;
         return nullptr;
     }
+    // v4: instancje w komorkach (v3: geometria w komorkach, v2: instancje)
     std::string cacheFileName =
-        "buildings_" + std::to_string(fileSize) + ".osgb";
+        "buildings_v4_" + std::to_string(fileSize) + ".osgb";
     const std::filesystem::path cachePath =
         std::filesystem::current_path() / cacheFileName;
 
@@ -382,6 +711,7 @@ osg::Node* process_buildings(osg::Matrixd& ltw, const std::string& file_path)
         if (cached.valid())
         {
             std::cout << "[BUILDINGS] Cache OK, pomijam generowanie\n";
+            attachFeatureIndex(cached.get(), cachePath.string());
             return cached.release();
         }
         std::cout << "[BUILDINGS] Cache uszkodzony, generuje od nowa\n";
@@ -445,15 +775,21 @@ osg::Node* process_buildings(osg::Matrixd& ltw, const std::string& file_path)
     }
 
 
-    // 5) Extrusion
+    // 5) Extrusion (+ instancing powtarzalnych obrysow)
+    osg::ref_ptr<osg::Group> buildings_root = new osg::Group;
+    buildings_root->addChild(buildings_model);
+
     std::cout << "[BUILDINGS] Extruding buildings...\n";
-    parse_meta_data(buildings_model.get());
+    parse_meta_data(buildings_model.get(), buildings_root.get());
+    partitionLayer(buildings_root.get(), "buildings");
 
     // 6) Zapis cache
     std::cout << "[BUILDINGS] Zapisuje cache: " << cachePath.string() << "\n";
-    bool ok = osgDB::writeNodeFile(*buildings_model, cachePath.string());
+    bool ok = osgDB::writeNodeFile(*buildings_root, cachePath.string());
     std::cout << "[BUILDINGS] writeNodeFile -> " << (ok ? "OK" : "FAIL")
               << "\n";
 
-    return buildings_model.release();
+    // Instancjonowane budynki nie maja atrybutow i nie trafiaja do indeksu
+    attachFeatureIndex(buildings_root.get(), cachePath.string());
+    return buildings_root.release();
 }
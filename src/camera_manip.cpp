@@ -9,6 +9,10 @@ constexpr double kMinRadiusThreshold = 1000.0;
 constexpr double kZoomInFactor = 0.8;
 constexpr double kZoomOutFactor = 1.25;
 constexpr double kTiltSensitivity = 100.0;
+// Time constant of the speed smoothing, in seconds
+constexpr double kVelocitySmoothing = 0.15;
+// Largest zoom factor of a prediction (e^2)
+constexpr double kMaxPredictedZoom = 2.0;
 
 // Clamps the tilt angle to valid range [0, maxTilt]
 double clampTilt(double tilt, double maxTilt)
@@ -59,7 +63,8 @@ void computeLocalFrame(const osg::Vec3d& center, osg::Vec3d& up,
 GoogleMapsManipulator::GoogleMapsManipulator()
     : _distance(100.0), _lastX(0), _lastY(0), _center(0, 0, 1), _tiltDeg(0.0),
       _isMoving(false), _lastMoveTime(0.0), _movementTimeout(0.2),
-      _maxTiltDeg(75.0)
+      _maxTiltDeg(75.0), _zoomRate(0.0), _lastDistance(100.0),
+      _lastSampleTime(-1.0)
 {}
 
 bool GoogleMapsManipulator::isMoving() const
@@ -80,6 +85,44 @@ void GoogleMapsManipulator::setMaxTiltDeg(double degrees)
 
 double GoogleMapsManipulator::getMaxTiltDeg() const { return _maxTiltDeg; }
 
+osg::Matrixd
+GoogleMapsManipulator::getPredictedInverseMatrix(double seconds) const
+{
+    // Pan continues along the tangent plane, zoom keeps its rate
+    osg::Vec3d center = _center + _velocity * seconds;
+    double zoom =
+        std::clamp(_zoomRate * seconds, -kMaxPredictedZoom, kMaxPredictedZoom);
+    double distance = std::max(_distance * std::exp(zoom), kMinDistance);
+    return computeInverseMatrix(center, distance);
+}
+
+void GoogleMapsManipulator::updateVelocity(double time)
+{
+    double dt = time - _lastSampleTime;
+    if (_lastSampleTime >= 0.0 && dt > 0.0)
+    {
+        osg::Vec3d velocity = (_center - _lastCenter) / dt;
+        double zoomRate = std::log(_distance / _lastDistance) / dt;
+
+        // Exponential smoothing independent of the frame rate
+        double alpha = std::min(dt / kVelocitySmoothing, 1.0);
+        _velocity += (velocity - _velocity) * alpha;
+        _zoomRate += (zoomRate - _zoomRate) * alpha;
+    }
+    _lastCenter = _center;
+    _lastDistance = _distance;
+    _lastSampleTime = time;
+}
+
+void GoogleMapsManipulator::resetVelocity()
+{
+    // Jumps (home, switching manipulators) are not movement
+    _velocity.set(0.0, 0.0, 0.0);
+    _zoomRate = 0.0;
+    _lastCenter = _center;
+    _lastDistance = _distance;
+}
+
 void GoogleMapsManipulator::resetFromBounds()
 {
     if (!_node.valid()) return;
@@ -88,6 +131,7 @@ void GoogleMapsManipulator::resetFromBounds()
     const osg::BoundingSphere bs = _node->getBound();
     _center = bs.center();
     _distance = bs.radius() * 0.5;
+    resetVelocity();
 }
 
 void GoogleMapsManipulator::setNode(osg::Node* node)
@@ -107,9 +151,16 @@ void GoogleMapsManipulator::home(const osgGA::GUIEventAdapter&,
 
 osg::Matrixd GoogleMapsManipulator::getInverseMatrix() const
 {
-    // Compute local coordinate frame at the current center point
+    return computeInverseMatrix(_center, _distance);
+}
+
+osg::Matrixd
+GoogleMapsManipulator::computeInverseMatrix(const osg::Vec3d& center,
+                                            double distance) const
+{
+    // Compute local coordinate frame at the center point
     osg::Vec3d up, east, north;
-    computeLocalFrame(_center, up, east, north);
+    computeLocalFrame(center, up, east, north);
 
     // Calculate eye position based on tilt angle
     // Blend between 'up' (0° tilt) and 'north' (90° tilt) directions
@@ -117,7 +168,7 @@ osg::Matrixd GoogleMapsManipulator::getInverseMatrix() const
     osg::Vec3d offset = (-north * std::sin(tiltRad)) + (up * std::cos(tiltRad));
     offset.normalize();
 
-    osg::Vec3d eye = _center + offset * _distance;
+    osg::Vec3d eye = center + offset * distance;
 
     // Ensure camera doesn't go below the surface
     // The "Earth Radius" is simply the distance from (0,0,0) to the city.
@@ -133,7 +184,7 @@ osg::Matrixd GoogleMapsManipulator::getInverseMatrix() const
     }
 
     // Return view matrix (camera looks from eye to center, with north as up)
-    return osg::Matrixd::lookAt(eye, _center, north);
+    return osg::Matrixd::lookAt(eye, center, north);
 }
 
 osg::Matrixd GoogleMapsManipulator::getMatrix() const
@@ -214,6 +265,7 @@ void GoogleMapsManipulator::setByMatrix(const osg::Matrixd& matrix)
         {
             _center = eye + lookVector * t;
             _distance = std::max(t, kMinDistance);
+            resetVelocity();
             return;
         }
     }
@@ -235,6 +287,7 @@ void GoogleMapsManipulator::setByInverseMatrix(const osg::Matrixd& matrix)
  * - Right mouse drag: Adjust the tilt angle (vertical rotation)
  * - Mouse scroll: Zoom in/out by adjusting distance
  * - Home key: Reset camera to default view
+ * - Frame: Sample the pan and zoom speed for getPredictedInverseMatrix()
  *
  * The function also tracks movement state for animation and rendering purposes.
  *
@@ -324,6 +377,11 @@ bool GoogleMapsManipulator::handle(const osgGA::GUIEventAdapter& ea,
             }
             return false;
 
+        case osgGA::GUIEventAdapter::FRAME:
+            // Not consumed, other handlers need frame events too
+            updateVelocity(ea.getTime());
+            return false;
+
         default: return false;
     }
 }
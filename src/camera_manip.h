@@ -21,6 +21,13 @@ public:
 
     double getMaxTiltDeg() const;
 
+    /**
+     * View matrix of the camera `seconds` ahead, extrapolated from the pan
+     * and zoom speed of the last frames. Equal to getInverseMatrix() when
+     * the camera stands still.
+     */
+    osg::Matrixd getPredictedInverseMatrix(double seconds) const;
+
     void resetFromBounds();
 
     void setNode(osg::Node* node) override;
@@ -41,6 +48,13 @@ public:
                 osgGA::GUIActionAdapter& aa) override;
 
 private:
+    osg::Matrixd computeInverseMatrix(const osg::Vec3d& center,
+                                      double distance) const;
+
+    void updateVelocity(double time);
+
+    void resetVelocity();
+
     osg::observer_ptr<osg::Node> _node;
     osg::Vec3d _center;
     double _distance;
@@ -51,6 +65,13 @@ private:
     double _lastMoveTime;
     double _movementTimeout;
     double _maxTiltDeg;
+
+    // Pan speed (world units/s) and zoom speed (log distance/s), smoothed
+    osg::Vec3d _velocity;
+    double _zoomRate;
+    osg::Vec3d _lastCenter;
+    double _lastDistance;
+    double _lastSampleTime;
 };
 
 #endif // CAMERA_MANIP_H
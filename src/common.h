@@ -9,7 +9,8 @@ osg::Node* process_water(osg::Matrixd& ltw, const std::string & file_path);
 osg::Node* process_buildings(osg::Matrixd& ltw, const std::string & file_path);
 osg::Node* process_roads(osg::Matrixd& ltw, const std::string & file_path);
 osg::Node* process_labels(osg::Matrixd& ltw, const std::string& file_path,
-                          float textSize, float iconSize, float maxViewDist);
+                          float textSize, float iconSize, float maxViewDist,
+                          unsigned maxLabels);
 
 
 extern osg::ref_ptr<osg::EllipsoidModel> ellipsoid;
@@ -0,0 +1,600 @@
+#include "feature_index.h"
+
+#include <osg/Drawable>
+#include <osg/NodeVisitor>
+#include <osg/TemplatePrimitiveFunctor>
+#include <osg/Timer>
+#include <osgDB/FileNameUtils>
+#include <osgSim/ShapeAttribute>
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+// Max number of children of an R-tree node
+const unsigned NODE_SIZE = 16;
+
+const char FILE_MAGIC[8] = { 'O', 'S', 'G', 'M', 'A', 'P', 'F', 'I' };
+const uint32_t FILE_VERSION = 2;
+
+static std::string trimmed(const char* s)
+{
+    std::string str = s ? s : "";
+    auto notSpace = [](unsigned char ch) { return !std::isspace(ch); };
+    str.erase(str.begin(), std::find_if(str.begin(), str.end(), notSpace));
+    str.erase(std::find_if(str.rbegin(), str.rend(), notSpace).base(),
+              str.end());
+    return str;
+}
+
+static float cross(const osg::Vec2& a, const osg::Vec2& b)
+{
+    return a.x() * b.y() - a.y() * b.x();
+}
+
+static float distanceToSegment(const osg::Vec2& p, const osg::Vec2& a,
+                               const osg::Vec2& b)
+{
+    osg::Vec2 ab = b - a;
+    float len2 = ab.length2();
+    float t = len2 > 0.0f ? ((p - a) * ab) / len2 : 0.0f;
+    t = std::max(0.0f, std::min(1.0f, t));
+    return (a + ab * t - p).length();
+}
+
+static bool insideTriangle(const osg::Vec2& p, const osg::Vec2& a,
+                           const osg::Vec2& b, const osg::Vec2& c)
+{
+    float d1 = cross(b - a, p - a);
+    float d2 = cross(c - b, p - b);
+    float d3 = cross(a - c, p - c);
+    bool hasNeg = d1 < 0 || d2 < 0 || d3 < 0;
+    bool hasPos = d1 > 0 || d2 > 0 || d3 > 0;
+    return !(hasNeg && hasPos);
+}
+
+// Sort-Tile-Recursive order: vertical slices by x center, each slice
+// sorted by y center, so that consecutive runs of NODE_SIZE are compact
+template <typename B>
+static std::vector<unsigned> strOrder(const std::vector<B>& boxes)
+{
+    const unsigned n = (unsigned)boxes.size();
+    std::vector<unsigned> order(n);
+    for (unsigned i = 0; i < n; ++i) order[i] = i;
+
+    auto centerX = [&](unsigned i) { return boxes[i].minX + boxes[i].maxX; };
+    auto centerY = [&](unsigned i) { return boxes[i].minY + boxes[i].maxY; };
+
+    std::sort(order.begin(), order.end(),
+              [&](unsigned a, unsigned b) { return centerX(a) < centerX(b); });
+
+    unsigned leaves = (n + NODE_SIZE - 1) / NODE_SIZE;
+    unsigned slices = (unsigned)std::ceil(std::sqrt((double)leaves));
+    unsigned sliceSize = std::max(slices, 1u) * NODE_SIZE;
+
+    for (unsigned s = 0; s < n; s += sliceSize)
+    {
+        auto first = order.begin() + s;
+        auto last = order.begin() + std::min(s + sliceSize, n);
+        std::sort(first, last, [&](unsigned a, unsigned b) {
+            return centerY(a) < centerY(b);
+        });
+    }
+    return order;
+}
+
+/****************************************************************************/
+
+struct PrimitiveCollector
+{
+    osg::Matrixd matrix;
+    std::vector<osg::Vec2>* tris = nullptr;
+    std::vector<osg::Vec2>* segs = nullptr;
+
+    osg::Vec2 project(const osg::Vec3& v) const
+    {
+        osg::Vec3d p = osg::Vec3d(v) * matrix;
+        return osg::Vec2(p.x(), p.y());
+    }
+
+    void operator()(const osg::Vec3&, bool) {}
+
+    void operator()(const osg::Vec3& v1, const osg::Vec3& v2, bool)
+    {
+        segs->push_back(project(v1));
+        segs->push_back(project(v2));
+    }
+
+    void operator()(const osg::Vec3& v1, const osg::Vec3& v2,
+                    const osg::Vec3& v3, bool)
+    {
+        osg::Vec2 a = project(v1), b = project(v2), c = project(v3);
+
+        // Sciany budynkow w rzucie na XY sa zdegenerowane
+        if (std::fabs(cross(b - a, c - a)) < 1e-6f) return;
+
+        tris->push_back(a);
+        tris->push_back(b);
+        tris->push_back(c);
+    }
+
+    void operator()(const osg::Vec3& v1, const osg::Vec3& v2,
+                    const osg::Vec3& v3, const osg::Vec3& v4, bool temp)
+    {
+        (*this)(v1, v2, v3, temp);
+        (*this)(v1, v3, v4, temp);
+    }
+};
+
+class FeatureCollector : public osg::NodeVisitor {
+public:
+    struct RawFeature
+    {
+        FeatureIndex::Feature feature;
+        std::vector<osg::Vec2> tris;
+        std::vector<osg::Vec2> segs;
+    };
+
+    std::vector<RawFeature> features;
+
+    FeatureCollector(): osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Drawable& drawable) override
+    {
+        osgSim::ShapeAttributeList* sal =
+            dynamic_cast<osgSim::ShapeAttributeList*>(drawable.getUserData());
+        if (!sal) return;
+
+        // Ten sam rekord moze byc rozbity na kilka drawable
+        auto it = _bySal.find(sal);
+        if (it == _bySal.end())
+        {
+            FeatureIndex::Feature feature = FeatureIndex::readFeature(*sal);
+
+            // HUD pokazuje tylko nazwane obiekty z klasa
+            if (feature.fclass.empty() || feature.name.empty())
+            {
+                _bySal[sal] = ~0u;
+                return;
+            }
+
+            it = _bySal.emplace(sal, (unsigned)features.size()).first;
+            features.emplace_back();
+            features.back().feature = feature;
+        }
+        if (it->second == ~0u) return;
+
+        RawFeature& raw = features[it->second];
+        osg::TemplatePrimitiveFunctor<PrimitiveCollector> functor;
+        functor.matrix = osg::computeLocalToWorld(getNodePath());
+        functor.tris = &raw.tris;
+        functor.segs = &raw.segs;
+        drawable.accept(functor);
+    }
+
+private:
+    std::map<const osgSim::ShapeAttributeList*, unsigned> _bySal;
+};
+
+/****************************************************************************/
+
+void FeatureIndex::Box::init()
+{
+    minX = minY = FLT_MAX;
+    maxX = maxY = -FLT_MAX;
+}
+
+void FeatureIndex::Box::expandBy(const osg::Vec2& p)
+{
+    minX = std::min(minX, p.x());
+    minY = std::min(minY, p.y());
+    maxX = std::max(maxX, p.x());
+    maxY = std::max(maxY, p.y());
+}
+
+void FeatureIndex::Box::expandBy(const Box& b)
+{
+    minX = std::min(minX, b.minX);
+    minY = std::min(minY, b.minY);
+    maxX = std::max(maxX, b.maxX);
+    maxY = std::max(maxY, b.maxY);
+}
+
+FeatureIndex::Feature FeatureIndex::readFeature(
+    const osgSim::ShapeAttributeList& sal)
+{
+    Feature feature;
+    for (const osgSim::ShapeAttribute& attr : sal)
+    {
+        if (attr.getType() != osgSim::ShapeAttribute::STRING) continue;
+        if (attr.getName() == "fclass")
+            feature.fclass = trimmed(attr.getString());
+        else if (attr.getName() == "name")
+            feature.name = trimmed(attr.getString());
+    }
+    return feature;
+}
+
+FeatureIndex* FeatureIndex::build(osg::Node* layer)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    FeatureCollector collector;
+    if (layer) layer->accept(collector);
+
+    std::vector<FeatureCollector::RawFeature>& raw = collector.features;
+    raw.erase(std::remove_if(raw.begin(), raw.end(),
+                             [](const FeatureCollector::RawFeature& f) {
+                                 return f.tris.empty() && f.segs.empty();
+                             }),
+              raw.end());
+
+    std::vector<Box> boxes(raw.size());
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        boxes[i].init();
+        for (const osg::Vec2& p : raw[i].tris) boxes[i].expandBy(p);
+        for (const osg::Vec2& p : raw[i].segs) boxes[i].expandBy(p);
+    }
+
+    // Obiekty w kolejnosci STR - liscie drzewa obejmuja ciagle zakresy
+    FeatureIndex* index = new FeatureIndex;
+    index->_triStart.push_back(0);
+    index->_segStart.push_back(0);
+    for (unsigned i : strOrder(boxes))
+    {
+        index->_features.push_back(raw[i].feature);
+        index->_boxes.push_back(boxes[i]);
+        index->_triPoints.insert(index->_triPoints.end(), raw[i].tris.begin(),
+                                 raw[i].tris.end());
+        index->_segPoints.insert(index->_segPoints.end(), raw[i].segs.begin(),
+                                 raw[i].segs.end());
+        index->_triStart.push_back((unsigned)index->_triPoints.size());
+        index->_segStart.push_back((unsigned)index->_segPoints.size());
+    }
+    index->buildTree();
+
+    std::cout << "[FEATURES] Indeks: " << index->getNumFeatures()
+              << " obiektow, " << index->_nodes.size() << " wezlow, "
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms" << std::endl;
+    return index;
+}
+
+void FeatureIndex::buildTree()
+{
+    _nodes.clear();
+    const unsigned n = getNumFeatures();
+    if (n == 0) return;
+
+    for (unsigned i = 0; i < n; i += NODE_SIZE)
+    {
+        TreeNode node;
+        node.first = i;
+        node.count = std::min(NODE_SIZE, n - i);
+        node.leaf = 1;
+        node.box.init();
+        for (unsigned f = i; f < i + node.count; ++f)
+            node.box.expandBy(_boxes[f]);
+        _nodes.push_back(node);
+    }
+
+    unsigned levelBegin = 0;
+    unsigned levelEnd = (unsigned)_nodes.size();
+    while (levelEnd - levelBegin > 1)
+    {
+        std::vector<Box> boxes;
+        for (unsigned i = levelBegin; i < levelEnd; ++i)
+            boxes.push_back(_nodes[i].box);
+
+        std::vector<TreeNode> level;
+        for (unsigned k : strOrder(boxes))
+            level.push_back(_nodes[levelBegin + k]);
+        std::copy(level.begin(), level.end(), _nodes.begin() + levelBegin);
+
+        for (unsigned i = levelBegin; i < levelEnd; i += NODE_SIZE)
+        {
+            TreeNode node;
+            node.first = i;
+            node.count = std::min(NODE_SIZE, levelEnd - i);
+            node.leaf = 0;
+            node.box.init();
+            for (unsigned c = i; c < i + node.count; ++c)
+                node.box.expandBy(_nodes[c].box);
+            _nodes.push_back(node);
+        }
+
+        levelBegin = levelEnd;
+        levelEnd = (unsigned)_nodes.size();
+    }
+}
+
+float FeatureIndex::distance(unsigned feature, const osg::Vec2& p) const
+{
+    float best = FLT_MAX;
+
+    for (unsigned k = _triStart[feature]; k < _triStart[feature + 1]; k += 3)
+    {
+        const osg::Vec2& a = _triPoints[k];
+        const osg::Vec2& b = _triPoints[k + 1];
+        const osg::Vec2& c = _triPoints[k + 2];
+        if (insideTriangle(p, a, b, c)) return 0.0f;
+
+        best = std::min(best, distanceToSegment(p, a, b));
+        best = std::min(best, distanceToSegment(p, b, c));
+        best = std::min(best, distanceToSegment(p, c, a));
+    }
+
+    for (unsigned k = _segStart[feature]; k < _segStart[feature + 1]; k += 2)
+        best = std::min(best,
+                        distanceToSegment(p, _segPoints[k], _segPoints[k + 1]));
+
+    return best;
+}
+
+void FeatureIndex::query(const osg::Vec2& p, float radius,
+                         std::vector<Hit>& hits) const
+{
+    hits.clear();
+    if (_nodes.empty()) return;
+
+    Box q;
+    q.minX = p.x() - radius;
+    q.minY = p.y() - radius;
+    q.maxX = p.x() + radius;
+    q.maxY = p.y() + radius;
+
+    std::vector<unsigned> stack;
+    stack.push_back((unsigned)_nodes.size() - 1);
+    while (!stack.empty())
+    {
+        const TreeNode& node = _nodes[stack.back()];
+        stack.pop_back();
+        if (!node.box.overlaps(q)) continue;
+
+        for (unsigned i = node.first; i < node.first + node.count; ++i)
+        {
+            if (!node.leaf)
+            {
+                stack.push_back(i);
+                continue;
+            }
+            if (!_boxes[i].overlaps(q)) continue;
+
+            float d = distance(i, p);
+            if (d <= radius) hits.push_back({ i, d });
+        }
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+        return a.distance < b.distance;
+    });
+}
+
+/****************************************************************************/
+
+// Size and modification time of the layer cache an index is built from,
+// zeros if there is no such file (layers of a tile pyramid)
+static void getSourceStamp(const std::string& source, uint64_t& size,
+                           int64_t& time)
+{
+    std::error_code ec;
+    size = 0;
+    time = 0;
+    uint64_t fileSize = std::filesystem::file_size(source, ec);
+    if (ec) return;
+    auto writeTime = std::filesystem::last_write_time(source, ec);
+    if (ec) return;
+    size = fileSize;
+    time = (int64_t)writeTime.time_since_epoch().count();
+}
+
+// Bytes of the file after the read position
+static uint64_t remaining(std::ifstream& in, uint64_t length)
+{
+    std::streamoff pos = in.tellg();
+    if (pos < 0 || (uint64_t)pos > length) return 0;
+    return length - (uint64_t)pos;
+}
+
+template <typename T>
+static void writeVector(std::ofstream& out, const std::vector<T>& v)
+{
+    uint32_t size = (uint32_t)v.size();
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    if (size)
+        out.write(reinterpret_cast<const char*>(v.data()), sizeof(T) * size);
+}
+
+template <typename T>
+static bool readVector(std::ifstream& in, uint64_t length, std::vector<T>& v)
+{
+    uint32_t size = 0;
+    if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+    // Uszkodzony plik: rozmiar wiekszy niz reszta pliku
+    if (size > remaining(in, length) / sizeof(T)) return false;
+    v.resize(size);
+    if (size)
+        in.read(reinterpret_cast<char*>(v.data()), sizeof(T) * size);
+    return (bool)in;
+}
+
+static void writeString(std::ofstream& out, const std::string& s)
+{
+    uint32_t size = (uint32_t)s.size();
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(s.data(), size);
+}
+
+static bool readString(std::ifstream& in, uint64_t length, std::string& s)
+{
+    uint32_t size = 0;
+    if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+    if (size > remaining(in, length)) return false;
+    s.resize(size);
+    if (size) in.read(&s[0], size);
+    return (bool)in;
+}
+
+// Offsets of the primitives of each feature: from 0 to the number of points,
+// never decreasing, whole primitives of `size` points
+static bool validStarts(const std::vector<unsigned>& start, size_t points,
+                        unsigned size)
+{
+    if (start.empty() || start.front() != 0 || start.back() != points)
+        return false;
+    for (size_t i = 1; i < start.size(); ++i)
+    {
+        if (start[i] < start[i - 1] || (start[i] - start[i - 1]) % size)
+            return false;
+    }
+    return true;
+}
+
+bool FeatureIndex::isConsistent() const
+{
+    if (!validStarts(_triStart, _triPoints.size(), 3)
+        || !validStarts(_segStart, _segPoints.size(), 2))
+        return false;
+
+    // Liscie wskazuja obiekty, wezly wewnetrzne wczesniejsze wezly (bez
+    // cykli w zapytaniu)
+    for (size_t i = 0; i < _nodes.size(); ++i)
+    {
+        const TreeNode& node = _nodes[i];
+        uint64_t end = (uint64_t)node.first + node.count;
+        if (end > (node.leaf ? _boxes.size() : i)) return false;
+    }
+    return true;
+}
+
+bool FeatureIndex::write(const std::string& path,
+                         const std::string& source) const
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    getSourceStamp(source, sourceSize, sourceTime);
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    out.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    out.write(reinterpret_cast<const char*>(&FILE_VERSION),
+              sizeof(FILE_VERSION));
+    out.write(reinterpret_cast<const char*>(&sourceSize), sizeof(sourceSize));
+    out.write(reinterpret_cast<const char*>(&sourceTime), sizeof(sourceTime));
+
+    uint32_t n = (uint32_t)_features.size();
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    for (const Feature& f : _features)
+    {
+        writeString(out, f.fclass);
+        writeString(out, f.name);
+    }
+
+    writeVector(out, _boxes);
+    writeVector(out, _triStart);
+    writeVector(out, _triPoints);
+    writeVector(out, _segStart);
+    writeVector(out, _segPoints);
+    writeVector(out, _nodes);
+    return (bool)out;
+}
+
+FeatureIndex* FeatureIndex::read(const std::string& path,
+                                 const std::string& source)
+{
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    getSourceStamp(source, sourceSize, sourceTime);
+
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return nullptr;
+    uint64_t length = (uint64_t)std::max<std::streamoff>(in.tellg(), 0);
+    in.seekg(0);
+
+    char magic[sizeof(FILE_MAGIC)];
+    uint32_t version = 0, n = 0;
+    uint64_t size = 0;
+    int64_t time = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    in.read(reinterpret_cast<char*>(&time), sizeof(time));
+    in.read(reinterpret_cast<char*>(&n), sizeof(n));
+    if (!in || !std::equal(magic, magic + sizeof(magic), FILE_MAGIC)
+        || version != FILE_VERSION)
+        return nullptr;
+
+    // Indeks zbudowany z innego pliku cache warstwy
+    if (size != sourceSize || time != sourceTime) return nullptr;
+
+    // Kazda cecha ma co najmniej dwa rozmiary napisow
+    if (n > remaining(in, length) / (2 * sizeof(uint32_t))) return nullptr;
+
+    osg::ref_ptr<FeatureIndex> index = new FeatureIndex;
+    index->_features.resize(n);
+    for (Feature& f : index->_features)
+    {
+        if (!readString(in, length, f.fclass)
+            || !readString(in, length, f.name))
+            return nullptr;
+    }
+
+    if (!readVector(in, length, index->_boxes)
+        || !readVector(in, length, index->_triStart)
+        || !readVector(in, length, index->_triPoints)
+        || !readVector(in, length, index->_segStart)
+        || !readVector(in, length, index->_segPoints)
+        || !readVector(in, length, index->_nodes))
+        return nullptr;
+
+    if (index->_boxes.size() != n || index->_triStart.size() != n + 1
+        || index->_segStart.size() != n + 1 || !index->isConsistent())
+        return nullptr;
+
+    return index.release();
+}
+
+/****************************************************************************/
+
+osg::Node* attachFeatureIndex(osg::Node* layer, const std::string& cacheFile)
+{
+    if (!layer) return layer;
+
+    std::string indexFile;
+    if (!cacheFile.empty())
+        indexFile = osgDB::getNameLessExtension(cacheFile) + ".fidx";
+
+    osg::ref_ptr<FeatureIndex> index;
+    if (!indexFile.empty()) index = FeatureIndex::read(indexFile, cacheFile);
+
+    if (index.valid())
+    {
+        std::cout << "[FEATURES] Wczytano indeks [" << indexFile << "]"
+                  << std::endl;
+    }
+    else
+    {
+        index = FeatureIndex::build(layer);
+        if (!indexFile.empty() && !index->write(indexFile, cacheFile))
+            std::cout << "[FEATURES] Nie mozna zapisac " << indexFile
+                      << std::endl;
+    }
+
+    layer->setUserData(index.get());
+    return layer;
+}
+
+FeatureIndex* getFeatureIndex(osg::Node* layer)
+{
+    if (!layer) return nullptr;
+    return dynamic_cast<FeatureIndex*>(layer->getUserData());
+}
@@ -0,0 +1,120 @@
+#ifndef FEATURE_INDEX_H
+#define FEATURE_INDEX_H
+
+#include <osg/Referenced>
+#include <osg/Node>
+#include <osg/Vec2>
+#include <osgSim/ShapeAttribute>
+
+#include <string>
+#include <vector>
+
+/**
+ * Spatial index of the named features (shapefile records) of one layer.
+ *
+ * Feature bounding boxes on the local XY plane are stored in a packed
+ * R-tree built bottom-up with Sort-Tile-Recursive. Candidates found in the
+ * tree are refined against the feature's own geometry: point in polygon for
+ * areas (their triangles) and distance to the polyline for lines.
+ */
+class FeatureIndex : public osg::Referenced {
+public:
+    struct Feature
+    {
+        std::string fclass;
+        std::string name;
+    };
+
+    struct Hit
+    {
+        unsigned feature;
+        float distance;
+    };
+
+    // Class and name of a shapefile record, both trimmed
+    static Feature readFeature(const osgSim::ShapeAttributeList& sal);
+
+    // Collects the named features of a layer subgraph (local frame)
+    static FeatureIndex* build(osg::Node* layer);
+
+    /**
+     * Index files carry the size and modification time of the layer cache
+     * they were built from; read() rejects a file that does not match it
+     * or whose sizes do not fit in the file.
+     *
+     * @param source Layer cache the index belongs to; without such a file
+     *               (layers of a tile pyramid) there is nothing to compare
+     */
+    static FeatureIndex* read(const std::string& path,
+                              const std::string& source);
+    bool write(const std::string& path, const std::string& source) const;
+
+    /**
+     * Finds features within `radius` of a ground point.
+     *
+     * @param p Point on the local XY plane
+     * @param radius Search radius in meters
+     * @param[out] hits Found features, nearest first
+     */
+    void query(const osg::Vec2& p, float radius, std::vector<Hit>& hits) const;
+
+    unsigned getNumFeatures() const { return (unsigned)_features.size(); }
+    const Feature& getFeature(unsigned i) const { return _features[i]; }
+
+private:
+    struct Box
+    {
+        float minX, minY, maxX, maxY;
+
+        void init();
+        void expandBy(const osg::Vec2& p);
+        void expandBy(const Box& b);
+        bool overlaps(const Box& b) const
+        {
+            return minX <= b.maxX && maxX >= b.minX && minY <= b.maxY
+                   && maxY >= b.minY;
+        }
+    };
+
+    // Leaf nodes point to features, inner nodes to other tree nodes;
+    // children of a node are always contiguous
+    struct TreeNode
+    {
+        Box box;
+        unsigned first;
+        unsigned count;
+        unsigned leaf;
+    };
+
+    void buildTree();
+    float distance(unsigned feature, const osg::Vec2& p) const;
+
+    // Offsets and tree links stay within the arrays (checked after read())
+    bool isConsistent() const;
+
+    std::vector<Feature> _features;
+    std::vector<Box> _boxes;
+
+    // feature geometry: 3 points per triangle, 2 per segment
+    std::vector<unsigned> _triStart;
+    std::vector<osg::Vec2> _triPoints;
+    std::vector<unsigned> _segStart;
+    std::vector<osg::Vec2> _segPoints;
+
+    std::vector<TreeNode> _nodes; // root is the last node
+};
+
+/**
+ * Attaches a feature index to a layer node (as its user data). The index
+ * is cached next to the layer cache (same name, .fidx extension) and only
+ * rebuilt if that file is missing or was built from another layer cache;
+ * an empty cache name disables caching.
+ *
+ * @return The layer, for use in return statements
+ */
+osg::Node* attachFeatureIndex(osg::Node* layer, const std::string& cacheFile);
+
+// Index attached to a layer by attachFeatureIndex(), or nullptr
+FeatureIndex* getFeatureIndex(osg::Node* layer);
+
+#endif // FEATURE_INDEX_H
@@ -0,0 +1,539 @@
+#include "label_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+
+// Screen bucket size (pixels) used for overlap tests
+const float BUCKET_SIZE = 64.0f;
+
+// Upper bound of the spatial grid resolution (per axis)
+const int MAX_GRID_DIM = 1024;
+
+// Labels shown in the previous frame compete as if they were this much
+// closer (squared distance factor), which keeps them from flickering
+const float HYSTERESIS = 0.6f;
+
+// Minimum spacing (meters) between labels at the finest zoom level, every
+// coarser level doubles it
+const float ZOOM_SPACING = 30.0f;
+
+// Camera height (meters) below which the finest zoom level is used
+const float ZOOM_BASE_HEIGHT = 300.0f;
+
+// Radius (meters) used to measure local label density
+const float DENSITY_RADIUS = 150.0f;
+
+// Minimum number of hidden labels in a cell to show a cluster marker
+const unsigned CLUSTER_MIN_SIZE = 3;
+
+// Sparse hash grid used by the ranking passes
+struct HashGrid
+{
+    float cellSize;
+    std::unordered_map<long long, std::vector<unsigned>> cells;
+
+    explicit HashGrid(float size): cellSize(size) {}
+
+    static long long key(int cx, int cy)
+    {
+        return (long long)(((unsigned long long)(unsigned)cx << 32)
+                           | (unsigned)cy);
+    }
+
+    void insert(unsigned i, float x, float y)
+    {
+        int cx = (int)std::floor(x / cellSize);
+        int cy = (int)std::floor(y / cellSize);
+        cells[key(cx, cy)].push_back(i);
+    }
+
+    // Calls f(index) for every item in the cells around (x, y); the radius
+    // of interest must not exceed the cell size
+    template <typename F>
+    void forNeighbours(float x, float y, F f) const
+    {
+        int cx = (int)std::floor(x / cellSize);
+        int cy = (int)std::floor(y / cellSize);
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                auto it = cells.find(key(cx + dx, cy + dy));
+                if (it == cells.end()) continue;
+                for (unsigned i : it->second)
+                    if (!f(i)) return;
+            }
+        }
+    }
+};
+
+LabelEngine::LabelEngine(float maxViewDist, float textSize, float iconSize,
+                         unsigned maxLabels)
+    : _maxViewDist(maxViewDist), _textSize(textSize), _iconSize(iconSize),
+      _maxLabels(maxLabels), _cellSize(1.0f), _gridMinX(0.0f),
+      _gridMinY(0.0f), _gridW(0), _gridH(0), _bucketsW(0), _bucketsH(0),
+      _ranked(false), _hasCache(false), _cachedVpW(0.0), _cachedVpH(0.0),
+      _quit(false)
+{}
+
+LabelEngine::~LabelEngine()
+{
+    if (_worker.joinable())
+    {
+        _quit = true;
+        _wake.notify_one();
+        _worker.join();
+    }
+}
+
+unsigned LabelEngine::addLabel(const osg::Vec3& position, float widthPixels,
+                               float importance)
+{
+    _x.push_back(position.x());
+    _y.push_back(position.y());
+    _z.push_back(position.z());
+    _halfWidth.push_back(std::max(widthPixels, _iconSize) * 0.5f);
+    _importance.push_back(importance);
+    _clusterSize.push_back(0);
+    return (unsigned)_x.size() - 1;
+}
+
+void LabelEngine::setLabelWidth(unsigned i, float widthPixels)
+{
+    _halfWidth[i] = std::max(widthPixels, _iconSize) * 0.5f;
+}
+
+unsigned LabelEngine::zoomLevelForHeight(float height)
+{
+    float ratio = std::max(height / ZOOM_BASE_HEIGHT, 1.0f);
+    int level = (int)ZOOM_LEVELS - 1 - (int)std::floor(std::log2(ratio));
+    return (unsigned)std::max(level, 0);
+}
+
+void LabelEngine::rank()
+{
+    if (_ranked) return;
+    _ranked = true;
+
+    const unsigned n = getNumLabels();
+
+    // Gestosc lokalna - w zatloczonych miejscach waznosc spada
+    HashGrid density(DENSITY_RADIUS);
+    for (unsigned i = 0; i < n; ++i) density.insert(i, _x[i], _y[i]);
+
+    const float r2 = DENSITY_RADIUS * DENSITY_RADIUS;
+    _score.resize(n);
+    for (unsigned i = 0; i < n; ++i)
+    {
+        unsigned neighbours = 0;
+        density.forNeighbours(_x[i], _y[i], [&](unsigned j) {
+            float dx = _x[j] - _x[i];
+            float dy = _y[j] - _y[i];
+            if (j != i && dx * dx + dy * dy <= r2) ++neighbours;
+            return true;
+        });
+        _score[i] = std::max(_importance[i], 0.01f)
+                    / (1.0f + 0.25f * std::log2(1.0f + neighbours));
+    }
+
+    std::vector<unsigned> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return _score[a] > _score[b];
+    });
+
+    // Zachlanne rozmieszczenie poziom po poziomie, od najdalszego; etykieta
+    // widoczna na poziomie L jest tez widoczna na wszystkich blizszych
+    _minZoom.assign(n, ZOOM_LEVELS - 1);
+    _maxZoom.assign(n, ZOOM_LEVELS - 1);
+    std::vector<bool> placed(n, false);
+    for (unsigned level = 0; level + 1 < ZOOM_LEVELS; ++level)
+    {
+        float spacing = ZOOM_SPACING * float(1 << (ZOOM_LEVELS - 1 - level));
+        float spacing2 = spacing * spacing;
+        HashGrid grid(spacing);
+
+        for (unsigned i : order)
+        {
+            if (!placed[i])
+            {
+                bool free = true;
+                grid.forNeighbours(_x[i], _y[i], [&](unsigned j) {
+                    float dx = _x[j] - _x[i];
+                    float dy = _y[j] - _y[i];
+                    free = dx * dx + dy * dy >= spacing2;
+                    return free;
+                });
+                if (!free) continue;
+
+                placed[i] = true;
+                _minZoom[i] = level;
+            }
+            grid.insert(i, _x[i], _y[i]);
+        }
+    }
+
+    unsigned perLevel[ZOOM_LEVELS] = {};
+    for (unsigned i = 0; i < n; ++i) ++perLevel[_minZoom[i]];
+
+    std::cout << "[LABELS] Piramida:";
+    for (unsigned level = 0; level < ZOOM_LEVELS; ++level)
+        std::cout << " " << perLevel[level];
+    std::cout << std::endl;
+
+    addClusters();
+}
+
+void LabelEngine::addClusters()
+{
+    const unsigned n = getNumLabels();
+
+    struct Cluster
+    {
+        double x = 0.0, y = 0.0, z = 0.0;
+        unsigned count = 0;
+    };
+
+    unsigned numClusters = 0;
+    for (unsigned level = 0; level + 1 < ZOOM_LEVELS; ++level)
+    {
+        // Komorka klastra = dwukrotny odstep etykiet na tym poziomie
+        float cellSize =
+            2.0f * ZOOM_SPACING * float(1 << (ZOOM_LEVELS - 1 - level));
+
+        std::unordered_map<long long, unsigned> cellToCluster;
+        std::vector<Cluster> clusters;
+        for (unsigned i = 0; i < n; ++i)
+        {
+            if (_minZoom[i] <= level) continue; // widoczna na tym poziomie
+
+            long long key =
+                HashGrid::key((int)std::floor(_x[i] / cellSize),
+                              (int)std::floor(_y[i] / cellSize));
+            auto it = cellToCluster.find(key);
+            if (it == cellToCluster.end())
+            {
+                it = cellToCluster.emplace(key, (unsigned)clusters.size())
+                         .first;
+                clusters.emplace_back();
+            }
+
+            Cluster& c = clusters[it->second];
+            c.x += _x[i];
+            c.y += _y[i];
+            c.z += _z[i];
+            ++c.count;
+        }
+
+        for (const Cluster& c : clusters)
+        {
+            if (c.count < CLUSTER_MIN_SIZE) continue;
+
+            _x.push_back(float(c.x / c.count));
+            _y.push_back(float(c.y / c.count));
+            _z.push_back(float(c.z / c.count));
+            _halfWidth.push_back(_iconSize * 0.5f);
+            _importance.push_back(0.0f);
+            _score.push_back(2.0f + std::log2((float)c.count));
+            _minZoom.push_back(level);
+            _maxZoom.push_back(level);
+            _clusterSize.push_back(c.count);
+            ++numClusters;
+        }
+    }
+
+    std::cout << "[LABELS] Klastry: " << numClusters << std::endl;
+}
+
+template <typename T> static uint64_t vectorBytes(const std::vector<T>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+uint64_t LabelEngine::getMemoryUsage() const
+{
+    return vectorBytes(_x) + vectorBytes(_y) + vectorBytes(_z)
+           + vectorBytes(_halfWidth) + vectorBytes(_importance)
+           + vectorBytes(_score) + vectorBytes(_minZoom)
+           + vectorBytes(_maxZoom) + vectorBytes(_clusterSize)
+           + vectorBytes(_cellStart) + vectorBytes(_cellItems)
+           + vectorBytes(_cellLevelEnd);
+}
+
+void LabelEngine::build()
+{
+    _cellStart.clear();
+    _cellItems.clear();
+    _gridW = _gridH = 0;
+
+    const unsigned n = getNumLabels();
+    if (n == 0) return;
+
+    rank();
+    const unsigned total = getNumLabels(); // z klastrami
+
+    float minX = _x[0], maxX = _x[0];
+    float minY = _y[0], maxY = _y[0];
+    for (unsigned i = 1; i < total; ++i)
+    {
+        minX = std::min(minX, _x[i]);
+        maxX = std::max(maxX, _x[i]);
+        minY = std::min(minY, _y[i]);
+        maxY = std::max(maxY, _y[i]);
+    }
+
+    // Komorka o boku polowy zasiegu - zapytanie obejmuje ok. 5x5 komorek
+    _cellSize = std::max(_maxViewDist * 0.5f, 1.0f);
+    float extent = std::max(maxX - minX, maxY - minY);
+    if (extent / _cellSize > MAX_GRID_DIM - 1)
+        _cellSize = extent / (MAX_GRID_DIM - 1);
+
+    _gridMinX = minX;
+    _gridMinY = minY;
+    _gridW = (int)((maxX - minX) / _cellSize) + 1;
+    _gridH = (int)((maxY - minY) / _cellSize) + 1;
+
+    // Counting sort of label indices into cells
+    std::vector<unsigned> cellOf(total);
+    _cellStart.assign(_gridW * _gridH + 1, 0);
+    for (unsigned i = 0; i < total; ++i)
+    {
+        int cx = std::min((int)((_x[i] - minX) / _cellSize), _gridW - 1);
+        int cy = std::min((int)((_y[i] - minY) / _cellSize), _gridH - 1);
+        cellOf[i] = cy * _gridW + cx;
+        ++_cellStart[cellOf[i] + 1];
+    }
+    for (size_t c = 1; c < _cellStart.size(); ++c)
+        _cellStart[c] += _cellStart[c - 1];
+
+    std::vector<unsigned> fill(_cellStart.begin(), _cellStart.end() - 1);
+    _cellItems.resize(total);
+    for (unsigned i = 0; i < total; ++i) _cellItems[fill[cellOf[i]]++] = i;
+
+    // W komorce: rosnaco po poziomie, potem malejaco po waznosci
+    const int numCells = _gridW * _gridH;
+    _cellLevelEnd.resize(numCells * ZOOM_LEVELS);
+    for (int c = 0; c < numCells; ++c)
+    {
+        auto first = _cellItems.begin() + _cellStart[c];
+        auto last = _cellItems.begin() + _cellStart[c + 1];
+        std::sort(first, last, [&](unsigned a, unsigned b) {
+            if (_minZoom[a] != _minZoom[b]) return _minZoom[a] < _minZoom[b];
+            return _score[a] > _score[b];
+        });
+
+        unsigned k = _cellStart[c];
+        for (unsigned level = 0; level < ZOOM_LEVELS; ++level)
+        {
+            while (k < _cellStart[c + 1] && _minZoom[_cellItems[k]] <= level)
+                ++k;
+            _cellLevelEnd[c * ZOOM_LEVELS + level] = k;
+        }
+    }
+
+    _wasAccepted.assign(total, 0);
+    _cachedAccepted.clear();
+    _hasCache = false;
+
+    std::cout << "[LABELS] Siatka " << _gridW << "x" << _gridH
+              << " (komorka " << _cellSize << " m) dla " << total << " etykiet"
+              << std::endl;
+
+    if (!_worker.joinable()) _worker = std::thread(&LabelEngine::run, this);
+}
+
+void LabelEngine::submitView(const osg::Matrixd& modelView,
+                             const osg::Matrixd& projection,
+                             const osg::Viewport& viewport)
+{
+    ViewSnapshot& view = _views.back();
+    view.modelView = modelView;
+    view.projection = projection;
+    view.width = viewport.width();
+    view.height = viewport.height();
+    _views.publish();
+    _wake.notify_one();
+}
+
+const std::vector<unsigned>& LabelEngine::getLatestAccepted()
+{
+    _results.fetch();
+    return _results.front();
+}
+
+void LabelEngine::run()
+{
+    while (!_quit)
+    {
+        if (!_views.fetch())
+        {
+            // Timeout zabezpiecza przed zgubionym powiadomieniem
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            _wake.wait_for(lock, std::chrono::milliseconds(5));
+            continue;
+        }
+
+        if (declutter(_views.front(), _results.back())) _results.publish();
+    }
+}
+
+bool LabelEngine::overlapsAccepted(const ScreenBox& box) const
+{
+    int bx0 = std::max((int)(box.minX / BUCKET_SIZE), 0);
+    int by0 = std::max((int)(box.minY / BUCKET_SIZE), 0);
+    int bx1 = std::min((int)(box.maxX / BUCKET_SIZE), _bucketsW - 1);
+    int by1 = std::min((int)(box.maxY / BUCKET_SIZE), _bucketsH - 1);
+
+    for (int by = by0; by <= by1; ++by)
+        for (int bx = bx0; bx <= bx1; ++bx)
+            for (unsigned b : _buckets[by * _bucketsW + bx])
+                if (box.overlaps(_acceptedBoxes[b])) return true;
+
+    return false;
+}
+
+void LabelEngine::insertAccepted(const ScreenBox& box)
+{
+    unsigned id = (unsigned)_acceptedBoxes.size();
+    _acceptedBoxes.push_back(box);
+
+    int bx0 = std::max((int)(box.minX / BUCKET_SIZE), 0);
+    int by0 = std::max((int)(box.minY / BUCKET_SIZE), 0);
+    int bx1 = std::min((int)(box.maxX / BUCKET_SIZE), _bucketsW - 1);
+    int by1 = std::min((int)(box.maxY / BUCKET_SIZE), _bucketsH - 1);
+
+    for (int by = by0; by <= by1; ++by)
+        for (int bx = bx0; bx <= bx1; ++bx)
+            _buckets[by * _bucketsW + bx].push_back(id);
+}
+
+bool LabelEngine::declutter(const ViewSnapshot& view,
+                            std::vector<unsigned>& accepted)
+{
+    const osg::Matrixd& modelView = view.modelView;
+    const osg::Matrixd& projection = view.projection;
+    const double vpW = view.width;
+    const double vpH = view.height;
+
+    // Kamera stoi - poprzedni wynik jest nadal poprawny
+    if (_hasCache && vpW == _cachedVpW && vpH == _cachedVpH
+        && modelView == _cachedModelView && projection == _cachedProjection)
+        return false;
+
+    accepted.clear();
+    if (_gridW == 0 || _maxLabels == 0) return false;
+
+    // Macierz okna jak osg::Viewport::computeWindowMatrix() dla x=y=0
+    osg::Matrixd projWin = projection * osg::Matrixd::translate(1, 1, 1)
+                           * osg::Matrixd::scale(0.5 * vpW, 0.5 * vpH, 0.5);
+
+    // Pozycja kamery w ukladzie lokalnym etykiet
+    osg::Vec3d eye = osg::Matrixd::inverse(modelView).getTrans();
+    const unsigned zoom = zoomLevelForHeight((float)eye.z());
+
+    // Na dalszych poziomach piramida ogranicza gestosc, wiec zasieg rosnie
+    const float viewDist =
+        _maxViewDist * float(1 << (ZOOM_LEVELS - 1 - zoom));
+
+    int cx0 = (int)std::floor((eye.x() - viewDist - _gridMinX) / _cellSize);
+    int cy0 = (int)std::floor((eye.y() - viewDist - _gridMinY) / _cellSize);
+    int cx1 = (int)std::floor((eye.x() + viewDist - _gridMinX) / _cellSize);
+    int cy1 = (int)std::floor((eye.y() + viewDist - _gridMinY) / _cellSize);
+    cx0 = std::max(cx0, 0);
+    cy0 = std::max(cy0, 0);
+    cx1 = std::min(cx1, _gridW - 1);
+    cy1 = std::min(cy1, _gridH - 1);
+
+    _candidates.clear();
+    const float maxDist2 = viewDist * viewDist;
+    const float boxHeight = _textSize + _iconSize;
+
+    for (int cy = cy0; cy <= cy1; ++cy)
+    {
+        for (int cx = cx0; cx <= cx1; ++cx)
+        {
+            int cell = cy * _gridW + cx;
+            unsigned end = _cellLevelEnd[cell * ZOOM_LEVELS + zoom];
+            for (unsigned k = _cellStart[cell]; k < end; ++k)
+            {
+                unsigned i = _cellItems[k];
+                if (_maxZoom[i] < zoom) continue; // klaster dalszego poziomu
+
+                osg::Vec3d eyePos =
+                    osg::Vec3d(_x[i], _y[i], _z[i]) * modelView;
+
+                if (eyePos.z() > 0) continue;
+
+                float dist2 = (float)eyePos.length2();
+                if (dist2 > maxDist2) continue;
+
+                osg::Vec3d screenPos = eyePos * projWin;
+                if (screenPos.x() < 0 || screenPos.x() > vpW
+                    || screenPos.y() < 0 || screenPos.y() > vpH)
+                    continue;
+
+                // Wazniejsze etykiety wygrywaja z blizszymi
+                float priority = dist2 / (_score[i] * _score[i]);
+
+                Candidate c;
+                c.priority = _wasAccepted[i] ? priority * HYSTERESIS : priority;
+                c.index = i;
+                c.box.minX = screenPos.x() - _halfWidth[i] - PADDING;
+                c.box.maxX = screenPos.x() + _halfWidth[i] + PADDING;
+                c.box.minY = screenPos.y() - (_iconSize / 2.0f) - PADDING;
+                c.box.maxY = screenPos.y() + boxHeight + PADDING;
+                _candidates.push_back(c);
+            }
+        }
+    }
+
+    // Screen bucket grid, cleared instead of reallocated each frame
+    int bw = (int)(vpW / BUCKET_SIZE) + 1;
+    int bh = (int)(vpH / BUCKET_SIZE) + 1;
+    if (bw != _bucketsW || bh != _bucketsH)
+    {
+        _bucketsW = bw;
+        _bucketsH = bh;
+        _buckets.assign(bw * bh, std::vector<unsigned>());
+    }
+    else
+    {
+        for (auto& bucket : _buckets) bucket.clear();
+    }
+    _acceptedBoxes.clear();
+
+    // Min-heap by priority; popping stops as soon as the budget is full,
+    // so only the labels that are actually considered get ordered
+    auto farther = [](const Candidate& a, const Candidate& b) {
+        return a.priority > b.priority;
+    };
+    std::make_heap(_candidates.begin(), _candidates.end(), farther);
+
+    auto heapEnd = _candidates.end();
+    while (heapEnd != _candidates.begin() && accepted.size() < _maxLabels)
+    {
+        std::pop_heap(_candidates.begin(), heapEnd, farther);
+        --heapEnd;
+
+        const Candidate& c = *heapEnd;
+        if (overlapsAccepted(c.box)) continue;
+
+        insertAccepted(c.box);
+        accepted.push_back(c.index);
+    }
+
+    for (unsigned i : _cachedAccepted) _wasAccepted[i] = 0;
+    for (unsigned i : accepted) _wasAccepted[i] = 1;
+
+    _cachedAccepted = accepted;
+    _cachedModelView = modelView;
+    _cachedProjection = projection;
+    _cachedVpW = vpW;
+    _cachedVpH = vpH;
+    _hasCache = true;
+    return true;
+}
@@ -0,0 +1,220 @@
+#ifndef LABEL_ENGINE_H
+#define LABEL_ENGINE_H
+
+#include <osg/Referenced>
+#include <osg/Matrixd>
+#include <osg/Viewport>
+#include <osg/Vec3>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "triple_buffer.h"
+
+// Spacing kept between label boxes (pixels)
+const float PADDING = 2.0f;
+
+// Number of zoom levels of the label pyramid, level 0 is the farthest
+const unsigned ZOOM_LEVELS = 6;
+
+/**
+ * Label placement (declutter) engine.
+ *
+ * Label anchors live in flat structure-of-arrays storage bucketed in a
+ * uniform grid over the local XY plane, so a view only visits labels from
+ * the cells within view distance. Candidates are ordered lazily with a heap
+ * (a partial sort that stops once the label budget is filled) and overlap
+ * tests go through a screen-space bucket grid instead of comparing against
+ * every accepted box.
+ *
+ * Results are temporally coherent: while the view is unchanged the previous
+ * accepted set is returned as is, and while the camera moves labels that
+ * were shown in the previous frame are favoured (hysteresis), so they do
+ * not flicker when competing with a label at a similar distance.
+ *
+ * Labels are ranked once in build(): the importance given by the caller
+ * (type, name quality) is weighted down in dense areas, and a greedy pass
+ * assigns every label the coarsest zoom level at which it keeps a minimum
+ * spacing to the more important labels. The grid cells keep labels sorted
+ * by that level, so a view only ever touches the labels of its zoom band.
+ * Labels hidden at a coarse level are grouped per grid cell into cluster
+ * markers (one per cell, showing the count) that exist only on that level.
+ *
+ * Placement runs on a worker thread: the cull traversal only submits the
+ * current view and reads the most recently published result, so labels
+ * lag at most a frame behind the camera but never stall the frame.
+ */
+class LabelEngine : public osg::Referenced {
+public:
+    /**
+     * @param maxViewDist Labels farther from the camera are not drawn
+     * @param textSize Text height in pixels
+     * @param iconSize Icon size in pixels
+     * @param maxLabels Label budget per frame
+     */
+    LabelEngine(float maxViewDist, float textSize, float iconSize,
+                unsigned maxLabels);
+
+    /**
+     * Registers a label anchored at `position` (local frame).
+     *
+     * @param widthPixels On-screen width of the label text
+     * @param importance Rank of the label (> 0), higher is shown first
+     * @return Index of the label
+     */
+    unsigned addLabel(const osg::Vec3& position, float widthPixels,
+                      float importance);
+
+    /**
+     * Ranks the labels and appends the cluster markers of the coarse zoom
+     * levels as new entries (after the regular labels). Called by build()
+     * if it was not called before.
+     */
+    void rank();
+
+    // Ranks the labels, builds the spatial grid and starts the worker
+    // thread, call after the last addLabel()
+    void build();
+
+    // Zoom level (0..ZOOM_LEVELS-1) for a camera at the given height
+    static unsigned zoomLevelForHeight(float height);
+
+    // Zoom band in which the label is shown
+    unsigned getMinZoom(unsigned i) const { return _minZoom[i]; }
+    unsigned getMaxZoom(unsigned i) const { return _maxZoom[i]; }
+
+    // Number of labels represented by a cluster marker, 0 for a label
+    unsigned getClusterSize(unsigned i) const { return _clusterSize[i]; }
+
+    osg::Vec3 getPosition(unsigned i) const
+    {
+        return osg::Vec3(_x[i], _y[i], _z[i]);
+    }
+
+    // Updates the on-screen width, e.g. of a cluster marker after rank()
+    void setLabelWidth(unsigned i, float widthPixels);
+
+    /**
+     * Hands the current view to the worker thread (called from cull).
+     *
+     * @param modelView Local-to-eye matrix of the labels group
+     * @param projection Projection matrix
+     * @param viewport Current viewport
+     */
+    void submitView(const osg::Matrixd& modelView,
+                    const osg::Matrixd& projection,
+                    const osg::Viewport& viewport);
+
+    // Indices of accepted labels from the latest finished placement, in
+    // priority order. Valid until the next call, only for the cull thread.
+    const std::vector<unsigned>& getLatestAccepted();
+
+    unsigned getNumLabels() const { return (unsigned)_x.size(); }
+
+    unsigned getMaxLabels() const { return _maxLabels; }
+
+    // Bytes of the label arrays and of the grid; the per-frame scratch of
+    // the worker, bounded by the label budget, is not included
+    uint64_t getMemoryUsage() const;
+
+protected:
+    virtual ~LabelEngine();
+
+private:
+    struct ScreenBox
+    {
+        float minX, maxX;
+        float minY, maxY;
+
+        bool overlaps(const ScreenBox& other) const
+        {
+            if (maxX < other.minX) return false;
+            if (minX > other.maxX) return false;
+            if (maxY < other.minY) return false;
+            if (minY > other.maxY) return false;
+            return true;
+        }
+    };
+
+    struct Candidate
+    {
+        float priority;
+        unsigned index;
+        ScreenBox box;
+    };
+
+    struct ViewSnapshot
+    {
+        osg::Matrixd modelView;
+        osg::Matrixd projection;
+        double width = 0.0;
+        double height = 0.0;
+    };
+
+    /**
+     * Selects labels to draw for the given view (worker thread).
+     *
+     * @param[out] accepted Indices of accepted labels, in priority order
+     * @return false if the view did not change and `accepted` was not
+     *         written
+     */
+    bool declutter(const ViewSnapshot& view, std::vector<unsigned>& accepted);
+
+    void run();
+
+    void addClusters();
+
+    bool overlapsAccepted(const ScreenBox& box) const;
+    void insertAccepted(const ScreenBox& box);
+
+    float _maxViewDist;
+    float _textSize;
+    float _iconSize;
+    unsigned _maxLabels;
+
+    // label anchors (structure of arrays)
+    std::vector<float> _x, _y, _z;
+    std::vector<float> _halfWidth;
+    std::vector<float> _importance;
+    std::vector<float> _score;
+    std::vector<unsigned char> _minZoom;
+    std::vector<unsigned char> _maxZoom;
+    std::vector<unsigned> _clusterSize;
+    bool _ranked;
+
+    // uniform grid over the local XY plane (CSR layout)
+    float _cellSize;
+    float _gridMinX, _gridMinY;
+    int _gridW, _gridH;
+    std::vector<unsigned> _cellStart;
+    std::vector<unsigned> _cellItems;
+    std::vector<unsigned> _cellLevelEnd; // per cell and zoom level
+
+    // per-frame scratch, reused to avoid allocations
+    std::vector<Candidate> _candidates;
+    std::vector<ScreenBox> _acceptedBoxes;
+    std::vector<std::vector<unsigned>> _buckets;
+    int _bucketsW, _bucketsH;
+
+    // result of the previous frame
+    bool _hasCache;
+    osg::Matrixd _cachedModelView;
+    osg::Matrixd _cachedProjection;
+    double _cachedVpW, _cachedVpH;
+    std::vector<unsigned> _cachedAccepted;
+    std::vector<unsigned char> _wasAccepted;
+
+    // worker thread and its mailboxes
+    std::thread _worker;
+    std::atomic<bool> _quit;
+    std::mutex _wakeMutex;
+    std::condition_variable _wake;
+    TripleBuffer<ViewSnapshot> _views;
+    TripleBuffer<std::vector<unsigned>> _results;
+};
+
+#endif // LABEL_ENGINE_H
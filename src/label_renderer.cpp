@@ -0,0 +1,479 @@
+#include "label_renderer.h"
+#include "memory_budget.h"
+
+#include <osg/BlendFunc>
+#include <osg/Depth>
+#include <osg/Program>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgText/String>
+
+#include <algorithm>
+#include <iostream>
+
+// labels.vert
+static const char* labelVertShader = R"(
+#version 420 compatibility
+uniform vec2 u_viewport;
+out vec2 v_tc;
+out vec4 v_col;
+flat out float v_icon;
+void main()
+{
+    // Kotwica w przestrzeni sceny, przesuniecie w pikselach ekranu
+    vec4 clip = gl_ModelViewProjectionMatrix * gl_Vertex;
+    clip.xy += gl_MultiTexCoord1.xy * 2.0 / u_viewport * clip.w;
+    gl_Position = clip;
+    v_tc = gl_MultiTexCoord0.xy;
+    v_col = gl_Color;
+    v_icon = gl_MultiTexCoord1.z;
+}
+)";
+// labels.frag
+static const char* labelFragShader = R"(
+#version 420 compatibility
+uniform sampler2D u_atlas;
+in vec2 v_tc;
+in vec4 v_col;
+flat in float v_icon;
+out vec4 fragColor;
+void main()
+{
+    vec4 tex = texture(u_atlas, v_tc);
+    if (v_icon > 0.5)
+    {
+        fragColor = tex * v_col;
+        return;
+    }
+
+    // Obrys tekstu z sasiednich tekseli maski glifu
+    vec2 d = 1.5 / vec2(textureSize(u_atlas, 0));
+    float outline = 0.0;
+    outline = max(outline, texture(u_atlas, v_tc + vec2(d.x, 0.0)).a);
+    outline = max(outline, texture(u_atlas, v_tc - vec2(d.x, 0.0)).a);
+    outline = max(outline, texture(u_atlas, v_tc + vec2(0.0, d.y)).a);
+    outline = max(outline, texture(u_atlas, v_tc - vec2(0.0, d.y)).a);
+    outline = max(outline, texture(u_atlas, v_tc + d).a);
+    outline = max(outline, texture(u_atlas, v_tc - d).a);
+    outline = max(outline, texture(u_atlas, v_tc + vec2(d.x, -d.y)).a);
+    outline = max(outline, texture(u_atlas, v_tc + vec2(-d.x, d.y)).a);
+
+    float alpha = max(tex.a, outline);
+    if (alpha < 0.01) discard;
+    fragColor = vec4(v_col.rgb * (tex.a / alpha), alpha * v_col.a);
+}
+)";
+
+const int ATLAS_SIZE = 1024;
+const int ATLAS_PADDING = 4;
+const int ICON_ATLAS_SIZE = 64;
+
+// Glyph rasterization resolution (pixels per em)
+const unsigned GLYPH_RESOLUTION = 32;
+
+// Extra texels around each glyph quad so the outline is not clipped
+const int GLYPH_BORDER = 2;
+
+static float coverage(const osg::Image* image, int s, int t)
+{
+    osg::Vec4 c = image->getColor(s, t);
+    switch (image->getPixelFormat())
+    {
+    case GL_ALPHA:
+    case GL_LUMINANCE_ALPHA:
+    case GL_RGBA:
+    case GL_BGRA:
+        return c.a();
+    default:
+        return c.r();
+    }
+}
+
+LabelRenderer::LabelRenderer(float textSize, float iconSize)
+    : _textSize(textSize), _iconSize(iconSize), _shelfX(0), _shelfY(0),
+      _shelfHeight(0), _current(0)
+{
+    _atlas = new osg::Image;
+    _atlas->allocateImage(ATLAS_SIZE, ATLAS_SIZE, 1, GL_RGBA,
+                          GL_UNSIGNED_BYTE);
+    std::fill(_atlas->data(), _atlas->data() + _atlas->getTotalSizeInBytes(),
+              0);
+
+    _anchors = new osg::Vec3Array;
+    _texCoords = new osg::Vec2Array;
+    _offsets = new osg::Vec3Array;
+    _colors = new osg::Vec4Array;
+}
+
+bool LabelRenderer::allocate(int width, int height, int& x, int& y)
+{
+    width += 2 * ATLAS_PADDING;
+    height += 2 * ATLAS_PADDING;
+
+    if (_shelfX + width > ATLAS_SIZE)
+    {
+        _shelfX = 0;
+        _shelfY += _shelfHeight;
+        _shelfHeight = 0;
+    }
+    if (width > ATLAS_SIZE || _shelfY + height > ATLAS_SIZE) return false;
+
+    x = _shelfX + ATLAS_PADDING;
+    y = _shelfY + ATLAS_PADDING;
+    _shelfX += width;
+    _shelfHeight = std::max(_shelfHeight, height);
+    return true;
+}
+
+unsigned LabelRenderer::loadIcons(const std::string& directory)
+{
+    osgDB::DirectoryContents files = osgDB::getDirectoryContents(directory);
+    std::sort(files.begin(), files.end());
+
+    unsigned loaded = 0;
+    for (const std::string& file : files)
+    {
+        if (osgDB::getLowerCaseFileExtension(file) != "png") continue;
+
+        std::string path = osgDB::concatPaths(directory, file);
+        osg::ref_ptr<osg::Image> image = osgDB::readRefImageFile(path);
+        if (!image || image->s() <= 0 || image->t() <= 0)
+        {
+            std::cerr << "Warning: Texture not found: " << path << std::endl;
+            continue;
+        }
+
+        int x, y;
+        if (!allocate(ICON_ATLAS_SIZE, ICON_ATLAS_SIZE, x, y))
+        {
+            std::cerr << "Warning: Label atlas full, skipping " << path
+                      << std::endl;
+            continue;
+        }
+
+        // Skalowanie ikony filtrem pudelkowym do rozmiaru komorki atlasu
+        for (int t = 0; t < ICON_ATLAS_SIZE; ++t)
+        {
+            int t0 = t * image->t() / ICON_ATLAS_SIZE;
+            int t1 = std::max((t + 1) * image->t() / ICON_ATLAS_SIZE, t0 + 1);
+            for (int s = 0; s < ICON_ATLAS_SIZE; ++s)
+            {
+                int s0 = s * image->s() / ICON_ATLAS_SIZE;
+                int s1 =
+                    std::max((s + 1) * image->s() / ICON_ATLAS_SIZE, s0 + 1);
+
+                osg::Vec4 sum;
+                for (int tt = t0; tt < t1; ++tt)
+                    for (int ss = s0; ss < s1; ++ss)
+                        sum += image->getColor(ss, tt);
+                sum /= float((t1 - t0) * (s1 - s0));
+
+                unsigned char* dst = _atlas->data(x + s, y + t);
+                for (int c = 0; c < 4; ++c)
+                    dst[c] = (unsigned char)(sum[c] * 255.0f + 0.5f);
+            }
+        }
+
+        AtlasEntry entry;
+        entry.valid = true;
+        entry.uvMin.set(float(x) / ATLAS_SIZE, float(y) / ATLAS_SIZE);
+        entry.uvMax.set(float(x + ICON_ATLAS_SIZE) / ATLAS_SIZE,
+                        float(y + ICON_ATLAS_SIZE) / ATLAS_SIZE);
+        _icons[file] = entry;
+        ++loaded;
+    }
+
+    std::cout << "[LABELS] Atlas: " << loaded << " ikon z " << directory
+              << std::endl;
+    return loaded;
+}
+
+const LabelRenderer::GlyphEntry& LabelRenderer::getGlyph(unsigned int charcode)
+{
+    auto it = _glyphs.find(charcode);
+    if (it != _glyphs.end()) return it->second;
+
+    GlyphEntry& entry = _glyphs[charcode];
+    if (!_font) return entry;
+
+    osgText::Glyph* glyph = _font->getGlyph(
+        osgText::FontResolution(GLYPH_RESOLUTION, GLYPH_RESOLUTION),
+        charcode);
+    if (!glyph) return entry;
+
+    // Metryki glifu sa w jednostkach wysokosci czcionki
+    entry.advance = glyph->getHorizontalAdvance() * _textSize;
+
+    int w = glyph->s();
+    int h = glyph->t();
+    if (w <= 0 || h <= 0 || !glyph->data()) return entry;
+
+    const int border = GLYPH_BORDER;
+    int x, y;
+    if (!allocate(w + 2 * border, h + 2 * border, x, y))
+    {
+        std::cerr << "Warning: Label atlas full, skipping glyph " << charcode
+                  << std::endl;
+        return entry;
+    }
+
+    for (int t = 0; t < h; ++t)
+    {
+        for (int s = 0; s < w; ++s)
+        {
+            unsigned char* dst = _atlas->data(x + border + s, y + border + t);
+            dst[0] = dst[1] = dst[2] = 255;
+            dst[3] = (unsigned char)(coverage(glyph, s, t) * 255.0f + 0.5f);
+        }
+    }
+
+    entry.atlas.valid = true;
+    entry.atlas.uvMin.set(float(x) / ATLAS_SIZE, float(y) / ATLAS_SIZE);
+    entry.atlas.uvMax.set(float(x + w + 2 * border) / ATLAS_SIZE,
+                          float(y + h + 2 * border) / ATLAS_SIZE);
+
+    // Obraz glifu moze miec margines - centrujemy go wzgledem metryk
+    const float res = (float)GLYPH_RESOLUTION;
+    float marginX = (w - glyph->getWidth() * res) * 0.5f;
+    float marginY = (h - glyph->getHeight() * res) * 0.5f;
+    float pxScale = _textSize / res;
+
+    osg::Vec2 bearing = glyph->getHorizontalBearing();
+    entry.quadMin.set((bearing.x() * res - marginX - border) * pxScale,
+                      (bearing.y() * res - marginY - border) * pxScale);
+    entry.quadMax = entry.quadMin + osg::Vec2(w + 2 * border, h + 2 * border)
+                                        * pxScale;
+    return entry;
+}
+
+void LabelRenderer::addQuad(const osg::Vec3& anchor, const osg::Vec2& offMin,
+                            const osg::Vec2& offMax, const AtlasEntry& entry,
+                            const osg::Vec4& color, float isIcon)
+{
+    const osg::Vec2& uv0 = entry.uvMin;
+    const osg::Vec2& uv1 = entry.uvMax;
+
+    _texCoords->push_back(osg::Vec2(uv0.x(), uv0.y()));
+    _texCoords->push_back(osg::Vec2(uv1.x(), uv0.y()));
+    _texCoords->push_back(osg::Vec2(uv1.x(), uv1.y()));
+    _texCoords->push_back(osg::Vec2(uv0.x(), uv1.y()));
+
+    _offsets->push_back(osg::Vec3(offMin.x(), offMin.y(), isIcon));
+    _offsets->push_back(osg::Vec3(offMax.x(), offMin.y(), isIcon));
+    _offsets->push_back(osg::Vec3(offMax.x(), offMax.y(), isIcon));
+    _offsets->push_back(osg::Vec3(offMin.x(), offMax.y(), isIcon));
+
+    for (int i = 0; i < 4; ++i)
+    {
+        _anchors->push_back(anchor);
+        _colors->push_back(color);
+    }
+}
+
+unsigned LabelRenderer::addLabel(const osg::Vec3& position,
+                                 const std::string& name,
+                                 const std::string& icon,
+                                 const osg::Vec4& textColor)
+{
+    LabelQuads label;
+    label.first = (unsigned)_anchors->size();
+
+    float textBase = 0.0f;
+    auto iconIt = _icons.find(icon);
+    if (iconIt != _icons.end())
+    {
+        float h = _iconSize * 0.5f;
+        addQuad(position, osg::Vec2(-h, -h), osg::Vec2(h, h), iconIt->second,
+                osg::Vec4(1, 1, 1, 1), 1.0f);
+        textBase = h * 1.5f;
+    }
+
+    osgText::String text(name, osgText::String::ENCODING_UTF8);
+
+    float width = 0.0f;
+    float minY = 0.0f;
+    for (unsigned int charcode : text)
+    {
+        const GlyphEntry& glyph = getGlyph(charcode);
+        width += glyph.advance;
+        if (glyph.atlas.valid) minY = std::min(minY, glyph.quadMin.y());
+    }
+
+    // Wyrownanie CENTER_BOTTOM wzgledem kotwicy (nad ikona)
+    osg::Vec2 pen(-width * 0.5f, textBase - minY);
+    for (unsigned int charcode : text)
+    {
+        const GlyphEntry& glyph = getGlyph(charcode);
+        if (glyph.atlas.valid)
+            addQuad(position, pen + glyph.quadMin, pen + glyph.quadMax,
+                    glyph.atlas, textColor, 0.0f);
+        pen.x() += glyph.advance;
+    }
+
+    label.count = (unsigned)_anchors->size() - label.first;
+    label.width = width;
+    _labels.push_back(label);
+    return (unsigned)_labels.size() - 1;
+}
+
+void LabelRenderer::createBatch(Batch& batch)
+{
+    batch.geometry = new osg::Geometry;
+    batch.geometry->setUseDisplayList(false);
+    batch.geometry->setUseVertexBufferObjects(true);
+    batch.geometry->setDataVariance(osg::Object::DYNAMIC);
+    batch.geometry->setCullingActive(false);
+
+    batch.geometry->setVertexArray(new osg::Vec3Array);
+    batch.geometry->setTexCoordArray(0, new osg::Vec2Array,
+                                     osg::Array::BIND_PER_VERTEX);
+    batch.geometry->setTexCoordArray(1, new osg::Vec3Array,
+                                     osg::Array::BIND_PER_VERTEX);
+    batch.geometry->setColorArray(new osg::Vec4Array,
+                                  osg::Array::BIND_PER_VERTEX);
+
+    batch.primitives = new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, 0);
+    batch.geometry->addPrimitiveSet(batch.primitives);
+    batch.geometry->setStateSet(_stateSet);
+
+    batch.viewport = new osg::Uniform("u_viewport", osg::Vec2(1.0f, 1.0f));
+
+    batch.geode = new osg::Geode;
+    batch.geode->setCullingActive(false);
+    batch.geode->addDrawable(batch.geometry);
+    batch.geode->getOrCreateStateSet()->addUniform(batch.viewport);
+}
+
+void LabelRenderer::reportMemory(LayerMemory& layer) const
+{
+    if (_atlasTexture.valid())
+    {
+        ++layer.textures;
+        layer.textureBytes += getTextureSize(*_atlasTexture);
+    }
+    if (_stateSet.valid()) ++layer.stateSets;
+
+    // Gotowe quady wszystkich etykiet, kopiowane do batchy
+    layer.positionBytes += _anchors->getTotalDataSize();
+    layer.texCoordBytes +=
+        _texCoords->getTotalDataSize() + _offsets->getTotalDataSize();
+    layer.colorBytes += _colors->getTotalDataSize();
+
+    layer.cpuBytes += _labels.capacity() * sizeof(LabelQuads)
+                      + _shown.capacity() * sizeof(unsigned)
+                      + _glyphs.size() * (sizeof(unsigned) + sizeof(GlyphEntry))
+                      + _icons.size() * sizeof(AtlasEntry);
+    for (const auto& icon : _icons) layer.cpuBytes += icon.first.capacity();
+
+    for (const Batch& batch : _batches)
+    {
+        if (!batch.geometry.valid()) continue;
+        ++layer.nodes;
+        ++layer.drawables;
+        ++layer.stateSets;
+        layer.primitiveSets += batch.geometry->getNumPrimitiveSets();
+
+        const osg::Array* vertices = batch.geometry->getVertexArray();
+        layer.vertices += vertices->getNumElements();
+        layer.positionBytes += vertices->getTotalDataSize();
+        for (const auto& array : batch.geometry->getTexCoordArrayList())
+            if (array.valid()) layer.texCoordBytes += array->getTotalDataSize();
+        layer.colorBytes += batch.geometry->getColorArray()->getTotalDataSize();
+    }
+}
+
+void LabelRenderer::finalize()
+{
+    _atlas->dirty();
+
+    _atlasTexture = new osg::Texture2D(_atlas);
+    _atlasTexture->setFilter(osg::Texture::MIN_FILTER,
+                             osg::Texture::LINEAR_MIPMAP_LINEAR);
+    _atlasTexture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+    _atlasTexture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    _atlasTexture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+
+    osg::ref_ptr<osg::Program> program = new osg::Program;
+    program->addShader(new osg::Shader(osg::Shader::VERTEX, labelVertShader));
+    program->addShader(
+        new osg::Shader(osg::Shader::FRAGMENT, labelFragShader));
+
+    _stateSet = new osg::StateSet;
+    _stateSet->setAttributeAndModes(program.get());
+    _stateSet->setTextureAttributeAndModes(0, _atlasTexture,
+                                           osg::StateAttribute::ON);
+    _stateSet->addUniform(new osg::Uniform("u_atlas", 0));
+
+    osg::BlendFunc* bf =
+        new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    _stateSet->setAttributeAndModes(bf, osg::StateAttribute::ON);
+
+    _stateSet->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+    _stateSet->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+
+    osg::Depth* depth = new osg::Depth;
+    depth->setWriteMask(false);
+    depth->setFunction(osg::Depth::LESS);
+    _stateSet->setAttributeAndModes(depth, osg::StateAttribute::ON);
+
+    createBatch(_batches[0]);
+    createBatch(_batches[1]);
+
+    std::cout << "[LABELS] Atlas: " << _glyphs.size() << " glifow, "
+              << _anchors->size() / 4 << " quadow" << std::endl;
+}
+
+osg::Geode* LabelRenderer::update(const std::vector<unsigned>& accepted,
+                                  const osg::Viewport& viewport)
+{
+    osg::Vec2 size(viewport.width(), viewport.height());
+    if (accepted == _shown && size == _shownSize)
+        return _batches[_current].geode.get();
+
+    _current = 1 - _current;
+    Batch& batch = _batches[_current];
+    _shown = accepted;
+    _shownSize = size;
+    batch.viewport->set(size);
+
+    osg::Geometry* geom = batch.geometry.get();
+    osg::Vec3Array* anchors =
+        static_cast<osg::Vec3Array*>(geom->getVertexArray());
+    osg::Vec2Array* texCoords =
+        static_cast<osg::Vec2Array*>(geom->getTexCoordArray(0));
+    osg::Vec3Array* offsets =
+        static_cast<osg::Vec3Array*>(geom->getTexCoordArray(1));
+    osg::Vec4Array* colors =
+        static_cast<osg::Vec4Array*>(geom->getColorArray());
+
+    anchors->clear();
+    texCoords->clear();
+    offsets->clear();
+    colors->clear();
+
+    for (unsigned i : accepted)
+    {
+        const LabelQuads& label = _labels[i];
+        unsigned first = label.first;
+        unsigned last = label.first + label.count;
+        anchors->insert(anchors->end(), _anchors->begin() + first,
+                        _anchors->begin() + last);
+        texCoords->insert(texCoords->end(), _texCoords->begin() + first,
+                          _texCoords->begin() + last);
+        offsets->insert(offsets->end(), _offsets->begin() + first,
+                        _offsets->begin() + last);
+        colors->insert(colors->end(), _colors->begin() + first,
+                       _colors->begin() + last);
+    }
+
+    anchors->dirty();
+    texCoords->dirty();
+    offsets->dirty();
+    colors->dirty();
+    batch.primitives->setCount((GLsizei)anchors->size());
+    batch.primitives->dirty();
+    geom->dirtyBound();
+
+    return batch.geode.get();
+}
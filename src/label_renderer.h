@@ -0,0 +1,138 @@
+#ifndef LABEL_RENDERER_H
+#define LABEL_RENDERER_H
+
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Image>
+#include <osg/Texture2D>
+#include <osg/Uniform>
+#include <osg/Viewport>
+#include <osgText/Font>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "memory_report.h"
+
+/**
+ * Batched label renderer.
+ *
+ * Glyphs of the label font and the POI icons are packed into one RGBA atlas,
+ * and every label is pre-expanded into textured quads anchored at the label
+ * position. Each frame the accepted labels are copied into a single
+ * geometry which is drawn with one call; quads are offset by their pixel
+ * size in the vertex shader so labels keep a constant screen size.
+ */
+class LabelRenderer : public osg::Referenced {
+public:
+    /**
+     * @param textSize Text height in pixels
+     * @param iconSize Icon size in pixels
+     */
+    LabelRenderer(float textSize, float iconSize);
+
+    void setFont(osgText::Font* font) { _font = font; }
+
+    /**
+     * Packs all *.png images from `directory` into the atlas.
+     *
+     * @return Number of loaded icons
+     */
+    unsigned loadIcons(const std::string& directory);
+
+    /**
+     * Creates the quads of a label.
+     *
+     * @param position Anchor in the local frame
+     * @param name UTF-8 label text
+     * @param icon File name of the icon, label has no icon if not loaded
+     * @param textColor Color of the text
+     * @return Index of the label
+     */
+    unsigned addLabel(const osg::Vec3& position, const std::string& name,
+                      const std::string& icon, const osg::Vec4& textColor);
+
+    // Width of the label text in pixels
+    float getLabelWidth(unsigned i) const { return _labels[i].width; }
+
+    // Uploads the atlas, call after the last addLabel()
+    void finalize();
+
+    /**
+     * Fills the batch with the given labels and returns the node to draw.
+     * The batch is only rebuilt when the label set or the viewport size
+     * changes; the two batches are used alternately so a frame still being
+     * drawn is never modified.
+     */
+    osg::Geode* update(const std::vector<unsigned>& accepted,
+                       const osg::Viewport& viewport);
+
+    // Adds the atlas, the quads of all labels and the two batches
+    void reportMemory(LayerMemory& layer) const;
+
+private:
+    struct AtlasEntry
+    {
+        bool valid = false;
+        osg::Vec2 uvMin, uvMax;
+    };
+
+    struct GlyphEntry
+    {
+        AtlasEntry atlas;
+        osg::Vec2 quadMin, quadMax; // in pixels, relative to the pen
+        float advance = 0.0f;       // in pixels
+    };
+
+    struct LabelQuads
+    {
+        unsigned first = 0;
+        unsigned count = 0;
+        float width = 0.0f;
+    };
+
+    struct Batch
+    {
+        osg::ref_ptr<osg::Geode> geode;
+        osg::ref_ptr<osg::Geometry> geometry;
+        osg::ref_ptr<osg::DrawArrays> primitives;
+        osg::ref_ptr<osg::Uniform> viewport;
+    };
+
+    bool allocate(int width, int height, int& x, int& y);
+    const GlyphEntry& getGlyph(unsigned int charcode);
+    void addQuad(const osg::Vec3& anchor, const osg::Vec2& offMin,
+                 const osg::Vec2& offMax, const AtlasEntry& entry,
+                 const osg::Vec4& color, float isIcon);
+    void createBatch(Batch& batch);
+
+    float _textSize;
+    float _iconSize;
+    osg::ref_ptr<osgText::Font> _font;
+
+    // atlas with a simple shelf packer
+    osg::ref_ptr<osg::Image> _atlas;
+    osg::ref_ptr<osg::Texture2D> _atlasTexture;
+    osg::ref_ptr<osg::StateSet> _stateSet;
+    int _shelfX, _shelfY, _shelfHeight;
+
+    std::map<std::string, AtlasEntry> _icons;
+    std::map<unsigned int, GlyphEntry> _glyphs;
+
+    // pre-expanded quads of all labels, 4 vertices per quad
+    osg::ref_ptr<osg::Vec3Array> _anchors;
+    osg::ref_ptr<osg::Vec2Array> _texCoords;
+    osg::ref_ptr<osg::Vec3Array> _offsets;
+    osg::ref_ptr<osg::Vec4Array> _colors;
+    std::vector<LabelQuads> _labels;
+
+    Batch _batches[2];
+    unsigned _current;
+    std::vector<unsigned> _shown;
+    osg::Vec2 _shownSize;
+};
+
+#endif // LABEL_RENDERER_H
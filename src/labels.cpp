@@ -2,22 +2,12 @@
 #include <osgUtil/Optimizer>
 #include <osgUtil/CullVisitor>
 #include <osg/CoordinateSystemNode>
-#include <osg/Switch>
 #include <osg/Types>
-#include <osgText/Text>
-#include <osg/MatrixTransform>
-#include <osg/ShapeDrawable>
-#include <osg/Billboard>
+#include <osgText/Font>
 #include <osgSim/ShapeAttribute>
 #include <osgViewer/View>
-#include <osg/BlendFunc>
-#include <osg/Depth>
-#include <osg/Program>
-#include <osg/Projection>
 #include <osg/Geode>
 #include <osg/Geometry>
-#include <osg/Image>
-#include <osg/Texture2D>
 
 #include <iostream>
 #include <vector>
@@ -30,15 +20,11 @@
 #include <cmath>
 
 #include "common.h"
+#include "label_engine.h"
+#include "label_renderer.h"
 
 using namespace osg;
 
-const float CHAR_WIDTH_EST = 8.0f;
-const float ICON_SCREEN_W = 24.0f;
-const float ICON_SCREEN_H = 24.0f;
-const float PADDING = 2.0f;
-
-
 struct LabelData
 {
     osg::Vec3 position;
@@ -182,126 +168,40 @@ public:
     }
 };
 
-class SortAndCullLabelsCallback : public osg::NodeCallback {
-    struct ScreenBox
-    {
-        double minX, maxX;
-        double minY, maxY;
-
-        bool overlaps(const ScreenBox& other) const
-        {
-            if (maxX < other.minX) return false;
-            if (minX > other.maxX) return false;
-            if (maxY < other.minY) return false;
-            if (minY > other.maxY) return false;
-            return true;
-        }
-    };
-
-    struct LabelItem
-    {
-        osg::MatrixTransform* node;
-        ScreenBox box;
-        double distToCam;
-    };
-
-    float _maxViewDist;
-    float _textSize; // Used for box calculation
+class SortAndCullLabelsCallback : public osg::NodeCallback,
+                                  public MemoryReporter {
+    osg::ref_ptr<LabelEngine> _engine;
+    osg::ref_ptr<LabelRenderer> _renderer;
 
 public:
-    SortAndCullLabelsCallback(float maxViewDist, float textSize)
-        : _maxViewDist(maxViewDist), _textSize(textSize)
+    SortAndCullLabelsCallback(LabelEngine* engine, LabelRenderer* renderer)
+        : _engine(engine), _renderer(renderer)
     {}
 
+    void reportMemory(LayerMemory& layer) const override
+    {
+        _renderer->reportMemory(layer);
+        layer.cpuBytes += _engine->getMemoryUsage();
+    }
+
     virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
     {
-        osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+        osgUtil::CullVisitor* cv = nv->asCullVisitor();
         if (!cv)
         {
             traverse(node, nv);
             return;
         }
 
-        osg::Group* group = node->asGroup();
-        if (!group) return;
-
-        osg::Camera* camera = cv->getCurrentCamera();
-        if (!camera) return;
-
-        osg::Matrixd viewMat = *cv->getModelViewMatrix();
-        osg::Matrixd projMat = *cv->getProjectionMatrix();
         const osg::Viewport* viewport = cv->getViewport();
         if (!viewport) return;
 
-        osg::Matrixd mvpw = viewMat * projMat * viewport->computeWindowMatrix();
-
-        std::vector<LabelItem> visibleLabels;
-        visibleLabels.reserve(group->getNumChildren());
-
-        for (unsigned int i = 0; i < group->getNumChildren(); ++i)
-        {
-            osg::MatrixTransform* mt =
-                dynamic_cast<osg::MatrixTransform*>(group->getChild(i));
-            if (!mt) continue;
-
-            osg::Vec3 centerWorld = mt->getMatrix().getTrans();
-            osg::Vec3 eyePos = centerWorld * viewMat;
-
-            if (eyePos.z() > 0) continue;
-
-            double dist = eyePos.length();
-            if (dist > _maxViewDist) continue;
-
-            osg::Vec3 screenPos = centerWorld * mvpw;
+        // Rozmieszczenie liczy watek roboczy, tu tylko odbieramy wynik
+        _engine->submitView(*cv->getModelViewMatrix(),
+                            *cv->getProjectionMatrix(), *viewport);
 
-            if (screenPos.x() < 0 || screenPos.x() > viewport->width()
-                || screenPos.y() < 0 || screenPos.y() > viewport->height())
-            {
-                continue;
-            }
-
-            std::string labelName = mt->getName();
-
-            double widthPixels = (labelName.length() * CHAR_WIDTH_EST);
-            if (widthPixels < ICON_SCREEN_W) widthPixels = ICON_SCREEN_W;
-
-            double heightPixels = _textSize + ICON_SCREEN_H;
-
-            ScreenBox box;
-            box.minX = screenPos.x() - (widthPixels / 2.0) - PADDING;
-            box.maxX = screenPos.x() + (widthPixels / 2.0) + PADDING;
-            box.minY = screenPos.y() - (ICON_SCREEN_H / 2.0) - PADDING;
-            box.maxY = screenPos.y() + heightPixels + PADDING;
-
-            visibleLabels.push_back({ mt, box, dist });
-        }
-
-        std::sort(visibleLabels.begin(), visibleLabels.end(),
-                  [](const LabelItem& a, const LabelItem& b) {
-                      return a.distToCam < b.distToCam;
-                  });
-
-        std::vector<ScreenBox> acceptedBoxes;
-        acceptedBoxes.reserve(visibleLabels.size());
-
-        for (auto& item : visibleLabels)
-        {
-            bool overlaps = false;
-            for (const auto& existingBox : acceptedBoxes)
-            {
-                if (item.box.overlaps(existingBox))
-                {
-                    overlaps = true;
-                    break;
-                }
-            }
-
-            if (!overlaps)
-            {
-                acceptedBoxes.push_back(item.box);
-                item.node->accept(*nv);
-            }
-        }
+        _renderer->update(_engine->getLatestAccepted(), *viewport)
+            ->accept(*nv);
     }
 };
 
@@ -337,159 +237,78 @@ static std::string determineIconTexture(const std::string& type,
     return "default.png";
 }
 
-static osg::StateSet*
-getSharedStateSet(const std::string& filename,
-                  std::map<std::string, osg::ref_ptr<osg::StateSet>>& cache)
+static osg::Vec4 determineTextColor(const std::string& type,
+                                    const std::string& subtype)
 {
-    if (filename.empty()) return nullptr;
-
-    auto it = cache.find(filename);
-    if (it != cache.end())
-    {
-        return it->second.get();
-    }
-
-    std::string localPath = "images/labelsTextures/" + filename;
-
-    osg::ref_ptr<osg::Image> image = osgDB::readRefImageFile(localPath);
-
-    if (!image)
-    {
-        std::cerr << "Warning: Texture not found: " << localPath << std::endl;
-        return nullptr;
-    }
-
-    osg::ref_ptr<osg::StateSet> ss = new osg::StateSet();
-    osg::Texture2D* tex = new osg::Texture2D(image);
-    tex->setFilter(osg::Texture::MIN_FILTER,
-                   osg::Texture::LINEAR_MIPMAP_LINEAR);
-    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
-
-    ss->setTextureAttributeAndModes(0, tex, osg::StateAttribute::ON);
-
-    osg::BlendFunc* bf =
-        new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    ss->setAttributeAndModes(bf, osg::StateAttribute::ON);
+    auto checkType = [&](const std::string& keyword) {
+        return (subtype.find(keyword) != std::string::npos
+                || type.find(keyword) != std::string::npos);
+    };
 
-    ss->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
-    ss->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+    if (checkType("station") || checkType("subway") || checkType("tram"))
+        return osg::Vec4(1.0f, 0.9f, 0.2f, 1.0f);
+    if (checkType("university") || checkType("school")
+        || checkType("college"))
+        return osg::Vec4(0.6f, 0.8f, 1.0f, 1.0f);
+    if (checkType("townhall") || checkType("government"))
+        return osg::Vec4(1.0f, 0.6f, 0.6f, 1.0f);
+    if (checkType("pub") || checkType("bar") || checkType("cafe"))
+        return osg::Vec4(0.7f, 1.0f, 0.7f, 1.0f);
+
+    return osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f);
+}
 
-    osg::Depth* depth = new osg::Depth;
-    depth->setWriteMask(false);
-    depth->setFunction(osg::Depth::LESS);
-    ss->setAttributeAndModes(depth, osg::StateAttribute::ON);
+// Waznosc wg typu obiektu: stacje > uczelnie > urzedy > ... > kawiarnie
+static float rankType(const std::string& type, const std::string& subtype)
+{
+    auto matches = [&](const std::string& keyword) {
+        return (subtype.find(keyword) != std::string::npos
+                || type.find(keyword) != std::string::npos);
+    };
 
-    cache[filename] = ss;
-    return ss.get();
+    if (matches("station")) return 10.0f;
+    if (matches("subway_entrance")) return 8.0f;
+    if (matches("university") || matches("college")) return 8.0f;
+    if (matches("townhall") || matches("government")) return 7.0f;
+    if (matches("public_building")) return 6.0f;
+    if (matches("tram_stop")) return 5.0f;
+    if (matches("school")) return 5.0f;
+    if (matches("kindergarten")) return 3.0f;
+    if (matches("bus_stop") || matches("halt")) return 3.0f;
+    if (matches("restaurant")) return 3.0f;
+    if (matches("bar") || matches("pub")) return 2.5f;
+    if (matches("fast_food")) return 2.0f;
+    if (matches("cafe")) return 2.0f;
+
+    return 1.0f;
 }
 
-static osg::MatrixTransform* createLabelNode(const LabelData& data,
-                                             osg::StateSet* sharedIconStateSet,
-                                             float textSize, float iconSize)
+// Jakosc nazwy, 0 = etykieta bez sensownej nazwy (pomijana)
+static float rankName(const std::string& name)
 {
-    osg::MatrixTransform* mt = new osg::MatrixTransform;
-    mt->setMatrix(osg::Matrix::translate(data.position));
-    mt->setName(data.name);
+    if (name.length() < 2) return 0.0f;
+    if (name == "public_transport" || name == "bus_stop" || name == "shelter"
+        || name == "platform")
+        return 0.0f;
 
-    bool hasIcon = (sharedIconStateSet != nullptr);
-    float offsetZ = 0.0f;
-
-    if (hasIcon)
+    unsigned digits = 0, letters = 0;
+    for (char c : name)
     {
-        osg::Billboard* bb = new osg::Billboard();
-        bb->setMode(osg::Billboard::POINT_ROT_EYE);
-
-        osg::Geometry* iconGeom = new osg::Geometry();
-        float w = iconSize / 2.0f;
-        float h = iconSize / 2.0f;
-
-        osg::Vec3Array* verts = new osg::Vec3Array;
-        verts->push_back(osg::Vec3(-w, 0, -h));
-        verts->push_back(osg::Vec3(w, 0, -h));
-        verts->push_back(osg::Vec3(w, 0, h));
-        verts->push_back(osg::Vec3(-w, 0, h));
-        iconGeom->setVertexArray(verts);
-
-        osg::Vec2Array* texcoords = new osg::Vec2Array;
-        texcoords->push_back(osg::Vec2(0, 0));
-        texcoords->push_back(osg::Vec2(1, 0));
-        texcoords->push_back(osg::Vec2(1, 1));
-        texcoords->push_back(osg::Vec2(0, 1));
-        iconGeom->setTexCoordArray(0, texcoords);
-
-        osg::Vec4Array* colors = new osg::Vec4Array;
-        colors->push_back(osg::Vec4(1, 1, 1, 1));
-        iconGeom->setColorArray(colors, osg::Array::BIND_OVERALL);
-
-        iconGeom->addPrimitiveSet(
-            new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, 4));
-
-        iconGeom->setStateSet(sharedIconStateSet);
-        bb->addDrawable(iconGeom, osg::Vec3(0, 0, 0));
-        bb->getOrCreateStateSet()->setMode(GL_LIGHTING,
-                                           osg::StateAttribute::OFF
-                                               | osg::StateAttribute::OVERRIDE);
-
-        mt->addChild(bb);
-        offsetZ = h * 1.5f;
+        if (std::isdigit((unsigned char)c)) ++digits;
+        else if (!std::isspace((unsigned char)c)) ++letters;
     }
+    if (letters == 0) return 0.0f;
 
-    if (!data.name.empty())
-    {
-        osg::Geode* textGeode = new osg::Geode();
-        osgText::Text* text = new osgText::Text;
-
-        static osg::ref_ptr<osgText::Font> sharedFont =
-            osgText::readRefFontFile("fonts/arial.ttf");
-        if (!sharedFont) sharedFont = osgText::readRefFontFile("arial.ttf");
-
-        text->setFont(sharedFont);
-        text->setText(
-            osgText::String(data.name, osgText::String::ENCODING_UTF8));
-
-        text->setCharacterSizeMode(osgText::Text::SCREEN_COORDS);
-        text->setCharacterSize(textSize);
-
-        text->setAlignment(osgText::Text::CENTER_BOTTOM);
-        text->setAxisAlignment(osgText::Text::SCREEN);
-
-        text->setBackdropType(osgText::Text::OUTLINE);
-
-        osg::Vec4 textColor(1.0f, 1.0f, 1.0f, 1.0f);
-        osg::Vec4 outlineColor(0.0f, 0.0f, 0.0f, 1.0f);
-
-        auto checkType = [&](const std::string& keyword) {
-            return (data.subtype.find(keyword) != std::string::npos
-                    || data.type.find(keyword) != std::string::npos);
-        };
-
-        if (checkType("station") || checkType("subway") || checkType("tram"))
-            textColor.set(1.0f, 0.9f, 0.2f, 1.0f);
-        else if (checkType("university") || checkType("school")
-                 || checkType("college"))
-            textColor.set(0.6f, 0.8f, 1.0f, 1.0f);
-        else if (checkType("townhall") || checkType("government"))
-            textColor.set(1.0f, 0.6f, 0.6f, 1.0f);
-        else if (checkType("pub") || checkType("bar") || checkType("cafe"))
-            textColor.set(0.7f, 1.0f, 0.7f, 1.0f);
-
-        text->setColor(textColor);
-        text->setBackdropColor(outlineColor);
-        text->setPosition(osg::Vec3(0, 0, offsetZ));
-
-        textGeode->addDrawable(text);
-        textGeode->getOrCreateStateSet()->setMode(
-            GL_LIGHTING,
-            osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE);
-
-        mt->addChild(textGeode);
-    }
-
-    return mt;
+    float quality = 1.0f;
+    if (digits > 0) quality *= 0.6f;     // numery przystankow, adresy
+    if (name.length() < 4) quality *= 0.7f;
+    if (name.length() > 32) quality *= 0.7f; // dlugie nazwy zaslaniaja mape
+    return quality;
 }
 
 osg::Node* process_labels(osg::Matrixd& ltw, const std::string& file_path,
-                          float textSize, float iconSize, float maxViewDist)
+                          float textSize, float iconSize, float maxViewDist,
+                          unsigned maxLabels)
 {
     std::string shp_path = file_path + "/test_pointss.shp";
     std::string dbf_path = file_path + "/test_pointss.dbf";
@@ -518,8 +337,17 @@ osg::Node* process_labels(osg::Matrixd& ltw, const std::string& file_path,
         std::min(extractor._positions.size(), dbfReader.records.size());
     if (!hasDBF) count = 0;
 
-    std::map<std::string, osg::ref_ptr<osg::StateSet>> iconStateSets;
-    osg::Group* labelsGroup = new osg::Group;
+    osg::ref_ptr<osgText::Font> font =
+        osgText::readRefFontFile("fonts/arial.ttf");
+    if (!font) font = osgText::readRefFontFile("arial.ttf");
+
+    osg::ref_ptr<LabelRenderer> renderer =
+        new LabelRenderer(textSize, iconSize);
+    renderer->setFont(font.get());
+    renderer->loadIcons("images/labelsTextures");
+
+    osg::ref_ptr<LabelEngine> engine =
+        new LabelEngine(maxViewDist, textSize, iconSize, maxLabels);
 
     for (size_t i = 0; i < count; ++i)
     {
@@ -529,40 +357,44 @@ osg::Node* process_labels(osg::Matrixd& ltw, const std::string& file_path,
         ld.subtype = dbfReader.records[i].subtype;
         ld.type = dbfReader.records[i].type;
 
-        if (ld.name.length() < 2) continue;
-        if (ld.name == "public_transport" || ld.name == "bus_stop"
-            || ld.name == "shelter" || ld.name == "platform")
-            continue;
-
-        bool allDigits = true;
-        for (char c : ld.name)
-        {
-            if (!std::isdigit((unsigned char)c)
-                && !std::isspace((unsigned char)c))
-            {
-                allDigits = false;
-                break;
-            }
-        }
-        if (allDigits) continue;
+        float importance = rankName(ld.name);
+        if (importance <= 0.0f) continue;
+        importance *= rankType(ld.type, ld.subtype);
 
         ld.position.z() += 25.0f;
 
         std::string iconFile = determineIconTexture(ld.type, ld.subtype);
-        osg::StateSet* iconSS = nullptr;
-        if (!iconFile.empty())
-        {
-            iconSS = getSharedStateSet(iconFile, iconStateSets);
-        }
+        osg::Vec4 textColor = determineTextColor(ld.type, ld.subtype);
 
-        labelsGroup->addChild(createLabelNode(ld, iconSS, textSize, iconSize));
+        unsigned id = renderer->addLabel(ld.position, ld.name, iconFile,
+                                         textColor);
+        engine->addLabel(ld.position, renderer->getLabelWidth(id),
+                         importance);
     }
 
-    std::cout << "--- LABELS: Utworzono " << labelsGroup->getNumChildren()
+    std::cout << "--- LABELS: Utworzono " << engine->getNumLabels()
               << " etykiet." << std::endl;
 
+    // Znaczniki klastrow (liczba ukrytych etykiet) dopisywane za etykietami,
+    // indeksy w rendererze i silniku musza sie zgadzac
+    unsigned firstCluster = engine->getNumLabels();
+    engine->rank();
+    for (unsigned i = firstCluster; i < engine->getNumLabels(); ++i)
+    {
+        unsigned id = renderer->addLabel(
+            engine->getPosition(i), std::to_string(engine->getClusterSize(i)),
+            "default.png", osg::Vec4(1.0f, 0.75f, 0.3f, 1.0f));
+        engine->setLabelWidth(i, renderer->getLabelWidth(id));
+    }
+
+    renderer->finalize();
+    engine->build();
+
+    // Etykiety rysowane sa jednym batchem z callbacka, grupa nie ma dzieci
+    osg::Group* labelsGroup = new osg::Group;
+    labelsGroup->setCullingActive(false);
     labelsGroup->setCullCallback(
-        new SortAndCullLabelsCallback(maxViewDist, textSize));
+        new SortAndCullLabelsCallback(engine.get(), renderer.get()));
 
     return labelsGroup;
 }
\ No newline at end of file
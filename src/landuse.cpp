@@ -26,6 +26,8 @@
 #include <filesystem>
 
 #include "common.h"
+#include "feature_index.h"
+#include "partition.h"
 
 using namespace osg;
 
@@ -218,7 +220,9 @@ osg::Node* process_landuse(osg::Matrixd& ltw, osg::BoundingBox& wbb,
         return nullptr;
     }
 
-    std::string cacheFileName = "landuse_" + std::to_string(fileSize) + ".osgb";
+    // v4: shadery z LOD (program jest zapisany w cache), podzial na komorki
+    std::string cacheFileName =
+        "landuse_v4_" + std::to_string(fileSize) + ".osgb";
 
     if (std::filesystem::exists(cacheFileName))
     {
@@ -250,6 +254,7 @@ osg::Node* process_landuse(osg::Matrixd& ltw, osg::BoundingBox& wbb,
                 std::cout << "Ostrzezenie: Cache nie zawiera WBB!" << std::endl;
             }
 
+            attachFeatureIndex(cachedNode.get(), cacheFileName);
             return cachedNode.release();
         }
         std::cout << "Blad wczytywania cache, powrot do generowania..."
@@ -435,10 +440,12 @@ osg::Node* process_landuse(osg::Matrixd& ltw, osg::BoundingBox& wbb,
     land_group->setUserValue("wbb_max", wbb._max);
 
     process_background(land_group);
+    partitionLayer(land_group.get(), "landuse");
 
     std::cout << "Zapisuje cache Landuse: " << cacheFileName << std::endl;
     osgDB::writeNodeFile(*land_group, cacheFileName);
 
     std::cout << "--- Koniec Landuse ---" << std::endl;
+    attachFeatureIndex(land_group.get(), cacheFileName);
     return land_group.release();
 }
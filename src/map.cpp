@@ -1,5 +1,6 @@
 #include <osgDB/ReadFile>
 #include <osgUtil/Optimizer>
+#include <osgUtil/IncrementalCompileOperation>
 #include <osg/CoordinateSystemNode>
 
 #include <osg/Switch>
@@ -31,8 +32,14 @@
 
 #include "common.h"
 #include "HUD.h"
+#include "memory_budget.h"
+#include "memory_report.h"
 #include "camera_manip.h"
 #include "post_process.h"
+#include "picking.h"
+#include "prefetch.h"
+#include "shader_lod.h"
+#include "tiles.h"
 
 using namespace osg;
 using namespace std::chrono_literals;
@@ -205,10 +212,15 @@ int main(int argc, char** argv)
     arguments.getApplicationUsage()->addCommandLineOption(
         "--label-size <size>", "Text size for labels (default: 18.0)");
     arguments.getApplicationUsage()->addCommandLineOption(
-        "--label-icon <size>", "Icon world size for labels (default: 8.0)");
+        "--label-icon <size>",
+        "Icon screen size for labels in pixels (default: 24.0)");
     arguments.getApplicationUsage()->addCommandLineOption(
         "--label-dist <distance>",
-        "Max view distance for labels (default: 1500.0)");
+        "Label view distance at the closest zoom level, doubled for every "
+        "farther level, up to 32x at the farthest (default: 1500.0)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--label-budget <count>",
+        "Max number of labels drawn per frame (default: 256)");
 
     /**
      * Even though postfx have more parameters,
@@ -238,6 +250,49 @@ int main(int argc, char** argv)
         "--bloom-intensity <value>",
         "Intensity of the Bloom effect (default 2.0)");
 
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--target-fps <fps>",
+        "Scale the render resolution to keep this frame rate (default: off)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--min-res-scale <scale>",
+        "Lowest render resolution scale (default: 0.5)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--max-res-scale <scale>",
+        "Highest render resolution scale (default: 1.0)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--postfx-timings <filename>",
+        "Write the GPU/CPU time of every post-processing pass on exit");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--shader-lod <distance>",
+        "Distance of the cheap landuse/water shaders (default: 1500)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--bake-tiles <dir>",
+        "Write the map as a paged tile pyramid to the directory and exit");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--tiles <dir>",
+        "Page the map layers from a tile directory, generating missing tiles");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--tile-cache-mb <size>",
+        "Disk budget of the tile directory in MB (default: no limit)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--prefetch-horizon <seconds>",
+        "Load tiles where the camera will be this far ahead (default: 1, "
+        "0 = off)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--tile-log <filename>",
+        "Append every tile read by the pager, with its time, to the file");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--warm-tiles <count>",
+        "Preload the tiles read most often according to --tile-log");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--mem-budget-mb <size>",
+        "Track the memory of the layers and evict far tiles above this size "
+        "(0 = only track)");
+    arguments.getApplicationUsage()->addCommandLineOption(
+        "--mem-report <filename>",
+        "Print the memory of every layer after loading, write it as JSON to "
+        "the file and exit");
+
     ellipsoid = new osg::EllipsoidModel;
     viewer = new osgViewer::Viewer(arguments);
 
@@ -297,6 +352,38 @@ int main(int argc, char** argv)
         }
     }
 
+    std::string bakeDir;
+    if (arguments.read("--bake-tiles", bakeDir))
+        return bakeTiles(file_path, bakeDir) ? 0 : 1;
+    std::string tileDir;
+    arguments.read("--tiles", tileDir);
+    double tileCacheMB = 0.0;
+    arguments.read("--tile-cache-mb", tileCacheMB);
+    double prefetchHorizon = 1.0;
+    arguments.read("--prefetch-horizon", prefetchHorizon);
+    std::string tileLogFile;
+    arguments.read("--tile-log", tileLogFile);
+    unsigned warmTiles = 0;
+    arguments.read("--warm-tiles", warmTiles);
+    double memBudgetMB = 0.0;
+    bool trackMemory = arguments.read("--mem-budget-mb", memBudgetMB);
+    std::string memReportFile;
+    arguments.read("--mem-report", memReportFile);
+    osg::ref_ptr<TileCache> tileCache;
+    if (!tileDir.empty())
+    {
+        // Bez danych zrodlowych usuniete kafle bylyby dziurami na stale
+        uint64_t tileBudget = (uint64_t)(tileCacheMB * 1024.0 * 1024.0);
+        if (tileBudget && !hasTileSources(file_path))
+        {
+            std::cout << "[TILECACHE] Brak danych zrodlowych w " << file_path
+                      << ", limit --tile-cache-mb pominiety (kafle nie beda "
+                      << "usuwane)" << std::endl;
+            tileBudget = 0;
+        }
+        tileCache = new TileCache(tileDir, tileBudget);
+    }
+
     osgMap::postfx::FXAA::Parameters fxaa_params;
     osgMap::postfx::DOF::Parameters dof_params;
     osgMap::postfx::Bloom::Parameters bloom_params;
@@ -310,6 +397,17 @@ int main(int argc, char** argv)
         arguments.read("--bloom-intensity", bloom_params.intensity);
     }
 
+    double targetFps = 0.0;
+    float minResScale = 0.5f;
+    float maxResScale = 1.0f;
+    arguments.read("--target-fps", targetFps);
+    arguments.read("--min-res-scale", minResScale);
+    arguments.read("--max-res-scale", maxResScale);
+    std::string timingsFile;
+    arguments.read("--postfx-timings", timingsFile);
+    float shaderLodDistance = 1500.0f;
+    arguments.read("--shader-lod", shaderLodDistance);
+
     // set up the camera manipulators.
     {
         // Read max tilt parameter from command line
@@ -367,12 +465,14 @@ int main(int argc, char** argv)
     }
 
     float labelTextSize = 18.0f;
-    float labelIconSize = 8.0f;
+    float labelIconSize = 24.0f;
     float labelMaxDist = 1500.0f;
+    unsigned labelBudget = 256;
     {
         arguments.read("--label-size", labelTextSize);
         arguments.read("--label-icon", labelIconSize);
         arguments.read("--label-dist", labelMaxDist);
+        arguments.read("--label-budget", labelBudget);
     }
 
     // add the state manipulator
@@ -385,7 +485,34 @@ int main(int argc, char** argv)
     // add the window size toggle handler
     viewer->addEventHandler(new osgViewer::WindowSizeHandler);
     // add the stats handler
-    viewer->addEventHandler(new osgViewer::StatsHandler);
+    osg::ref_ptr<osgViewer::StatsHandler> statsHandler =
+        new osgViewer::StatsHandler;
+    viewer->addEventHandler(statsHandler);
+    if (tileCache.valid())
+    {
+        for (const char* name :
+             { "Tile cache MB", "Tile cache hits", "Tile cache misses",
+               "Tile cache evictions", "Tile prefetch" })
+        {
+            statsHandler->addUserStatsLine(
+                std::string(name) + ": ", osg::Vec4(0.8f, 1.0f, 0.7f, 1.0f),
+                osg::Vec4(0.8f, 1.0f, 0.7f, 0.5f), name, 1.0, false, false,
+                "", "", 0.0);
+        }
+    }
+    if (trackMemory)
+    {
+        for (const char* name :
+             { "Memory MB", "Memory vertices MB", "Memory indices MB",
+               "Memory textures MB", "Memory attributes MB",
+               "Memory evicted tiles" })
+        {
+            statsHandler->addUserStatsLine(
+                std::string(name) + ": ", osg::Vec4(1.0f, 0.9f, 0.7f, 1.0f),
+                osg::Vec4(1.0f, 0.9f, 0.7f, 0.5f), name, 1.0, false, false,
+                "", "", 0.0);
+        }
+    }
 
     // add the help handler
     viewer->addEventHandler(
@@ -427,25 +554,55 @@ int main(int argc, char** argv)
 
     osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
     osg::ref_ptr<osg::Group> scene = new osg::Group;
-    auto prepare_scene = [&labelTextSize, &labelIconSize, &labelMaxDist](
+    osg::ref_ptr<osg::Uniform> shaderLodMode =
+        setupShaderLod(scene->getOrCreateStateSet(), shaderLodDistance);
+    auto prepare_scene = [&labelTextSize, &labelIconSize, &labelMaxDist,
+                          &labelBudget, &tileCache](
                              osg::ref_ptr<osg::MatrixTransform>& root,
                              osg::ref_ptr<osg::Group>& scene,
                              const std::string& file_path) {
         osg::Matrixd ltw;
         osg::BoundingBox wbb;
-        osg::ref_ptr<osg::Node> land_model =
-            process_landuse(ltw, wbb, file_path);
-        osg::ref_ptr<osg::Node> water_model = process_water(ltw, file_path);
-        osg::ref_ptr<osg::Node> roads_model = process_roads(ltw, file_path);
-        osg::ref_ptr<osg::Node> buildings_model =
-            process_buildings(ltw, file_path);
-        osg::ref_ptr<osg::Node> labels_model = process_labels(
-            ltw, file_path, labelTextSize, labelIconSize, labelMaxDist);
+        osg::ref_ptr<osg::Group> tiles;
+        if (tileCache.valid())
+            tiles = loadTiles(tileCache.get(), file_path, ltw, wbb);
+
+        if (tiles.valid())
+        {
+            // Korzenie warstw i kafel glowny, reszte doczytuje DatabasePager
+            for (unsigned i = 0; i < tiles->getNumChildren(); ++i)
+                scene->addChild(tiles->getChild(i));
+        }
+        else
+        {
+            osg::ref_ptr<osg::Node> land_model =
+                process_landuse(ltw, wbb, file_path);
+            osg::ref_ptr<osg::Node> water_model =
+                process_water(ltw, file_path);
+            osg::ref_ptr<osg::Node> roads_model =
+                process_roads(ltw, file_path);
+            osg::ref_ptr<osg::Node> buildings_model =
+                process_buildings(ltw, file_path);
+
+            // Nazwy jak w piramidzie kafli, po nich liczona jest pamiec
+            if (land_model.valid()) land_model->setName("landuse");
+            if (water_model.valid()) water_model->setName("water");
+            if (roads_model.valid()) roads_model->setName("roads");
+            if (buildings_model.valid()) buildings_model->setName("buildings");
+
+            scene->addChild(land_model);
+            scene->addChild(water_model);
+            scene->addChild(roads_model);
+            scene->addChild(buildings_model);
+
+            buildKdTrees({ land_model.get(), roads_model.get(),
+                           buildings_model.get() });
+        }
 
-        scene->addChild(land_model);
-        scene->addChild(water_model);
-        scene->addChild(roads_model);
-        scene->addChild(buildings_model);
+        osg::ref_ptr<osg::Node> labels_model = process_labels(
+            ltw, file_path, labelTextSize, labelIconSize, labelMaxDist,
+            labelBudget);
+        if (labels_model.valid()) labels_model->setName("labels");
         root->addChild(labels_model);
 
         osg::Vec3d wtrans = wbb.center();
@@ -473,6 +630,11 @@ int main(int argc, char** argv)
         root->setMatrix(ltw);
     };
 
+    // Tekstury i bufory kafli trafiaja na GPU przed wpieciem do sceny
+    if (tileCache.valid())
+        viewer->setIncrementalCompileOperation(
+            new osgUtil::IncrementalCompileOperation);
+
     viewer->setSceneData(create_loading_screen());
     viewer->setUpViewOnSingleScreen(0);
     viewer->realize();
@@ -486,12 +648,25 @@ int main(int argc, char** argv)
     int h = viewer->getCamera()->getViewport()->height();
 
     bool wasMoving = false;
+    osg::ref_ptr<osgMap::postfx::PostProcessor> ppu;
+    osg::ref_ptr<LandInfoQuery> landInfoQuery = new LandInfoQuery;
+    osg::ref_ptr<TilePrefetcher> prefetcher;
+    osg::ref_ptr<TileWarmer> tileWarmer;
+    osg::ref_ptr<MemoryBudget> memoryBudget;
     const float FADE_SPEED = 2.0f;
     double lastTime = viewer->getFrameStamp()->getReferenceTime();
 
     while (!viewer->done())
     {
         viewer->frame();
+        if (tileCache.valid()) tileCache->reportStats(viewer->getViewerStats());
+        if (prefetcher.valid())
+            prefetcher->reportStats(viewer->getViewerStats());
+        if (memoryBudget.valid())
+        {
+            memoryBudget->update(viewer.get(), root->getMatrix());
+            memoryBudget->reportStats(viewer->getViewerStats());
+        }
 
         if (loading.valid())
         {
@@ -499,11 +674,23 @@ int main(int argc, char** argv)
             {
                 loading.get();
 
+                if (!memReportFile.empty())
+                {
+                    // Warstwy sceny i etykiety, zanim dojda postfx i HUD
+                    std::vector<osg::Node*> layers;
+                    for (unsigned i = 0; i < scene->getNumChildren(); ++i)
+                        layers.push_back(scene->getChild(i));
+                    for (unsigned i = 0; i < root->getNumChildren(); ++i)
+                        layers.push_back(root->getChild(i));
+                    writeMemoryReport(layers, memReportFile);
+                    viewer->setDone(true);
+                    continue;
+                }
+
                 /**************/
                 /** PPU SETUP */
                 /**************/
-                osg::ref_ptr<osgMap::postfx::PostProcessor> ppu =
-                    new osgMap::postfx::PostProcessor(scene);
+                ppu = new osgMap::postfx::PostProcessor(scene);
                 {
                     ppu->pushLayer<osgMap::postfx::FXAA>();
                     ppu->pushLayer<osgMap::postfx::DOF>();
@@ -519,6 +706,19 @@ int main(int argc, char** argv)
                         ppu->getLayer<osgMap::postfx::Bloom>())
                         ->setParameters(bloom_params);
 
+                    ppu->setStats(viewer->getViewerStats());
+                    for (auto* timer : ppu->getTimers())
+                    {
+                        statsHandler->addUserStatsLine(
+                            timer->getName() + ": ",
+                            osg::Vec4(0.7f, 0.9f, 1.0f, 1.0f),
+                            osg::Vec4(0.7f, 0.9f, 1.0f, 0.5f),
+                            timer->getStatName(), 1000.0, true, false, "",
+                            "", 0.0);
+                    }
+                    if (targetFps > 0.0)
+                        ppu->setDynamicResolution(targetFps, minResScale,
+                                                  maxResScale);
                     viewer->addEventHandler(ppu->getResizeHandler());
                     viewer->addEventHandler(
                         ppu->getActivationHandler<osgMap::postfx::FXAA>(
@@ -549,8 +749,39 @@ int main(int argc, char** argv)
 
                 // Add HUD AFTER realize() (totally allowed)
                 root->addChild(hud);
+
+                viewer->addEventHandler(new IdentifyHandler(scene, root));
+                viewer->addEventHandler(new ShaderLodBenchmark(
+                    shaderLodMode.get(), viewer->getViewerStats()));
                 viewer->setSceneData(root);
 
+                if (trackMemory)
+                    memoryBudget = new MemoryBudget(
+                        scene.get(),
+                        (uint64_t)(memBudgetMB * 1024.0 * 1024.0));
+
+                if (tileCache.valid())
+                {
+                    prefetcher =
+                        new TilePrefetcher(scene.get(), prefetchHorizon);
+
+                    // Najczestsze kafle poprzednich sesji, zanim kto podejdzie
+                    osg::ref_ptr<TileUsageLog> tileLog;
+                    if (!tileLogFile.empty())
+                    {
+                        if (warmTiles > 0)
+                            tileWarmer = new TileWarmer(
+                                tileCache->getDirectory(),
+                                TileUsageLog::readMostUsed(tileLogFile,
+                                                           warmTiles),
+                                viewer->getIncrementalCompileOperation());
+                        tileLog = new TileUsageLog(tileLogFile);
+                    }
+                    setTileUsage(tileLog.get(), tileWarmer.get());
+                    if (memoryBudget.valid())
+                        memoryBudget->setTileWarmer(tileWarmer.get());
+                }
+
                 // Initialize to visible
                 g_currentAlpha = 1.0f;
                 g_targetAlpha = 1.0f;
@@ -587,24 +818,30 @@ int main(int argc, char** argv)
                     if (moving)
                     {
                         g_targetAlpha = 0.0f; // Fade out when moving
+                        if (!wasMoving) landInfoQuery->cancel();
                     }
-                    else
+                    else if (wasMoving)
                     {
-                        g_targetAlpha = 1.0f; // Fade in when stopped
-
-                        // When just stopped moving, update text content
-                        if (wasMoving)
-                        {
-                            std::ostringstream ss;
-                            osg::Vec3d hit, normal;
-                            std::string landInfo =
-                                getLandInfoAtIntersection(root, hit);
-                            ss << "W pobliżu:\n" << landInfo;
-                            hudSetText(ss.str());
-                        }
+                        // Just stopped moving, query the text in background
+                        landInfoQuery->submit(scene.get(), root->getMatrix());
+                    }
+
+                    // Fade in when the text of the current pose is ready
+                    std::string landInfo;
+                    if (!moving && landInfoQuery->poll(landInfo))
+                    {
+                        std::ostringstream ss;
+                        ss << "W pobliżu:\n" << landInfo;
+                        hudSetText(ss.str());
+                        g_targetAlpha = 1.0f;
                     }
 
                     wasMoving = moving;
+
+                    // Kafle na drodze kamery, zanim je odslonimy
+                    if (prefetcher.valid())
+                        prefetcher->update(viewer.get(), *google,
+                                           root->getMatrix());
                 }
             }
 
@@ -636,5 +873,9 @@ int main(int argc, char** argv)
         }
     }
 
+    if (ppu.valid() && !timingsFile.empty()) ppu->writeTimings(timingsFile);
+    setTileUsage(nullptr, nullptr);
+    tileWarmer = nullptr;
+
     return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
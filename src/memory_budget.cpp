@@ -0,0 +1,349 @@
+#include "memory_budget.h"
+#include "tile_usage.h"
+
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <vector>
+
+namespace {
+
+const double UPDATE_INTERVAL = 1.0;
+
+// Warstwa kafli wczytanych zawczasu przez TileWarmer
+const char* WARM_LAYER = "warm tiles";
+
+// Children of a tile PagedLOD: child 0 is its own content
+const unsigned CHILDREN = 1;
+
+struct Candidate
+{
+    osg::ref_ptr<osg::PagedLOD> lod;
+    float distance;
+    uint64_t bytes;
+};
+
+class MemoryVisitor : public osg::NodeVisitor {
+public:
+    MemoryVisitor(const std::set<std::string>& layers, const osg::Vec3d& eye,
+                  float lodScale, unsigned frameNumber)
+        : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _layerNames(layers),
+          _layer("other"), _eye(eye), _lodScale(lodScale),
+          _frameNumber(frameNumber), _bytes(0), _inCandidate(false)
+    {}
+
+    std::map<std::string, MemoryUsage>& getLayers() { return _layers; }
+    std::vector<Candidate>& getCandidates() { return _candidates; }
+
+    void apply(osg::Node& node) override
+    {
+        countObject(node);
+        traverse(node);
+    }
+
+    void apply(osg::Group& group) override
+    {
+        // Kafle maja grupy warstw o tych samych nazwach co korzenie
+        std::string saved = _layer;
+        if (_layerNames.count(group.getName())) _layer = group.getName();
+        countObject(group);
+        traverse(group);
+        _layer = saved;
+    }
+
+    void apply(osg::PagedLOD& lod) override
+    {
+        if (_inCandidate || lod.getNumChildren() <= CHILDREN
+            || lod.getNumRanges() <= CHILDREN)
+        {
+            apply(static_cast<osg::Group&>(lod));
+            return;
+        }
+
+        float distance = (lod.getCenter() - _eye).length() * _lodScale;
+        if (distance < lod.getRangeList()[CHILDREN].second)
+        {
+            apply(static_cast<osg::Group&>(lod));
+            return;
+        }
+
+        // TilePrefetcher stempluje kafle potrzebne prognozie ruchu kamery
+        // (po tej aktualizacji, stad poprzednia klatka); usuniete zostalyby
+        // zaraz wczytane ponownie
+        if (lod.getFrameNumber(CHILDREN) + 1 >= _frameNumber)
+        {
+            apply(static_cast<osg::Group&>(lod));
+            return;
+        }
+
+        // Dzieci niewidoczne: mozna je usunac razem z calym poddrzewem
+        countObject(lod);
+        lod.getChild(0)->accept(*this);
+        uint64_t before = _bytes;
+        _inCandidate = true;
+        for (unsigned i = CHILDREN; i < lod.getNumChildren(); ++i)
+            lod.getChild(i)->accept(*this);
+        _inCandidate = false;
+        _candidates.push_back({ &lod, distance, _bytes - before });
+    }
+
+    void apply(osg::Drawable& drawable) override
+    {
+        countObject(drawable);
+        osg::Geometry* geometry = drawable.asGeometry();
+        if (!geometry) return;
+
+        countArray(geometry->getVertexArray());
+        countArray(geometry->getNormalArray());
+        countArray(geometry->getColorArray());
+        countArray(geometry->getSecondaryColorArray());
+        countArray(geometry->getFogCoordArray());
+        for (const auto& array : geometry->getTexCoordArrayList())
+            countArray(array.get());
+        for (const auto& array : geometry->getVertexAttribArrayList())
+            countArray(array.get());
+
+        for (const auto& primitiveSet : geometry->getPrimitiveSetList())
+        {
+            const osg::DrawElements* elements =
+                primitiveSet->getDrawElements();
+            if (elements && _buffers.insert(elements).second)
+                add(&MemoryUsage::indices, elements->getTotalDataSize());
+        }
+    }
+
+private:
+    void add(uint64_t MemoryUsage::*kind, uint64_t bytes)
+    {
+        _layers[_layer].*kind += bytes;
+        _bytes += bytes;
+    }
+
+    void countArray(const osg::Array* array)
+    {
+        if (array && _buffers.insert(array).second)
+            add(&MemoryUsage::vertices, array->getTotalDataSize());
+    }
+
+    void countObject(osg::Node& node)
+    {
+        const osgSim::ShapeAttributeList* sal =
+            dynamic_cast<const osgSim::ShapeAttributeList*>(
+                node.getUserData());
+        if (sal && _objects.insert(sal).second)
+            add(&MemoryUsage::attributes, getShapeAttributesSize(*sal));
+
+        const osg::StateSet* stateSet = node.getStateSet();
+        if (!stateSet) return;
+        for (const auto& unit : stateSet->getTextureAttributeList())
+        {
+            for (const auto& attribute : unit)
+            {
+                const osg::Texture* texture =
+                    attribute.second.first->asTexture();
+                if (texture && _objects.insert(texture).second)
+                    add(&MemoryUsage::textures, getTextureSize(*texture));
+            }
+        }
+    }
+
+    const std::set<std::string>& _layerNames;
+    std::string _layer;
+    osg::Vec3d _eye;
+    float _lodScale;
+    unsigned _frameNumber;
+
+    std::map<std::string, MemoryUsage> _layers;
+    uint64_t _bytes;
+    std::set<const osg::BufferData*> _buffers; // arrays shared by pieces
+    std::set<const osg::Referenced*> _objects; // textures, attributes
+
+    std::vector<Candidate> _candidates;
+    bool _inCandidate;
+};
+
+} // namespace
+
+/****************************************************************************/
+
+MemoryUsage& MemoryUsage::operator+=(const MemoryUsage& other)
+{
+    vertices += other.vertices;
+    indices += other.indices;
+    textures += other.textures;
+    attributes += other.attributes;
+    return *this;
+}
+
+MemoryUsage& MemoryUsage::operator-=(const MemoryUsage& other)
+{
+    vertices -= other.vertices;
+    indices -= other.indices;
+    textures -= other.textures;
+    attributes -= other.attributes;
+    return *this;
+}
+
+uint64_t getShapeAttributesSize(const osgSim::ShapeAttributeList& sal)
+{
+    uint64_t size =
+        sizeof(sal) + sal.capacity() * sizeof(osgSim::ShapeAttribute);
+    for (const osgSim::ShapeAttribute& attribute : sal)
+    {
+        size += attribute.getName().capacity();
+        if (attribute.getType() == osgSim::ShapeAttribute::STRING
+            && attribute.getString())
+            size += std::strlen(attribute.getString()) + 1;
+    }
+    return size;
+}
+
+uint64_t getTextureSize(const osg::Texture& texture)
+{
+    uint64_t size = 0;
+    for (unsigned i = 0; i < texture.getNumImages(); ++i)
+    {
+        if (const osg::Image* image = texture.getImage(i))
+            size += image->getTotalSizeInBytesIncludingMipmaps();
+    }
+    // Obraz zwolniony po wyslaniu: szacunek RGBA8 z mipmapami
+    if (size == 0)
+        size = (uint64_t)texture.getTextureWidth()
+               * std::max(texture.getTextureHeight(), 1)
+               * std::max(texture.getTextureDepth(), 1) * 4 * 4 / 3;
+    return size;
+}
+
+MemoryUsage getMemoryUsage(osg::Node& node)
+{
+    std::set<std::string> layerNames; // visitor keeps a reference
+    MemoryVisitor visitor(layerNames, osg::Vec3d(), 1.0f, 0);
+    node.accept(visitor);
+    MemoryUsage usage;
+    for (const auto& layer : visitor.getLayers()) usage += layer.second;
+    return usage;
+}
+
+/****************************************************************************/
+
+MemoryBudget::MemoryBudget(osg::Node* scene, uint64_t budget)
+    : _scene(scene), _budget(budget), _lastUpdate(-UPDATE_INTERVAL),
+      _overBudget(false), _numEvicted(0)
+{}
+
+void MemoryBudget::setTileWarmer(TileWarmer* warmer)
+{
+    _warmer = warmer;
+}
+
+void MemoryBudget::update(osgViewer::Viewer* viewer, const osg::Matrixd& ltw)
+{
+    osg::ref_ptr<osg::Node> scene;
+    const osg::FrameStamp* frameStamp = viewer->getFrameStamp();
+    if (!_scene.lock(scene) || !frameStamp) return;
+
+    double time = frameStamp->getReferenceTime();
+    if (time - _lastUpdate < UPDATE_INTERVAL) return;
+    _lastUpdate = time;
+
+    // Warstwy to nazwane dzieci korzenia (bez kafli)
+    std::set<std::string> layerNames;
+    if (osg::Group* group = scene->asGroup())
+    {
+        for (unsigned i = 0; i < group->getNumChildren(); ++i)
+        {
+            const std::string& name = group->getChild(i)->getName();
+            if (!name.empty() && name.compare(0, 4, "lod_") != 0
+                && name.compare(0, 5, "tile_") != 0)
+                layerNames.insert(name);
+        }
+    }
+
+    osg::Camera* camera = viewer->getCamera();
+    osg::Vec3d eye =
+        osg::Matrixd::inverse(ltw * camera->getViewMatrix()).getTrans();
+    MemoryVisitor visitor(layerNames, eye, camera->getLODScale(),
+                          frameStamp->getFrameNumber());
+    scene->accept(visitor);
+
+    _layers.swap(visitor.getLayers());
+    osg::ref_ptr<TileWarmer> warmer;
+    if (_warmer.lock(warmer))
+    {
+        MemoryUsage warm = warmer->getMemoryUsage();
+        if (warm.total()) _layers[WARM_LAYER] = warm;
+    }
+    _total = MemoryUsage();
+    for (const auto& layer : _layers) _total += layer.second;
+
+    if (!_budget || _total.total() <= _budget)
+    {
+        _overBudget = false;
+        return;
+    }
+
+    uint64_t target = _budget - _budget / 10;
+    uint64_t total = _total.total();
+    uint64_t freed = 0;
+    unsigned evicted = 0;
+
+    // Kafle wczytane zawczasu pierwsze: nikt ich jeszcze nie ogladal
+    if (warmer.valid() && _layers.count(WARM_LAYER))
+    {
+        uint64_t dropped = warmer->drop().total();
+        total -= std::min(total, dropped);
+        freed += dropped;
+    }
+
+    // Potem najdalsze kafle; zapas 10%, zeby nie usuwac co sekunde
+    std::vector<Candidate>& candidates = visitor.getCandidates();
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) {
+                  return a.distance > b.distance;
+              });
+    for (const Candidate& candidate : candidates)
+    {
+        if (total <= target) break;
+        osg::PagedLOD* lod = candidate.lod.get();
+        unsigned numChildren = lod->getNumChildren() - CHILDREN;
+        for (unsigned i = CHILDREN; i < lod->getNumChildren(); ++i)
+            lod->getChild(i)->releaseGLObjects();
+        lod->removeChildren(CHILDREN, numChildren);
+        total -= std::min(total, candidate.bytes);
+        freed += candidate.bytes;
+        ++evicted;
+    }
+    _numEvicted += evicted;
+
+    if (freed)
+    {
+        std::cout << "[MEMORY] Usunieto " << evicted << " kafli ("
+                  << freed / (1024 * 1024) << " MB), zostalo "
+                  << total / (1024 * 1024) << " MB" << std::endl;
+        // Podzial na warstwy liczony od nowa w nastepnej klatce
+        _lastUpdate = -UPDATE_INTERVAL;
+    }
+    if (total > _budget && !_overBudget)
+        std::cout << "[MEMORY] Widoczne kafle przekraczaja budzet "
+                  << _budget / (1024 * 1024) << " MB: "
+                  << total / (1024 * 1024) << " MB" << std::endl;
+    _overBudget = total > _budget;
+}
+
+void MemoryBudget::reportStats(osg::Stats* stats) const
+{
+    if (!stats) return;
+    const double MB = 1024.0 * 1024.0;
+    unsigned int frame = stats->getLatestFrameNumber();
+    stats->setAttribute(frame, "Memory MB", _total.total() / MB);
+    stats->setAttribute(frame, "Memory vertices MB", _total.vertices / MB);
+    stats->setAttribute(frame, "Memory indices MB", _total.indices / MB);
+    stats->setAttribute(frame, "Memory textures MB", _total.textures / MB);
+    stats->setAttribute(frame, "Memory attributes MB",
+                        _total.attributes / MB);
+    stats->setAttribute(frame, "Memory evicted tiles", (double)_numEvicted);
+}
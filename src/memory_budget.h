@@ -0,0 +1,104 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <osg/Matrixd>
+#include <osg/Node>
+#include <osg/Referenced>
+#include <osg/Stats>
+#include <osg/Texture>
+#include <osg/observer_ptr>
+#include <osgSim/ShapeAttribute>
+#include <osgViewer/Viewer>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Bytes of the data of a part of the scene, by kind
+struct MemoryUsage
+{
+    uint64_t vertices = 0;   // per vertex arrays: positions, normals, ...
+    uint64_t indices = 0;    // DrawElements of the primitive sets
+    uint64_t textures = 0;   // images of the textures, with mipmaps
+    uint64_t attributes = 0; // ShapeAttributeList user data
+
+    uint64_t total() const
+    {
+        return vertices + indices + textures + attributes;
+    }
+
+    MemoryUsage& operator+=(const MemoryUsage& other);
+    MemoryUsage& operator-=(const MemoryUsage& other);
+};
+
+// Size of a ShapeAttributeList with its names and strings
+uint64_t getShapeAttributesSize(const osgSim::ShapeAttributeList& sal);
+
+// Size of the images of a texture with mipmaps, estimated if released
+uint64_t getTextureSize(const osg::Texture& texture);
+
+// Memory of a subgraph, shared arrays and textures counted once
+MemoryUsage getMemoryUsage(osg::Node& node);
+
+class TileWarmer;
+
+/**
+ * Accounts for the memory of the map layers and keeps it under a budget.
+ *
+ * Once a second the scene is walked and the data of vertex arrays, index
+ * buffers, textures and feature attributes is summed per layer (the
+ * children of the scene root and the tile groups with their names); shared
+ * arrays and textures count once. The same data lives in the CPU copy and in
+ * the GPU buffers, so the sums stand for both.
+ *
+ * Tiles preloaded by a TileWarmer and not requested yet count as the
+ * "warm tiles" layer. When the total is over the budget they are dropped
+ * first; then the children of the farthest tile PagedLODs that neither the
+ * camera nor the TilePrefetcher's predicted view refines are removed, their
+ * GL objects released with them, down to 90% of the budget. The
+ * DatabasePager loads them again when the camera comes back.
+ */
+class MemoryBudget : public osg::Referenced {
+public:
+    /**
+     * @param scene Root of the layers, in the local frame
+     * @param budget Limit in bytes, 0 to only account
+     */
+    MemoryBudget(osg::Node* scene, uint64_t budget);
+
+    /**
+     * Recounts (once a second) and evicts tiles when over the budget. Call
+     * from the main loop after Viewer::frame().
+     *
+     * @param ltw Local to world matrix of the scene
+     */
+    void update(osgViewer::Viewer* viewer, const osg::Matrixd& ltw);
+
+    // Counts and drops the preloaded tiles of `warmer`, may be nullptr
+    void setTileWarmer(TileWarmer* warmer);
+
+    const MemoryUsage& getTotal() const { return _total; }
+    const std::map<std::string, MemoryUsage>& getLayers() const
+    {
+        return _layers;
+    }
+
+    // Sets "Memory ..." attributes of the latest frame
+    void reportStats(osg::Stats* stats) const;
+
+protected:
+    ~MemoryBudget() override = default;
+
+private:
+    osg::observer_ptr<osg::Node> _scene;
+    osg::observer_ptr<TileWarmer> _warmer;
+    uint64_t _budget;
+    double _lastUpdate;
+    bool _overBudget; // visible tiles alone do not fit, reported once
+
+    MemoryUsage _total;
+    std::map<std::string, MemoryUsage> _layers;
+    uint64_t _numEvicted;
+};
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,323 @@
+#include "memory_report.h"
+
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osgSim/ShapeAttribute>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+
+#include "memory_budget.h"
+
+namespace {
+
+// Atrybut wierzcholka ze stycznymi (a_tangent drog)
+const unsigned TANGENT_ATTRIB = 6;
+
+class ReportVisitor : public osg::NodeVisitor {
+public:
+    explicit ReportVisitor(const std::set<std::string>& layerNames)
+        : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _layerNames(layerNames),
+          _current(0)
+    {}
+
+    std::vector<LayerMemory>& getLayers() { return _layers; }
+
+    void setLayer(const std::string& name) { _current = getIndex(name); }
+
+    void apply(osg::Node& node) override
+    {
+        ++_layers[_current].nodes;
+        countObject(node);
+        traverse(node);
+    }
+
+    void apply(osg::Group& group) override
+    {
+        size_t saved = _current;
+        if (_layerNames.count(group.getName()))
+            _current = getIndex(group.getName());
+        ++_layers[_current].nodes;
+        countObject(group);
+        traverse(group);
+        _current = saved;
+    }
+
+    void apply(osg::Drawable& drawable) override
+    {
+        LayerMemory& layer = _layers[_current];
+        ++layer.drawables;
+        countObject(drawable);
+        osg::Geometry* geometry = drawable.asGeometry();
+        if (!geometry) return;
+
+        const osg::Array* vertices = geometry->getVertexArray();
+        if (vertices && _objects.count(vertices) == 0)
+            layer.vertices += vertices->getNumElements();
+        countArray(vertices, &LayerMemory::positionBytes);
+        countArray(geometry->getNormalArray(), &LayerMemory::normalBytes);
+        countArray(geometry->getColorArray(), &LayerMemory::colorBytes);
+        countArray(geometry->getSecondaryColorArray(),
+                   &LayerMemory::otherArrayBytes);
+        countArray(geometry->getFogCoordArray(),
+                   &LayerMemory::otherArrayBytes);
+        for (const auto& array : geometry->getTexCoordArrayList())
+            countArray(array.get(), &LayerMemory::texCoordBytes);
+
+        const osg::Geometry::ArrayList& attribs =
+            geometry->getVertexAttribArrayList();
+        for (unsigned i = 0; i < attribs.size(); ++i)
+        {
+            countArray(attribs[i].get(), i == TANGENT_ATTRIB
+                                             ? &LayerMemory::tangentBytes
+                                             : &LayerMemory::otherArrayBytes);
+        }
+
+        layer.primitiveSets += geometry->getNumPrimitiveSets();
+        for (const auto& primitiveSet : geometry->getPrimitiveSetList())
+        {
+            const osg::DrawElements* elements =
+                primitiveSet->getDrawElements();
+            if (elements && _objects.insert(elements).second)
+                layer.indexBytes += elements->getTotalDataSize();
+        }
+    }
+
+private:
+    size_t getIndex(const std::string& name)
+    {
+        auto it = _index.find(name);
+        if (it != _index.end()) return it->second;
+        _layers.emplace_back();
+        _layers.back().name = name;
+        _index[name] = _layers.size() - 1;
+        return _layers.size() - 1;
+    }
+
+    void countArray(const osg::Array* array, uint64_t LayerMemory::*bytes)
+    {
+        if (array && _objects.insert(array).second)
+            _layers[_current].*bytes += array->getTotalDataSize();
+    }
+
+    void countObject(osg::Node& node)
+    {
+        LayerMemory& layer = _layers[_current];
+
+        const osgSim::ShapeAttributeList* sal =
+            dynamic_cast<const osgSim::ShapeAttributeList*>(
+                node.getUserData());
+        if (sal && _objects.insert(sal).second)
+        {
+            ++layer.attributeLists;
+            layer.attributeBytes += getShapeAttributesSize(*sal);
+        }
+
+        // Dane rysowane z callbacka, poza grafem (etykiety)
+        if (const MemoryReporter* reporter =
+                dynamic_cast<const MemoryReporter*>(node.getCullCallback()))
+            reporter->reportMemory(layer);
+
+        const osg::StateSet* stateSet = node.getStateSet();
+        if (!stateSet || !_objects.insert(stateSet).second) return;
+        ++layer.stateSets;
+        for (const auto& unit : stateSet->getTextureAttributeList())
+        {
+            for (const auto& attribute : unit)
+            {
+                const osg::Texture* texture =
+                    attribute.second.first->asTexture();
+                if (!texture || !_objects.insert(texture).second) continue;
+                ++layer.textures;
+                layer.textureBytes += getTextureSize(*texture);
+            }
+        }
+    }
+
+    const std::set<std::string>& _layerNames;
+    std::vector<LayerMemory> _layers;
+    std::map<std::string, size_t> _index;
+    size_t _current;
+
+    // Obiekty wspoldzielone liczone raz
+    std::set<const osg::Referenced*> _objects;
+};
+
+bool isTileName(const std::string& name)
+{
+    return name.compare(0, 4, "lod_") == 0 || name.compare(0, 5, "tile_") == 0;
+}
+
+uint64_t toKB(uint64_t bytes) { return (bytes + 512) / 1024; }
+
+LayerMemory getTotal(const std::vector<LayerMemory>& layers)
+{
+    LayerMemory total;
+    total.name = "total";
+    for (const LayerMemory& layer : layers) total += layer;
+    return total;
+}
+
+void writeJsonLayer(std::ostream& out, const LayerMemory& layer)
+{
+    std::string name;
+    for (char c : layer.name)
+    {
+        if (c == '"' || c == '\\') name += '\\';
+        name += c;
+    }
+
+    out << "{\"name\": \"" << name << "\", \"nodes\": " << layer.nodes
+        << ", \"drawables\": " << layer.drawables
+        << ", \"vertices\": " << layer.vertices
+        << ", \"primitive_sets\": " << layer.primitiveSets
+        << ", \"state_sets\": " << layer.stateSets
+        << ", \"textures\": " << layer.textures
+        << ", \"attribute_lists\": " << layer.attributeLists
+        << ", \"bytes\": {\"positions\": " << layer.positionBytes
+        << ", \"normals\": " << layer.normalBytes
+        << ", \"colors\": " << layer.colorBytes
+        << ", \"texcoords\": " << layer.texCoordBytes
+        << ", \"tangents\": " << layer.tangentBytes
+        << ", \"other_arrays\": " << layer.otherArrayBytes
+        << ", \"indices\": " << layer.indexBytes
+        << ", \"textures\": " << layer.textureBytes
+        << ", \"attributes\": " << layer.attributeBytes
+        << ", \"cpu\": " << layer.cpuBytes
+        << ", \"total\": " << layer.totalBytes() << "}}";
+}
+
+} // namespace
+
+/****************************************************************************/
+
+uint64_t LayerMemory::totalBytes() const
+{
+    return positionBytes + normalBytes + colorBytes + texCoordBytes
+           + tangentBytes + otherArrayBytes + indexBytes + textureBytes
+           + attributeBytes + cpuBytes;
+}
+
+LayerMemory& LayerMemory::operator+=(const LayerMemory& other)
+{
+    nodes += other.nodes;
+    drawables += other.drawables;
+    vertices += other.vertices;
+    primitiveSets += other.primitiveSets;
+    stateSets += other.stateSets;
+    textures += other.textures;
+    attributeLists += other.attributeLists;
+    positionBytes += other.positionBytes;
+    normalBytes += other.normalBytes;
+    colorBytes += other.colorBytes;
+    texCoordBytes += other.texCoordBytes;
+    tangentBytes += other.tangentBytes;
+    otherArrayBytes += other.otherArrayBytes;
+    indexBytes += other.indexBytes;
+    textureBytes += other.textureBytes;
+    attributeBytes += other.attributeBytes;
+    cpuBytes += other.cpuBytes;
+    return *this;
+}
+
+std::vector<LayerMemory>
+createMemoryReport(const std::vector<osg::Node*>& roots)
+{
+    std::set<std::string> layerNames;
+    for (osg::Node* root : roots)
+    {
+        if (root && !root->getName().empty() && !isTileName(root->getName()))
+            layerNames.insert(root->getName());
+    }
+
+    ReportVisitor visitor(layerNames);
+    for (osg::Node* root : roots)
+    {
+        if (!root) continue;
+        const std::string& name = root->getName();
+        visitor.setLayer(name.empty()       ? "other"
+                         : isTileName(name) ? "tiles"
+                                            : name);
+        root->accept(visitor);
+    }
+    return visitor.getLayers();
+}
+
+void writeMemoryTable(std::ostream& out,
+                      const std::vector<LayerMemory>& layers)
+{
+    std::vector<LayerMemory> rows = layers;
+    rows.push_back(getTotal(layers));
+
+    out << std::left << std::setw(14) << "layer" << std::right
+        << std::setw(9) << "nodes" << std::setw(11) << "drawables"
+        << std::setw(11) << "vertices" << std::setw(10) << "primsets"
+        << std::setw(11) << "statesets" << std::setw(10) << "textures"
+        << std::setw(11) << "attrlists" << "\n";
+    for (const LayerMemory& row : rows)
+    {
+        out << std::left << std::setw(14) << row.name << std::right
+            << std::setw(9) << row.nodes << std::setw(11) << row.drawables
+            << std::setw(11) << row.vertices << std::setw(10)
+            << row.primitiveSets << std::setw(11) << row.stateSets
+            << std::setw(10) << row.textures << std::setw(11)
+            << row.attributeLists << "\n";
+    }
+
+    out << "\n"
+        << std::left << std::setw(14) << "KB" << std::right << std::setw(10)
+        << "positions" << std::setw(10) << "normals" << std::setw(10)
+        << "colors" << std::setw(10) << "texcoords" << std::setw(10)
+        << "tangents" << std::setw(10) << "other" << std::setw(10)
+        << "indices" << std::setw(10) << "textures" << std::setw(10)
+        << "attribs" << std::setw(10) << "cpu" << std::setw(10) << "total"
+        << "\n";
+    for (const LayerMemory& row : rows)
+    {
+        out << std::left << std::setw(14) << row.name << std::right
+            << std::setw(10) << toKB(row.positionBytes) << std::setw(10)
+            << toKB(row.normalBytes) << std::setw(10) << toKB(row.colorBytes)
+            << std::setw(10) << toKB(row.texCoordBytes) << std::setw(10)
+            << toKB(row.tangentBytes) << std::setw(10)
+            << toKB(row.otherArrayBytes) << std::setw(10)
+            << toKB(row.indexBytes) << std::setw(10)
+            << toKB(row.textureBytes) << std::setw(10)
+            << toKB(row.attributeBytes) << std::setw(10)
+            << toKB(row.cpuBytes) << std::setw(10) << toKB(row.totalBytes())
+            << "\n";
+    }
+}
+
+void writeMemoryJson(std::ostream& out,
+                     const std::vector<LayerMemory>& layers)
+{
+    out << "{\n  \"layers\": [";
+    for (size_t i = 0; i < layers.size(); ++i)
+    {
+        out << (i ? ",\n    " : "\n    ");
+        writeJsonLayer(out, layers[i]);
+    }
+    out << "\n  ],\n  \"total\": ";
+    writeJsonLayer(out, getTotal(layers));
+    out << "\n}\n";
+}
+
+bool writeMemoryReport(const std::vector<osg::Node*>& roots,
+                       const std::string& path)
+{
+    std::vector<LayerMemory> layers = createMemoryReport(roots);
+    writeMemoryTable(std::cout, layers);
+
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "[MEMORY] Nie mozna zapisac " << path << std::endl;
+        return false;
+    }
+    writeMemoryJson(file, layers);
+    std::cout << "[MEMORY] Raport pamieci zapisany do " << path << std::endl;
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include <osg/Node>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Scene graph data of one layer, counts and bytes by structure
+struct LayerMemory
+{
+    std::string name;
+
+    unsigned nodes = 0; // without drawables
+    unsigned drawables = 0;
+    uint64_t vertices = 0;
+    unsigned primitiveSets = 0;
+    unsigned stateSets = 0;
+    unsigned textures = 0;
+    unsigned attributeLists = 0; // ShapeAttributeList user data
+
+    uint64_t positionBytes = 0;
+    uint64_t normalBytes = 0;
+    uint64_t colorBytes = 0;
+    uint64_t texCoordBytes = 0;
+    uint64_t tangentBytes = 0;
+    uint64_t otherArrayBytes = 0; // secondary color, fog, other attributes
+    uint64_t indexBytes = 0;
+    uint64_t textureBytes = 0;
+    uint64_t attributeBytes = 0;
+    uint64_t cpuBytes = 0; // data outside the scene graph (label placement)
+
+    uint64_t totalBytes() const;
+
+    LayerMemory& operator+=(const LayerMemory& other);
+};
+
+/**
+ * Implemented by the cull callbacks that draw data kept outside the scene
+ * graph (the labels), so that the report counts it with their node.
+ */
+class MemoryReporter {
+public:
+    virtual void reportMemory(LayerMemory& layer) const = 0;
+
+protected:
+    virtual ~MemoryReporter() = default;
+};
+
+/**
+ * Walks the layers and accounts for their data per layer.
+ *
+ * Every root is a layer named after it; tile groups with the name of a
+ * layer anywhere below count to that layer, the rest of a tile pyramid to
+ * "tiles". Objects shared by several layers (arrays, StateSets, textures,
+ * attribute lists) count once, in the first layer that uses them. Nodes
+ * whose cull callback is a MemoryReporter add what it reports.
+ */
+std::vector<LayerMemory>
+createMemoryReport(const std::vector<osg::Node*>& roots);
+
+// Table of the counts and of the bytes, with a total row
+void writeMemoryTable(std::ostream& out,
+                      const std::vector<LayerMemory>& layers);
+
+// {"layers": [...], "total": {...}}
+void writeMemoryJson(std::ostream& out,
+                     const std::vector<LayerMemory>& layers);
+
+/**
+ * Prints the report of `roots` as a table and writes it as JSON to `path`.
+ */
+bool writeMemoryReport(const std::vector<osg::Node*>& roots,
+                       const std::string& path);
+
+#endif // MEMORY_REPORT_H
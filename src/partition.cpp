@@ -0,0 +1,745 @@
+#include "partition.h"
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Timer>
+#include <osg/Transform>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <typeinfo>
+#include <vector>
+
+// Geometria dluzsza niz 1/SPLIT_GRID warstwy jest dzielona na kawalki
+static const int SPLIT_GRID = 16;
+// Komorka jest dzielona na cwiartki, dopoki ma wiecej wierzcholkow
+static const unsigned MAX_CELL_VERTICES = 65536;
+static const int MAX_DEPTH = 8;
+
+namespace {
+
+struct Item
+{
+    osg::Group* parent; // before partitioning
+    osg::ref_ptr<osg::Node> node;
+    osg::StateSet* state; // merged state above the item, may be null
+    osg::BoundingBox box;
+    unsigned weight;
+};
+
+// Prymitywy jako listy indeksow wierzcholkow
+struct Primitives
+{
+    std::vector<unsigned> points;
+    std::vector<unsigned> lines;
+    std::vector<unsigned> triangles;
+};
+
+/****************************************************************************/
+
+bool isPlainGroup(const osg::Node* node)
+{
+    return typeid(*node) == typeid(osg::Group)
+           || typeid(*node) == typeid(osg::Geode);
+}
+
+bool hasCallbacks(const osg::Node* node)
+{
+    return node->getUpdateCallback() || node->getEventCallback()
+           || node->getCullCallback()
+           || node->getComputeBoundingSphereCallback();
+}
+
+unsigned numVertices(const osg::Geometry* geometry)
+{
+    const osg::Array* vertices = geometry->getVertexArray();
+    return vertices ? vertices->getNumElements() : 0;
+}
+
+/****************************************************************************/
+
+class StateMerger {
+public:
+    // Stan wynikowy lancucha stanow od korzenia warstwy w dol
+    osg::StateSet* merge(const std::vector<osg::StateSet*>& chain)
+    {
+        if (chain.empty()) return nullptr;
+        if (chain.size() == 1) return chain[0];
+
+        osg::ref_ptr<osg::StateSet>& merged = _merged[chain];
+        if (!merged)
+        {
+            merged = new osg::StateSet(*chain[0], osg::CopyOp::SHALLOW_COPY);
+            for (size_t i = 1; i < chain.size(); ++i) merged->merge(*chain[i]);
+        }
+        return merged.get();
+    }
+
+private:
+    std::map<std::vector<osg::StateSet*>, osg::ref_ptr<osg::StateSet>> _merged;
+};
+
+void collect(osg::Group* group, std::vector<osg::StateSet*>& chain,
+             StateMerger& merger, std::vector<Item>& items)
+{
+    for (unsigned i = 0; i < group->getNumChildren(); ++i)
+    {
+        osg::Node* child = group->getChild(i);
+        if (child->getNumParents() != 1 || hasCallbacks(child)) continue;
+
+        Item item;
+        item.parent = group;
+        item.node = child;
+        item.state = merger.merge(chain);
+
+        osg::Transform* transform = child->asTransform();
+        osg::Geometry* geometry = child->asGeometry();
+        if (transform
+            && transform->getReferenceFrame() == osg::Transform::RELATIVE_RF)
+        {
+            item.box.expandBy(transform->getBound());
+            item.weight = 1000; // instancje sa tanie, liczy sie ich liczba
+            items.push_back(item);
+        }
+        else if (geometry && typeid(*geometry) == typeid(osg::Geometry))
+        {
+            item.box = geometry->getBoundingBox();
+            item.weight = numVertices(geometry);
+            if (item.box.valid()) items.push_back(item);
+        }
+        else if (isPlainGroup(child))
+        {
+            // Stan samej geometrii jedzie razem z nia
+            if (child->getStateSet()) chain.push_back(child->getStateSet());
+            collect(child->asGroup(), chain, merger, items);
+            if (child->getStateSet()) chain.pop_back();
+        }
+    }
+}
+
+// Usuwa puste grupy, z ktorych wyniesiono geometrie
+void prune(osg::Group* group)
+{
+    for (unsigned i = group->getNumChildren(); i-- > 0;)
+    {
+        osg::Node* child = group->getChild(i);
+        if (!isPlainGroup(child) || hasCallbacks(child)) continue;
+        prune(child->asGroup());
+        if (child->asGroup()->getNumChildren() == 0) group->removeChild(i);
+    }
+}
+
+/****************************************************************************/
+
+template <typename Index>
+bool decompose(GLenum mode, unsigned count, Index index, Primitives& out)
+{
+    switch (mode)
+    {
+    case GL_POINTS:
+        for (unsigned k = 0; k < count; ++k) out.points.push_back(index(k));
+        return true;
+    case GL_LINES:
+        for (unsigned k = 0; k + 1 < count; k += 2)
+            out.lines.insert(out.lines.end(), { index(k), index(k + 1) });
+        return true;
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+        for (unsigned k = 1; k < count; ++k)
+            out.lines.insert(out.lines.end(), { index(k - 1), index(k) });
+        if (mode == GL_LINE_LOOP && count > 2)
+            out.lines.insert(out.lines.end(), { index(count - 1), index(0) });
+        return true;
+    case GL_TRIANGLES:
+        for (unsigned k = 0; k + 2 < count; k += 3)
+            out.triangles.insert(out.triangles.end(),
+                                 { index(k), index(k + 1), index(k + 2) });
+        return true;
+    case GL_TRIANGLE_STRIP:
+        // Co drugi trojkat ma odwrocona kolejnosc, zachowujemy orientacje
+        for (unsigned k = 2; k < count; ++k)
+        {
+            if (k % 2 == 0)
+                out.triangles.insert(out.triangles.end(),
+                                     { index(k - 2), index(k - 1), index(k) });
+            else
+                out.triangles.insert(out.triangles.end(),
+                                     { index(k - 1), index(k - 2), index(k) });
+        }
+        return true;
+    case GL_TRIANGLE_FAN:
+    case GL_POLYGON:
+        for (unsigned k = 2; k < count; ++k)
+            out.triangles.insert(out.triangles.end(),
+                                 { index(0), index(k - 1), index(k) });
+        return true;
+    case GL_QUADS:
+        for (unsigned k = 0; k + 3 < count; k += 4)
+            out.triangles.insert(out.triangles.end(),
+                                 { index(k), index(k + 1), index(k + 2),
+                                   index(k), index(k + 2), index(k + 3) });
+        return true;
+    case GL_QUAD_STRIP:
+        for (unsigned k = 3; k < count; k += 2)
+            out.triangles.insert(out.triangles.end(),
+                                 { index(k - 3), index(k - 2), index(k),
+                                   index(k - 3), index(k), index(k - 1) });
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool decompose(const osg::Geometry& geometry, Primitives& out)
+{
+    for (const auto& set : geometry.getPrimitiveSetList())
+    {
+        if (set->getNumInstances() > 0) return false;
+
+        GLenum mode = set->getMode();
+        if (auto* lengths = dynamic_cast<const osg::DrawArrayLengths*>(
+                set.get()))
+        {
+            unsigned first = lengths->getFirst();
+            for (GLint length : *lengths)
+            {
+                if (!decompose(mode, length,
+                               [first](unsigned k) { return first + k; },
+                               out))
+                    return false;
+                first += length;
+            }
+        }
+        else if (set->getType() == osg::PrimitiveSet::DrawArraysPrimitiveType
+                 || set->getDrawElements())
+        {
+            const osg::PrimitiveSet* s = set.get();
+            if (!decompose(mode, s->getNumIndices(),
+                           [s](unsigned k) { return s->index(k); }, out))
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/****************************************************************************/
+
+class RemapArray : public osg::ArrayVisitor {
+public:
+    RemapArray(const std::vector<unsigned>& remap): _remap(remap) {}
+
+    osg::ref_ptr<osg::Array> result;
+
+    void apply(osg::FloatArray& array) override { remap(array); }
+    void apply(osg::Vec2Array& array) override { remap(array); }
+    void apply(osg::Vec3Array& array) override { remap(array); }
+    void apply(osg::Vec4Array& array) override { remap(array); }
+    void apply(osg::Vec4ubArray& array) override { remap(array); }
+    void apply(osg::DoubleArray& array) override { remap(array); }
+    void apply(osg::Vec2dArray& array) override { remap(array); }
+    void apply(osg::Vec3dArray& array) override { remap(array); }
+    void apply(osg::Vec4dArray& array) override { remap(array); }
+
+private:
+    template <class T> void remap(const T& array)
+    {
+        osg::ref_ptr<T> out = new T;
+        out->reserve(_remap.size());
+        for (unsigned i : _remap) out->push_back(array[i]);
+        out->setBinding(array.getBinding());
+        out->setNormalize(array.getNormalize());
+        result = out;
+    }
+
+    const std::vector<unsigned>& _remap;
+};
+
+// Tablica po wybranych wierzcholkach; nullptr gdy typ nie jest obslugiwany
+osg::Array* remapArray(osg::Array* array, const std::vector<unsigned>& remap)
+{
+    if (!array || array->getBinding() != osg::Array::BIND_PER_VERTEX)
+        return array;
+    RemapArray visitor(remap);
+    array->accept(visitor);
+    return visitor.result.release();
+}
+
+bool canSplit(const osg::Geometry& geometry)
+{
+    unsigned n = numVertices(&geometry);
+    osg::Geometry::ArrayList arrays;
+    geometry.getArrayList(arrays);
+    for (const auto& array : arrays)
+    {
+        osg::Array::Binding binding = array->getBinding();
+        if (binding == osg::Array::BIND_OVERALL) continue;
+        if (binding != osg::Array::BIND_PER_VERTEX
+            || array->getNumElements() != n)
+            return false;
+
+        std::vector<unsigned> none;
+        RemapArray visitor(none);
+        const_cast<osg::Array*>(array.get())->accept(visitor);
+        if (!visitor.result) return false;
+    }
+    return n > 0;
+}
+
+osg::Geometry* createPiece(const osg::Geometry& geometry,
+                           const Primitives& primitives)
+{
+    // Wierzcholki kawalka w kolejnosci pierwszego uzycia
+    std::vector<unsigned> remap;
+    std::vector<int> newIndex(numVertices(&geometry), -1);
+    auto reindex = [&](const std::vector<unsigned>& indices) {
+        osg::ref_ptr<osg::DrawElementsUInt> elements =
+            new osg::DrawElementsUInt;
+        elements->reserve(indices.size());
+        for (unsigned i : indices)
+        {
+            if (newIndex[i] < 0)
+            {
+                newIndex[i] = (int)remap.size();
+                remap.push_back(i);
+            }
+            elements->push_back((unsigned)newIndex[i]);
+        }
+        return elements;
+    };
+
+    osg::ref_ptr<osg::DrawElementsUInt> points = reindex(primitives.points);
+    osg::ref_ptr<osg::DrawElementsUInt> lines = reindex(primitives.lines);
+    osg::ref_ptr<osg::DrawElementsUInt> triangles =
+        reindex(primitives.triangles);
+
+    // Plytka kopia: stan i atrybuty rekordu sa wspoldzielone
+    osg::Geometry* piece =
+        new osg::Geometry(geometry, osg::CopyOp::SHALLOW_COPY);
+    piece->removePrimitiveSet(0, piece->getNumPrimitiveSets());
+
+    piece->setVertexArray(remapArray(piece->getVertexArray(), remap));
+    piece->setNormalArray(remapArray(piece->getNormalArray(), remap));
+    piece->setColorArray(remapArray(piece->getColorArray(), remap));
+    piece->setSecondaryColorArray(
+        remapArray(piece->getSecondaryColorArray(), remap));
+    piece->setFogCoordArray(remapArray(piece->getFogCoordArray(), remap));
+    for (unsigned unit = 0; unit < piece->getNumTexCoordArrays(); ++unit)
+        piece->setTexCoordArray(
+            unit, remapArray(piece->getTexCoordArray(unit), remap));
+    for (unsigned i = 0; i < piece->getNumVertexAttribArrays(); ++i)
+        piece->setVertexAttribArray(
+            i, remapArray(piece->getVertexAttribArray(i), remap));
+
+    if (!points->empty())
+    {
+        points->setMode(GL_POINTS);
+        piece->addPrimitiveSet(points);
+    }
+    if (!lines->empty())
+    {
+        lines->setMode(GL_LINES);
+        piece->addPrimitiveSet(lines);
+    }
+    if (!triangles->empty())
+    {
+        triangles->setMode(GL_TRIANGLES);
+        piece->addPrimitiveSet(triangles);
+    }
+    piece->dirtyBound();
+    return piece;
+}
+
+/**
+ * Dzieli geometrie wg komorek siatki (po srodku ciezkosci prymitywu).
+ * Zwraca false, gdy geometrii nie da sie albo nie trzeba dzielic.
+ */
+bool split(const Item& item, const osg::BoundingBox& layerBox,
+           float cellSize, std::vector<Item>& pieces)
+{
+    const osg::Geometry& geometry = *item.node->asGeometry();
+    if (item.box.xMax() - item.box.xMin() <= cellSize
+        && item.box.yMax() - item.box.yMin() <= cellSize)
+        return false;
+
+    Primitives all;
+    if (!canSplit(geometry) || !decompose(geometry, all)) return false;
+
+    const osg::Vec3Array* vertices =
+        dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+    if (!vertices) return false;
+
+    std::map<int, Primitives> cells;
+    auto add = [&](const std::vector<unsigned>& in, unsigned size,
+                   std::vector<unsigned> Primitives::*list) {
+        for (size_t k = 0; k + size <= in.size(); k += size)
+        {
+            osg::Vec3 c;
+            for (unsigned j = 0; j < size; ++j) c += (*vertices)[in[k + j]];
+            c /= (float)size;
+            int x = std::clamp((int)((c.x() - layerBox.xMin()) / cellSize), 0,
+                               SPLIT_GRID - 1);
+            int y = std::clamp((int)((c.y() - layerBox.yMin()) / cellSize), 0,
+                               SPLIT_GRID - 1);
+            std::vector<unsigned>& out = cells[y * SPLIT_GRID + x].*list;
+            out.insert(out.end(), in.begin() + k, in.begin() + k + size);
+        }
+    };
+    add(all.points, 1, &Primitives::points);
+    add(all.lines, 2, &Primitives::lines);
+    add(all.triangles, 3, &Primitives::triangles);
+    if (cells.size() < 2) return false;
+
+    for (const auto& cell : cells)
+    {
+        Item piece = item;
+        osg::Geometry* geometryPiece = createPiece(geometry, cell.second);
+        piece.node = geometryPiece;
+        piece.box = geometryPiece->getBoundingBox();
+        piece.weight = numVertices(geometryPiece);
+        pieces.push_back(piece);
+    }
+    return true;
+}
+
+/****************************************************************************/
+
+// Geometrie zgrupowane wg stanu (Geode na stan), transformacje osobno
+osg::Group* buildLeaf(const std::vector<Item*>& items, const std::string& name)
+{
+    osg::Group* cell = new osg::Group;
+    cell->setName(name);
+    std::map<osg::StateSet*, osg::Geode*> geodes;
+    std::map<osg::StateSet*, osg::Group*> groups;
+    for (Item* item : items)
+    {
+        if (osg::Geometry* geometry = item->node->asGeometry())
+        {
+            osg::Geode*& geode = geodes[item->state];
+            if (!geode)
+            {
+                geode = new osg::Geode;
+                geode->setStateSet(item->state);
+                cell->addChild(geode);
+            }
+            geode->addDrawable(geometry);
+        }
+        else
+        {
+            osg::Group*& group = groups[item->state];
+            if (!group)
+            {
+                group = new osg::Group;
+                group->setStateSet(item->state);
+                cell->addChild(group);
+            }
+            group->addChild(item->node.get());
+        }
+    }
+    return cell;
+}
+
+osg::Node* buildCell(std::vector<Item*>& items, const osg::BoundingBox& box,
+                     int depth, int x, int y, unsigned& numCells)
+{
+    unsigned weight = 0;
+    for (const Item* item : items) weight += item->weight;
+
+    if (items.size() > 1 && weight > MAX_CELL_VERTICES && depth < MAX_DEPTH)
+    {
+        osg::Vec3 center = box.center();
+        std::vector<Item*> quadrants[4];
+        for (Item* item : items)
+        {
+            osg::Vec3 c = item->box.center();
+            quadrants[(c.x() >= center.x()) + 2 * (c.y() >= center.y())]
+                .push_back(item);
+        }
+
+        osg::ref_ptr<osg::Group> cell = new osg::Group;
+        for (int q = 0; q < 4; ++q)
+        {
+            if (quadrants[q].empty()) continue;
+            osg::BoundingBox sub = box;
+            (q & 1 ? sub.xMin() : sub.xMax()) = center.x();
+            (q & 2 ? sub.yMin() : sub.yMax()) = center.y();
+            cell->addChild(buildCell(quadrants[q], sub, depth + 1,
+                                     2 * x + (q & 1), 2 * y + (q >> 1),
+                                     numCells));
+        }
+        // Wszystko w jednej cwiartce: bez pustego poziomu
+        if (cell->getNumChildren() == 1)
+        {
+            osg::ref_ptr<osg::Node> only = cell->getChild(0);
+            cell->removeChildren(0, 1);
+            return only.release();
+        }
+        cell->setName("cell_" + std::to_string(depth) + "_"
+                      + std::to_string(x) + "_" + std::to_string(y));
+        return cell.release();
+    }
+
+    ++numCells;
+    return buildLeaf(items, "cell_" + std::to_string(depth) + "_"
+                                + std::to_string(x) + "_" + std::to_string(y));
+}
+
+} // namespace
+
+/****************************************************************************/
+
+osg::Node* partitionLayer(osg::Node* layer, const std::string& name)
+{
+    if (!layer || !layer->asGroup()) return layer;
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // Geode przyjmuje tylko drawable, wiec jej miejsce zajmuje grupa
+    osg::ref_ptr<osg::Group> root = layer->asGroup();
+    if (layer->asGeode())
+    {
+        root = new osg::Group;
+        root->setName(layer->getName());
+        root->setStateSet(layer->getStateSet());
+        root->setUserDataContainer(layer->getUserDataContainer());
+        root->setUpdateCallback(layer->getUpdateCallback());
+        root->setEventCallback(layer->getEventCallback());
+        root->setCullCallback(layer->getCullCallback());
+        root->setNodeMask(layer->getNodeMask());
+        root->addChild(layer);
+        layer->setStateSet(nullptr);
+        layer->setUserDataContainer(nullptr);
+        layer->setUpdateCallback(nullptr);
+        layer->setEventCallback(nullptr);
+        layer->setCullCallback(nullptr);
+    }
+
+    std::vector<Item> collected;
+    std::vector<osg::StateSet*> chain;
+    StateMerger merger;
+    collect(root.get(), chain, merger, collected);
+    if (collected.empty())
+    {
+        std::cout << "[PARTITION] " << name << ": brak geometrii do podzialu"
+                  << std::endl;
+        return root.release();
+    }
+
+    osg::BoundingBox layerBox;
+    for (const Item& item : collected) layerBox.expandBy(item.box);
+    float cellSize = std::max(layerBox.xMax() - layerBox.xMin(),
+                              layerBox.yMax() - layerBox.yMin())
+                     / SPLIT_GRID;
+
+    std::vector<Item> items;
+    unsigned numSplit = 0;
+    for (const Item& item : collected)
+    {
+        item.parent->removeChild(item.node.get());
+        if (item.node->asGeometry() && cellSize > 0.0f
+            && split(item, layerBox, cellSize, items))
+            ++numSplit;
+        else
+            items.push_back(item);
+    }
+    prune(root.get());
+
+    std::vector<Item*> pointers;
+    for (Item& item : items) pointers.push_back(&item);
+    unsigned numCells = 0;
+    osg::Node* tree = buildCell(pointers, layerBox, 0, 0, 0, numCells);
+    tree->setName("quadtree");
+    root->addChild(tree);
+
+    std::cout << "[PARTITION] " << name << ": " << collected.size()
+              << " obiektow (" << numSplit << " podzielonych), "
+              << items.size() << " w " << numCells << " komorkach, "
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms" << std::endl;
+    return root.release();
+}
+
+/****************************************************************************/
+
+LayerTiler::LayerTiler(osg::Node* layer, const std::string& name,
+                       const osg::BoundingBox& extent, int levels,
+                       float detail)
+    : _name(name), _extent(extent), _leaf(std::max(levels, 1) - 1)
+{
+    const int n = 1 << _leaf;
+    _parts.resize(n * n);
+    if (!layer || !layer->asGroup()) return;
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    _state = layer->getStateSet();
+
+    std::vector<Item> collected;
+    std::vector<osg::StateSet*> chain;
+    StateMerger merger;
+    collect(layer->asGroup(), chain, merger, collected);
+
+    const float size = std::max(extent.xMax() - extent.xMin(),
+                                extent.yMax() - extent.yMin());
+    const float leafSize = size / n;
+
+    // Najgrubszy poziom, na ktorym obiekt o rozpietosci `span` jest widoczny
+    auto levelOf = [&](float span) {
+        if (span <= 0.0f || detail <= 0.0f) return _leaf;
+        int level = (int)std::ceil(std::log2(size / (detail * span)));
+        return std::clamp(level, 0, _leaf);
+    };
+    auto tileOf = [&](const osg::Vec3& p) {
+        int x = std::clamp((int)((p.x() - extent.xMin()) / leafSize), 0,
+                           n - 1);
+        int y = std::clamp((int)((p.y() - extent.yMin()) / leafSize), 0,
+                           n - 1);
+        return y * n + x;
+    };
+    auto spanOf = [](const osg::BoundingBox& box) {
+        return std::max(box.xMax() - box.xMin(), box.yMax() - box.yMin());
+    };
+
+    unsigned numWhole = 0;
+    for (const Item& item : collected)
+    {
+        item.parent->removeChild(item.node.get());
+        const unsigned index = (unsigned)_nodes.size();
+        _nodes.push_back(item.node);
+        _states.push_back(item.state);
+
+        const osg::Geometry* geometry = item.node->asGeometry();
+        const osg::Vec3Array* vertices =
+            geometry ? dynamic_cast<const osg::Vec3Array*>(
+                           geometry->getVertexArray())
+                     : nullptr;
+        Primitives all;
+        if (!vertices || !canSplit(*geometry) || !decompose(*geometry, all))
+        {
+            Part part;
+            part.item = index;
+            part.level = levelOf(spanOf(item.box));
+            part.whole = true;
+            _parts[tileOf(item.box.center())].push_back(part);
+            ++numWhole;
+            continue;
+        }
+
+        std::map<std::pair<int, int>, Part> parts; // (kafel, poziom)
+        auto add = [&](const std::vector<unsigned>& in, unsigned size,
+                       std::vector<unsigned> Part::*list) {
+            for (size_t k = 0; k + size <= in.size(); k += size)
+            {
+                osg::BoundingBox box;
+                osg::Vec3 c;
+                for (unsigned j = 0; j < size; ++j)
+                {
+                    box.expandBy((*vertices)[in[k + j]]);
+                    c += (*vertices)[in[k + j]];
+                }
+                c /= (float)size;
+                std::vector<unsigned>& out =
+                    parts[{ tileOf(c), levelOf(spanOf(box)) }].*list;
+                out.insert(out.end(), in.begin() + k, in.begin() + k + size);
+            }
+        };
+        add(all.points, 1, &Part::points);
+        add(all.lines, 2, &Part::lines);
+        add(all.triangles, 3, &Part::triangles);
+
+        for (auto& entry : parts)
+        {
+            Part& part = entry.second;
+            part.item = index;
+            part.level = entry.first.second;
+            part.whole = false;
+            _parts[entry.first.first].push_back(std::move(part));
+        }
+    }
+    prune(layer->asGroup());
+
+    std::cout << "[PARTITION] " << name << ": " << collected.size()
+              << " obiektow (" << numWhole << " w calosci) w piramidzie "
+              << _leaf + 1 << " poziomow, "
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms" << std::endl;
+}
+
+LayerTiler::~LayerTiler() = default;
+
+bool LayerTiler::isEmpty(int level, int x, int y) const
+{
+    if (level < 0 || level > _leaf) return true;
+    const int n = 1 << _leaf;
+    const int shift = _leaf - level;
+    for (int ty = y << shift; ty < (y + 1) << shift; ++ty)
+        for (int tx = x << shift; tx < (x + 1) << shift; ++tx)
+            if (!_parts[ty * n + tx].empty()) return false;
+    return true;
+}
+
+osg::Group* LayerTiler::createTile(int level, int x, int y) const
+{
+    if (level < 0 || level > _leaf) return nullptr;
+    const int n = 1 << _leaf;
+    const int shift = _leaf - level;
+
+    // Prymitywy kazdego obiektu ze wszystkich kafli-lisci pod tym kaflem
+    std::map<unsigned, Primitives> pieces;
+    std::vector<unsigned> whole;
+    for (int ty = y << shift; ty < (y + 1) << shift; ++ty)
+    {
+        for (int tx = x << shift; tx < (x + 1) << shift; ++tx)
+        {
+            for (const Part& part : _parts[ty * n + tx])
+            {
+                if (part.level > level) continue;
+                if (part.whole)
+                {
+                    whole.push_back(part.item);
+                    continue;
+                }
+                Primitives& p = pieces[part.item];
+                p.points.insert(p.points.end(), part.points.begin(),
+                                part.points.end());
+                p.lines.insert(p.lines.end(), part.lines.begin(),
+                               part.lines.end());
+                p.triangles.insert(p.triangles.end(), part.triangles.begin(),
+                                   part.triangles.end());
+            }
+        }
+    }
+    if (pieces.empty() && whole.empty()) return nullptr;
+
+    // Kopie wspoldziela stany, a rodzice stanow nie sa chronieni mutexem
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<Item> items;
+    items.reserve(pieces.size() + whole.size());
+    for (const auto& entry : pieces)
+    {
+        Item item{};
+        item.node = createPiece(*_nodes[entry.first]->asGeometry(),
+                                entry.second);
+        item.state = _states[entry.first].get();
+        items.push_back(item);
+    }
+    for (unsigned i : whole)
+    {
+        Item item{};
+        item.node = _nodes[i];
+        item.state = _states[i].get();
+        items.push_back(item);
+    }
+
+    std::vector<Item*> pointers;
+    for (Item& item : items) pointers.push_back(&item);
+    osg::Group* tile = buildLeaf(pointers, _name);
+    tile->setStateSet(_state.get());
+    return tile;
+}
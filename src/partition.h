@@ -0,0 +1,93 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <osg/BoundingBox>
+#include <osg/Group>
+#include <osg/StateSet>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Moves the geometry of a layer into a quadtree of cells on the local XY
+ * plane, so that culling skips whole cells out of view instead of testing
+ * (or drawing) the whole layer.
+ *
+ * Geometries larger than 1/16 of the layer are split by primitive into
+ * grid-aligned pieces that share the user data (shapefile attributes).
+ * Transforms (instanced subgraphs) and geometries that cannot be split
+ * (instanced draws) are bucketed whole by the centre of their bound, so
+ * their cell is drawn whenever any of them is in view; producers keep
+ * them local. The state sets between the layer root and each moved item
+ * are merged onto its cell; nodes that are not plain groups, geodes or
+ * geometries (light sources, nodes with callbacks, custom drawables) are
+ * left where they are.
+ *
+ * @param layer Layer root (local frame)
+ * @param name Layer name for the log
+ * @return The partitioned layer: `layer` itself, or a group replacing it if
+ *         it was a Geode (taking over its state, callbacks and user data)
+ */
+osg::Node* partitionLayer(osg::Node* layer, const std::string& name);
+
+/**
+ * Cuts a layer into the tiles of a quadtree pyramid over a square extent on
+ * the local XY plane, for paging. Every primitive goes to the leaf tile
+ * holding its centroid; a coarser tile only keeps the primitives spanning
+ * at least 1/detail of its size, so tiles hold about the same detail on
+ * screen at every level. Transforms and geometries that cannot be split
+ * are kept whole, by the centre of their bound.
+ *
+ * The geometry is taken out of the layer; what is left there (the root
+ * state, lights, nodes with callbacks) is not part of any tile. Tiles are
+ * created on demand, from any thread.
+ */
+class LayerTiler : public osg::Referenced {
+public:
+    /**
+     * @param layer Layer root (local frame)
+     * @param name Layer name, also the name of its group in each tile
+     * @param extent Extent of the whole pyramid (square in XY)
+     * @param levels Number of levels, the root tile being level 0
+     * @param detail Smallest kept primitive, as a fraction of the tile size
+     */
+    LayerTiler(osg::Node* layer, const std::string& name,
+               const osg::BoundingBox& extent, int levels, float detail);
+
+    const std::string& getName() const { return _name; }
+
+    // True if the layer has no geometry in the tile nor below it
+    bool isEmpty(int level, int x, int y) const;
+
+    // Geometry of the layer in one tile, under the layer root state;
+    // nullptr if the tile has none at its level
+    osg::Group* createTile(int level, int x, int y) const;
+
+protected:
+    ~LayerTiler() override;
+
+private:
+    // Primitives of one item in one leaf tile, kept from `level` down;
+    // a whole item has no primitives
+    struct Part
+    {
+        unsigned item;
+        int level;
+        bool whole;
+        std::vector<unsigned> points;
+        std::vector<unsigned> lines;
+        std::vector<unsigned> triangles;
+    };
+
+    std::string _name;
+    osg::BoundingBox _extent;
+    int _leaf; // level of the leaf tiles
+    osg::ref_ptr<osg::StateSet> _state;
+    std::vector<osg::ref_ptr<osg::Node>> _nodes;
+    std::vector<osg::ref_ptr<osg::StateSet>> _states; // merged, per item
+    std::vector<std::vector<Part>> _parts; // per leaf tile, row by row
+    mutable std::mutex _mutex;
+};
+
+#endif // PARTITION_H
@@ -0,0 +1,174 @@
+#include "pass_timer.h"
+
+#include <algorithm>
+
+#include <osg/FrameStamp>
+#include <osg/State>
+
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+using namespace osgMap::postfx;
+
+/**************************************************************************************************/
+
+PassTimer::PassTimer(const std::string& name, osg::Stats* stats)
+    : m_name(name), m_stats(stats), m_initialized(false), m_gpu(false),
+      m_current(-1), m_cpu_begin(0)
+{}
+
+/**************************************************************************************************/
+
+void PassTimer::attach(osg::Camera* first, osg::Camera* last)
+{
+    if (m_first.valid() && m_first != first)
+        m_first->setInitialDrawCallback(nullptr);
+    if (m_last.valid() && m_last != last) m_last->setFinalDrawCallback(nullptr);
+
+    m_first = first;
+    m_last = last;
+    m_first->setInitialDrawCallback(new Callback(this, true));
+    m_last->setFinalDrawCallback(new Callback(this, false));
+}
+
+/**************************************************************************************************/
+
+PassTimer::Summary PassTimer::getSummary(void) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_summary;
+}
+
+/**************************************************************************************************/
+
+void PassTimer::Callback::operator()(osg::RenderInfo& render_info) const
+{
+    osg::ref_ptr<PassTimer> timer;
+    if (!m_timer.lock(timer)) return;
+
+    if (m_begin)
+        timer->begin(render_info);
+    else
+        timer->end(render_info);
+}
+
+/**************************************************************************************************/
+
+void PassTimer::begin(osg::RenderInfo& render_info)
+{
+    osg::State* state = render_info.getState();
+    osg::GLExtensions* extensions = state->get<osg::GLExtensions>();
+
+    // Zapytania nie sa zwalniane, zyja tyle co kontekst
+    if (!m_initialized)
+    {
+        m_initialized = true;
+        m_gpu = extensions->isARBTimerQuerySupported;
+        if (m_gpu)
+        {
+            for (auto& query : m_queries)
+            {
+                extensions->glGenQueries(1, &query.begin);
+                extensions->glGenQueries(1, &query.end);
+            }
+        }
+    }
+
+    unsigned int frame =
+        state->getFrameStamp() ? state->getFrameStamp()->getFrameNumber() : 0;
+
+    if (!m_gpu)
+    {
+        m_current = (int)frame;
+        m_cpu_begin = osg::Timer::instance()->tick();
+        return;
+    }
+
+    collect(extensions);
+
+    // Wszystkie zapytania w drodze: pomijamy klatke zamiast czekac na GPU
+    m_current = -1;
+    for (int i = 0; i < NUM_QUERIES; ++i)
+    {
+        if (!m_queries[i].pending)
+        {
+            m_current = i;
+            break;
+        }
+    }
+    if (m_current < 0) return;
+
+    Query& query = m_queries[m_current];
+    query.frame = frame;
+    extensions->glQueryCounter(query.begin, GL_TIMESTAMP);
+}
+
+/**************************************************************************************************/
+
+void PassTimer::end(osg::RenderInfo& render_info)
+{
+    if (m_current < 0) return;
+
+    if (!m_gpu)
+    {
+        record((unsigned int)m_current,
+               osg::Timer::instance()->delta_s(
+                   m_cpu_begin, osg::Timer::instance()->tick()));
+        m_current = -1;
+        return;
+    }
+
+    osg::GLExtensions* extensions =
+        render_info.getState()->get<osg::GLExtensions>();
+    Query& query = m_queries[m_current];
+    extensions->glQueryCounter(query.end, GL_TIMESTAMP);
+    query.pending = true;
+    m_current = -1;
+}
+
+/**************************************************************************************************/
+
+void PassTimer::collect(osg::GLExtensions* extensions)
+{
+    for (auto& query : m_queries)
+    {
+        if (!query.pending) continue;
+
+        // Koniec jest zapisywany po poczatku, wiec wystarczy sprawdzic jego
+        GLint available = 0;
+        extensions->glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE,
+                                       &available);
+        if (!available) continue;
+
+        GLuint64 begin_ns = 0, end_ns = 0;
+        extensions->glGetQueryObjectui64v(query.begin, GL_QUERY_RESULT,
+                                          &begin_ns);
+        extensions->glGetQueryObjectui64v(query.end, GL_QUERY_RESULT,
+                                          &end_ns);
+        query.pending = false;
+
+        if (end_ns >= begin_ns) record(query.frame, (end_ns - begin_ns) * 1e-9);
+    }
+}
+
+/**************************************************************************************************/
+
+void PassTimer::record(unsigned int frame, double seconds)
+{
+    if (m_stats.valid()) m_stats->setAttribute(frame, getStatName(), seconds);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double ms = seconds * 1000.0;
+    m_summary.gpu = m_gpu;
+    m_summary.min_ms = m_summary.frames ? std::min(m_summary.min_ms, ms) : ms;
+    m_summary.max_ms = std::max(m_summary.max_ms, ms);
+    m_summary.total_ms += ms;
+    ++m_summary.frames;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include <osg/Camera>
+#include <osg/GL>
+#include <osg/GLExtensions>
+#include <osg/Referenced>
+#include <osg/Stats>
+#include <osg/Timer>
+#include <osg/observer_ptr>
+
+namespace osgMap::postfx {
+
+/**************************************************************************************************/
+
+/**
+ * Times a range of render passes, from the start of the first camera to the
+ * end of the last one. With GL_ARB_timer_query the GPU time is measured by
+ * timestamp queries kept in a small ring and read only once available, so
+ * the draw thread never waits for the GPU; otherwise the CPU time of the
+ * draw is measured instead.
+ *
+ * Results go to the stats as "<name> time taken" (seconds), in the frame
+ * the passes were drawn in.
+ */
+class PassTimer : public osg::Referenced {
+public:
+    struct Summary
+    {
+        bool gpu = false;
+        unsigned int frames = 0;
+        double total_ms = 0.0;
+        double min_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+    PassTimer(const std::string& name, osg::Stats* stats);
+
+    // Installs the draw callbacks, replacing those of a previous range
+    void attach(osg::Camera* first, osg::Camera* last);
+
+    const std::string& getName(void) const { return m_name; }
+    std::string getStatName(void) const { return m_name + " time taken"; }
+    Summary getSummary(void) const;
+
+protected:
+    ~PassTimer(void) override = default;
+
+private:
+    class Callback : public osg::Camera::DrawCallback {
+    public:
+        Callback(PassTimer* timer, bool begin)
+            : m_timer(timer), m_begin(begin)
+        {}
+        void operator()(osg::RenderInfo& render_info) const override;
+
+    private:
+        osg::observer_ptr<PassTimer> m_timer;
+        bool m_begin;
+    };
+
+    void begin(osg::RenderInfo& render_info);
+    void end(osg::RenderInfo& render_info);
+    void collect(osg::GLExtensions* extensions);
+    void record(unsigned int frame, double seconds);
+
+    static const int NUM_QUERIES = 4;
+
+    struct Query
+    {
+        GLuint begin = 0;
+        GLuint end = 0;
+        unsigned int frame = 0;
+        bool pending = false;
+    };
+
+    std::string m_name;
+    osg::ref_ptr<osg::Stats> m_stats;
+    osg::ref_ptr<osg::Camera> m_first;
+    osg::ref_ptr<osg::Camera> m_last;
+
+    // draw thread only
+    bool m_initialized;
+    bool m_gpu;
+    Query m_queries[NUM_QUERIES];
+    int m_current; // query of the range being drawn, -1 if skipped
+    osg::Timer_t m_cpu_begin;
+
+    mutable std::mutex m_mutex;
+    Summary m_summary;
+};
+
+} // namespace osgMap::postfx
@@ -0,0 +1,192 @@
+#include "picking.h"
+#include "feature_index.h"
+#include "HUD.h"
+
+#include <osg/Geometry>
+#include <osg/KdTree>
+#include <osg/Timer>
+#include <osgUtil/IntersectionVisitor>
+#include <osgUtil/LineSegmentIntersector>
+#include <osgViewer/View>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+// Prototype of instanced buildings: its vertices lie around the origin,
+// the copies are placed in the shader, and its bound covers all of them
+static bool isInstanced(const osg::Geometry& geometry)
+{
+    for (const auto& primitiveSet : geometry.getPrimitiveSetList())
+        if (primitiveSet->getNumInstances() > 0) return true;
+    return false;
+}
+
+class GeometryCollector : public osg::NodeVisitor {
+public:
+    std::vector<osg::Geometry*> geometries;
+
+    GeometryCollector(): osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Geometry& geometry) override
+    {
+        if (!dynamic_cast<osg::KdTree*>(geometry.getShape())
+            && !isInstanced(geometry))
+            geometries.push_back(&geometry);
+    }
+};
+
+// Skips instanced prototypes, which would be hit at the map centre
+class FeatureIntersector : public osgUtil::LineSegmentIntersector {
+public:
+    FeatureIntersector(const osg::Vec3d& start, const osg::Vec3d& end)
+        : osgUtil::LineSegmentIntersector(MODEL, start, end)
+    {}
+
+    void intersect(osgUtil::IntersectionVisitor& iv,
+                   osg::Drawable* drawable) override
+    {
+        const osg::Geometry* geometry = drawable->asGeometry();
+        if (geometry && isInstanced(*geometry)) return;
+        osgUtil::LineSegmentIntersector::intersect(iv, drawable);
+    }
+};
+
+static unsigned numVertices(const osg::Geometry* geometry)
+{
+    const osg::Array* vertices = geometry->getVertexArray();
+    return vertices ? vertices->getNumElements() : 0;
+}
+
+void buildKdTrees(const std::vector<osg::Node*>& layers)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    GeometryCollector collector;
+    for (osg::Node* layer : layers)
+        if (layer) layer->accept(collector);
+
+    // Najwieksze najpierw, zeby watki konczyly mniej wiecej razem
+    std::vector<osg::Geometry*>& geometries = collector.geometries;
+    std::sort(geometries.begin(), geometries.end(),
+              [](const osg::Geometry* a, const osg::Geometry* b) {
+                  return numVertices(a) > numVertices(b);
+              });
+
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        osg::ref_ptr<osg::KdTreeBuilder> builder = new osg::KdTreeBuilder;
+        for (size_t i = next++; i < geometries.size(); i = next++)
+            builder->apply(*geometries[i]);
+    };
+
+    unsigned numThreads = std::min<unsigned>(
+        std::thread::hardware_concurrency(), (unsigned)geometries.size());
+    numThreads = std::max(1u, numThreads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads; ++t) threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads) thread.join();
+
+    std::cout << "[PICK] KD-drzewa dla " << geometries.size()
+              << " geometrii (" << numThreads << " watkow): "
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms" << std::endl;
+}
+
+/****************************************************************************/
+
+IdentifyHandler::IdentifyHandler(osg::Group* layers,
+                                 osg::MatrixTransform* root)
+    : _layers(layers), _root(root), _pushX(0.0f), _pushY(0.0f)
+{}
+
+bool IdentifyHandler::handle(const osgGA::GUIEventAdapter& ea,
+                             osgGA::GUIActionAdapter& aa)
+{
+    if (ea.getButton() != osgGA::GUIEventAdapter::LEFT_MOUSE_BUTTON)
+        return false;
+
+    if (ea.getEventType() == osgGA::GUIEventAdapter::PUSH)
+    {
+        _pushX = ea.getX();
+        _pushY = ea.getY();
+    }
+    else if (ea.getEventType() == osgGA::GUIEventAdapter::RELEASE)
+    {
+        // Przeciagniecie to przesuwanie mapy, nie klikniecie
+        const float CLICK_TOLERANCE = 3.0f;
+        if (std::abs(ea.getX() - _pushX) > CLICK_TOLERANCE
+            || std::abs(ea.getY() - _pushY) > CLICK_TOLERANCE)
+            return false;
+
+        osgViewer::View* view = dynamic_cast<osgViewer::View*>(&aa);
+        if (!view) return false;
+
+        std::string info = identify(view->getCamera(), ea.getX(), ea.getY());
+        if (!info.empty())
+        {
+            hudSetText("Wskazano:\n" + info);
+            g_targetAlpha = 1.0f;
+        }
+    }
+    return false;
+}
+
+std::string IdentifyHandler::identify(osg::Camera* camera, float x,
+                                      float y) const
+{
+    osg::Viewport* viewport = camera->getViewport();
+    if (!viewport) return "";
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // Odcinek przez kursor w ukladzie lokalnym warstw
+    osg::Matrixd windowToLocal = osg::Matrixd::inverse(
+        _root->getMatrix() * camera->getViewMatrix()
+        * camera->getProjectionMatrix() * viewport->computeWindowMatrix());
+    osg::Vec3d nearPoint = osg::Vec3d(x, y, 0.0) * windowToLocal;
+    osg::Vec3d farPoint = osg::Vec3d(x, y, 1.0) * windowToLocal;
+
+    osg::ref_ptr<FeatureIntersector> picker =
+        new FeatureIntersector(nearPoint, farPoint);
+    picker->setIntersectionLimit(osgUtil::Intersector::LIMIT_NEAREST);
+    osgUtil::IntersectionVisitor iv(picker.get());
+    iv.setUseKdTreeWhenAvailable(true);
+    _layers->accept(iv);
+
+    std::string info;
+    if (picker->containsIntersections())
+    {
+        const osgUtil::LineSegmentIntersector::Intersection& hit =
+            picker->getFirstIntersection();
+
+        // Atrybuty sa na drawable albo na ktoryms z rodzicow
+        osg::NodePath path = hit.nodePath;
+        if (hit.drawable.valid()) path.push_back(hit.drawable.get());
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+        {
+            const osgSim::ShapeAttributeList* sal =
+                dynamic_cast<const osgSim::ShapeAttributeList*>(
+                    (*it)->getUserData());
+            if (!sal) continue;
+
+            FeatureIndex::Feature feature = FeatureIndex::readFeature(*sal);
+            if (!feature.fclass.empty())
+            {
+                info = translateFclass(feature.fclass);
+                if (!feature.name.empty()) info += ": " + feature.name;
+            }
+            break;
+        }
+    }
+
+    std::cout << "[PICK] " << (info.empty() ? "-" : info) << " ("
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms)" << std::endl;
+    return info;
+}
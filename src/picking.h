@@ -0,0 +1,49 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <osg/Group>
+#include <osg/MatrixTransform>
+#include <osg/ref_ptr>
+#include <osgGA/GUIEventHandler>
+
+#include <string>
+#include <vector>
+
+/**
+ * Builds an osg::KdTree for every geometry of the given layers except
+ * instanced ones. Geometries are spread over all hardware threads, largest
+ * first; intersection visitors pick the trees up automatically. Null layers
+ * are skipped.
+ */
+void buildKdTrees(const std::vector<osg::Node*>& layers);
+
+/**
+ * Click-to-identify: a left click without dragging intersects the layers
+ * under the cursor and shows the class and name of the hit feature on the
+ * HUD.
+ *
+ * Instanced buildings are not identifiable: their shared prototype has no
+ * attributes and its geometry is placed by the shader, so the intersector
+ * skips it and the click goes through to the ground below.
+ */
+class IdentifyHandler : public osgGA::GUIEventHandler {
+public:
+    /**
+     * @param layers Group with the layers (local frame)
+     * @param root Transform holding the local to world matrix
+     */
+    IdentifyHandler(osg::Group* layers, osg::MatrixTransform* root);
+
+    bool handle(const osgGA::GUIEventAdapter& ea,
+                osgGA::GUIActionAdapter& aa) override;
+
+private:
+    // Text for the feature under the window point, empty if nothing named
+    std::string identify(osg::Camera* camera, float x, float y) const;
+
+    osg::ref_ptr<osg::Group> _layers;
+    osg::ref_ptr<osg::MatrixTransform> _root;
+    float _pushX, _pushY;
+};
+
+#endif // PICKING_H
@@ -1,6 +1,13 @@
 #include "post_process.h"
 
+#include <cmath>
 #include <string>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
 #include <functional>
 
 #include <osg/Geometry>
@@ -19,50 +26,44 @@ static std::string s_shader_path = SHADER_PATH;
 
 osg::Program* createProgram(const std::string& vert_filename,
                             const std::string& frag_filename);
+osg::Program* createProgramFromSource(const std::string& vert_filename,
+                                      const std::string& frag_source);
 
 /**************************************************************************************************/
 
-osg::Geode* createRenderPlane(osg::ref_ptr<osg::Program>& program,
-                              osg::ref_ptr<osg::Texture2D>& color_texture,
-                              osg::ref_ptr<osg::Texture2D>& depth_texture);
+osg::Geode* createRenderPlane(void);
+osg::StateSet* createPlaneStateSet(osg::Program* program,
+                                   const Layer::Inputs& inputs);
+osg::Camera* createPassCamera(void);
 
 /**************************************************************************************************/
-/* LAYER */
-/**************************************************************************************************/
 
-unsigned int Layer::s_layer_index =
-    1; // 0 is reserved for the PostProcessor class
+osg::Texture2D* createColorTexture(bool linear_filter);
 
+/**************************************************************************************************/
+/* LAYER */
 /**************************************************************************************************/
 
 Layer::Layer(osg::ref_ptr<osg::Texture2D>& in_color_texture,
              osg::ref_ptr<osg::Texture2D>& out_color_texture,
              osg::ref_ptr<osg::Texture2D>& depth_texture,
              const std::string& frag_filename, PostProcessor* parent)
-    : m_camera(new osg::Camera),
-      m_resolution(new osg::Uniform("u_resolution", Vec2(0.0f, 0.0f))),
-      m_is_active(new osg::Uniform("u_is_active", true))
+    : Layer(parent)
 {
-    osg::ref_ptr<osg::Program> program =
-        createProgram("passthrough.vert", frag_filename);
-    m_render_plane =
-        createRenderPlane(program, in_color_texture, depth_texture);
-    osg::StateSet* state_set = m_render_plane->getOrCreateStateSet();
-    state_set->addUniform(m_resolution);
-    state_set->addUniform(m_is_active);
+    // Wejscie i wyjscie sa podpinane przez PostProcessor::rebuild()
+    addPass(frag_filename,
+            { { "color_texture", nullptr },
+              { "depth_texture", depth_texture.get() } },
+            nullptr);
+}
 
-    m_camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
-    m_camera->attach(osg::Camera::COLOR_BUFFER0, out_color_texture.get());
-    m_camera->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
-    m_camera->setViewMatrix(osg::Matrix::identity());
-    m_camera->setProjectionMatrix(osg::Matrix::ortho2D(-1, 1, -1, 1));
-    m_camera->setRenderOrder(osg::Camera::PRE_RENDER, s_layer_index++);
-    m_camera->setAllowEventFocus(false);
-    m_camera->setClearMask(0);
-    m_camera->setInheritanceMask(m_camera->getInheritanceMask()
-                                 & ~osg::Camera::CULL_MASK);
-    m_camera->addChild(m_render_plane);
-    parent->addChild(m_camera);
+/**************************************************************************************************/
+
+Layer::Layer(PostProcessor* parent)
+    : m_state_set(new osg::StateSet), m_parent(parent),
+      m_is_active(new osg::Uniform("u_is_active", true))
+{
+    m_state_set->addUniform(m_is_active);
 }
 
 /**************************************************************************************************/
@@ -71,24 +72,226 @@ Layer::~Layer(void) = default;
 
 /**************************************************************************************************/
 
+osg::StateSet* Layer::addPass(const std::string& frag_filename,
+                              const Inputs& inputs, osg::Texture2D* output,
+                              int divisor)
+{
+    Pass pass;
+    pass.camera = createPassCamera();
+    pass.resolution = new osg::Uniform("u_resolution", Vec2(0.0f, 0.0f));
+    pass.writes_output = output == nullptr;
+    pass.divisor = divisor;
+
+    osg::Geode* render_plane = createRenderPlane();
+    render_plane->setStateSet(createPlaneStateSet(
+        createProgram("passthrough.vert", frag_filename), inputs));
+    pass.plane_state = render_plane->getStateSet();
+    pass.plane_state->addUniform(pass.resolution);
+    for (unsigned int unit = 0; unit < inputs.size(); ++unit)
+    {
+        if (!inputs[unit].second) pass.input_units.push_back(unit);
+    }
+
+    if (output) pass.camera->attach(osg::Camera::COLOR_BUFFER0, output);
+    pass.camera->setStateSet(m_state_set.get());
+    pass.camera->addChild(render_plane);
+
+    m_passes.push_back(pass);
+    return pass.plane_state;
+}
+
+/**************************************************************************************************/
+
+void Layer::setStage(const std::string& filename, const std::string& function,
+                     const Inputs& inputs)
+{
+    osg::ref_ptr<osg::Shader> shader = osg::Shader::readShaderFile(
+        osg::Shader::FRAGMENT, s_shader_path + filename);
+    if (!shader)
+    {
+        std::cout << "[POSTFX] Brak pliku " << filename << std::endl;
+        return;
+    }
+
+    m_stage.source = shader->getShaderSource();
+    m_stage.function = function;
+    m_stage.inputs = inputs;
+}
+
+/**************************************************************************************************/
+
+void Layer::setActive(bool active)
+{
+    m_is_active->set(active);
+    m_parent->rebuild();
+}
+
+/**************************************************************************************************/
+
+void Layer::connect(osg::Texture2D* input, osg::Texture2D* output,
+                    osg::Group* group, unsigned int& render_order)
+{
+    for (auto& pass : m_passes)
+    {
+        for (unsigned int unit : pass.input_units)
+        {
+            pass.plane_state->setTextureAttributeAndModes(unit, input);
+        }
+        if (pass.writes_output)
+        {
+            pass.camera->detach(osg::Camera::COLOR_BUFFER0);
+            pass.camera->attach(osg::Camera::COLOR_BUFFER0, output);
+            pass.camera->dirtyAttachmentMap();
+        }
+        pass.camera->setRenderOrder(osg::Camera::PRE_RENDER, render_order++);
+        group->addChild(pass.camera);
+    }
+}
+
+/**************************************************************************************************/
+
+osg::StateSet* Layer::createDirectStateSet(osg::Texture2D* input)
+{
+    const Pass& pass = m_passes.front();
+    osg::StateSet* state_set =
+        new osg::StateSet(*pass.plane_state, osg::CopyOp::SHALLOW_COPY);
+    for (unsigned int unit : pass.input_units)
+    {
+        state_set->setTextureAttributeAndModes(unit, input);
+    }
+    // Render plane nie lezy pod kamera warstwy, wiec uniformy ida tu
+    state_set->merge(*m_state_set);
+    return state_set;
+}
+
+/**************************************************************************************************/
+
+void Layer::attachTimer(PassTimer* timer)
+{
+    if (!timer || m_passes.empty()) return;
+    timer->attach(m_passes.front().camera.get(), m_passes.back().camera.get());
+}
+
+/**************************************************************************************************/
+
 void Layer::resize(int width, int height)
 {
-    m_camera->setViewport(0, 0, width, height);
-    m_camera->resizeAttachments(width, height);
-    m_resolution->set(osg::Vec2((float)width, (float)height));
+    for (auto& pass : m_passes)
+    {
+        int pass_width = std::max(1, width / pass.divisor);
+        int pass_height = std::max(1, height / pass.divisor);
+        pass.camera->setViewport(0, 0, pass_width, pass_height);
+        pass.camera->resizeAttachments(pass_width, pass_height);
+        // Ta sama tekstura bywa podpieta do kilku kamer
+        pass.camera->dirtyAttachmentMap();
+        pass.resolution->set(
+            osg::Vec2((float)pass_width, (float)pass_height));
+    }
+}
+
+/**************************************************************************************************/
+/* DOF */
+/**************************************************************************************************/
+
+DOF::DOF(osg::ref_ptr<osg::Texture2D>& in_color_texture,
+         osg::ref_ptr<osg::Texture2D>& out_color_texture,
+         osg::ref_ptr<osg::Texture2D>& depth_texture, PostProcessor* parent)
+    : Layer(parent), m_max_blur(new osg::Uniform("u_max_blur", 0.03f)),
+      m_blur_ramp(new osg::Uniform("u_blur_ramp", 100.0f)),
+      m_focus_range(new osg::Uniform("u_focus_range", 0.986f)),
+      m_half(createColorTexture(true)), m_blurred(createColorTexture(true))
+{
+    m_state_set->addUniform(m_max_blur);
+    m_state_set->addUniform(m_blur_ramp);
+    m_state_set->addUniform(m_focus_range);
+
+    addPass("dof_coc.frag",
+            { { "color_texture", nullptr },
+              { "depth_texture", depth_texture.get() } },
+            m_half.get(), 2);
+    addPass("dof_blur.frag", { { "color_texture", m_half.get() } },
+            m_blurred.get(), 2);
+    addPass("dof_composite.frag",
+            { { "color_texture", nullptr },
+              { "depth_texture", depth_texture.get() },
+              { "dof_texture", m_blurred.get() } },
+            nullptr);
+}
+
+/**************************************************************************************************/
+/* BLOOM */
+/**************************************************************************************************/
+
+Bloom::Bloom(osg::ref_ptr<osg::Texture2D>& in_color_texture,
+             osg::ref_ptr<osg::Texture2D>& out_color_texture,
+             osg::ref_ptr<osg::Texture2D>& depth_texture,
+             PostProcessor* parent)
+    : Layer(parent), m_threshold(new osg::Uniform("u_threshold", 0.9f)),
+      m_knee(new osg::Uniform("u_knee", 0.4f)),
+      m_blur_scale(new osg::Uniform("u_blur_scale", 1.0f)),
+      m_intensity(new osg::Uniform("u_bloom_intensity", 2.0f))
+{
+    m_state_set->addUniform(m_threshold);
+    m_state_set->addUniform(m_knee);
+    m_state_set->addUniform(m_blur_scale);
+    m_state_set->addUniform(m_intensity);
+
+    for (int level = 0; level < MIP_LEVELS; ++level)
+    {
+        m_mips[level] = createColorTexture(true);
+        m_blurred[level] = createColorTexture(true);
+    }
+
+    for (int level = 0; level < MIP_LEVELS; ++level)
+    {
+        int divisor = 2 << level;
+        if (level == 0)
+        {
+            addPass("bloom_threshold.frag", { { "color_texture", nullptr } },
+                    m_mips[0].get(), divisor);
+        }
+        else
+        {
+            addPass("bloom_downsample.frag",
+                    { { "color_texture", m_mips[level - 1].get() } },
+                    m_mips[level].get(), divisor);
+        }
+
+        addPass("bloom_blur.frag",
+                { { "color_texture", m_mips[level].get() } },
+                m_blurred[level].get(), divisor)
+            ->addUniform(new osg::Uniform("u_direction", Vec2(1.0f, 0.0f)));
+        addPass("bloom_blur.frag",
+                { { "color_texture", m_blurred[level].get() } },
+                m_mips[level].get(), divisor)
+            ->addUniform(new osg::Uniform("u_direction", Vec2(0.0f, 1.0f)));
+    }
+
+    // Skladanie z obrazem jest etapem, laczonym z sasiednimi warstwami
+    Inputs combine_inputs;
+    for (int level = 0; level < MIP_LEVELS; ++level)
+    {
+        combine_inputs.emplace_back("bloom_texture" + std::to_string(level),
+                                    m_mips[level].get());
+    }
+    setStage("bloom_combine.glsl", "bloom_combine", combine_inputs);
 }
 
 /**************************************************************************************************/
 /* POST PROCESSOR */
 /**************************************************************************************************/
 
-PostProcessor::PostProcessor(osg::Group* scene): m_camera(new osg::Camera)
+PostProcessor::PostProcessor(osg::Group* scene)
+    : m_scene(scene), m_camera(new osg::Camera), m_width(0), m_height(0),
+      m_memory_usage(0), m_target_frame_time(0.0), m_min_scale(1.0f),
+      m_max_scale(1.0f), m_scale(1.0f), m_frame_time(0.0), m_last_time(-1.0),
+      m_last_adjust(-1.0)
 {
-    for (int i = 0; i < 2; ++i)
+    for (int i = 0; i < 3; ++i)
     {
-        m_buffers.push_back(new osg::Texture2D);
         if (i == Buffer::DEPTH_BUFFER)
         {
+            m_buffers.push_back(new osg::Texture2D);
             m_buffers[i]->setSourceType(GL_FLOAT);
             m_buffers[i]->setSourceFormat(GL_DEPTH_COMPONENT);
             m_buffers[i]->setInternalFormat(GL_DEPTH_COMPONENT24);
@@ -96,11 +299,7 @@ PostProcessor::PostProcessor(osg::Group* scene): m_camera(new osg::Camera)
         }
         else
         {
-            m_buffers[i]->setInternalFormat(GL_RGBA);
-            m_buffers[i]->setFilter(osg::Texture::MIN_FILTER,
-                                    osg::Texture::NEAREST);
-            m_buffers[i]->setFilter(osg::Texture::MAG_FILTER,
-                                    osg::Texture::NEAREST);
+            m_buffers.push_back(createColorTexture(false));
         }
     }
 
@@ -114,87 +313,456 @@ PostProcessor::PostProcessor(osg::Group* scene): m_camera(new osg::Camera)
     m_camera->attach(osg::Camera::DEPTH_BUFFER,
                      m_buffers[Buffer::DEPTH_BUFFER].get());
     m_camera->attach(osg::Camera::COLOR_BUFFER0,
-                     m_buffers[Buffer::FRAME_BUFFER].get());
+                     m_buffers[Buffer::COLOR_BUFFER_A].get());
     m_camera->addChild(scene);
 
-    osg::ref_ptr<osg::Program> program =
-        createProgram("passthrough.vert", "passthrough.frag");
-    m_render_plane = createRenderPlane(program, m_buffers[Buffer::FRAME_BUFFER],
-                                       m_buffers[Buffer::DEPTH_BUFFER]);
+    m_render_plane = createRenderPlane();
+
+    osg::ref_ptr<osg::MatrixTransform> model_view = new osg::MatrixTransform;
+    model_view->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+    model_view->setMatrix(osg::Matrixf::identity());
+    model_view->addChild(m_render_plane);
+
+    m_render_plane_projection = new osg::Projection;
+    m_render_plane_projection->setMatrix(
+        osg::Matrixf::ortho2D(-1.0, 1.0, -1.0, 1.0));
+    m_render_plane_projection->addChild(model_view);
+
+    rebuild();
+}
+
+/**************************************************************************************************/
+
+void PostProcessor::rebuild(void)
+{
+    this->removeChildren(0, this->getNumChildren());
+    m_fused_passes.clear();
+
+    std::vector<Layer*> active;
+    for (auto* layer : m_layers)
+    {
+        if (layer->getActive()) active.push_back(layer);
+    }
+
+    // Bez aktywnych warstw scena trafia prosto do bufora ramki
+    if (active.empty())
+    {
+        this->addChild(m_scene);
+        m_render_plane_projection->setNodeMask(0);
+        m_memory_usage = 0;
+        std::cout << "[POSTFX] Brak aktywnych warstw, rysowanie bez RTT"
+                  << std::endl;
+        return;
+    }
 
     this->addChild(m_camera);
+    m_render_plane_projection->setNodeMask(~0u);
+    if (PassTimer* timer = getTimer("PostFX scene"))
+        timer->attach(m_camera.get(), m_camera.get());
+
+    // Przy dynamicznej rozdzielczosci FXAA skaluje obraz do rozmiaru okna,
+    // wiec idzie na koniec lancucha i rysuje prosto na render plane
+    Layer* upscaler = nullptr;
+    if (m_target_frame_time > 0.0)
+    {
+        for (auto it = active.begin(); it != active.end(); ++it)
+        {
+            if (dynamic_cast<FXAA*>(*it))
+            {
+                upscaler = *it;
+                active.erase(it);
+                break;
+            }
+        }
+    }
+
+    unsigned int render_order = 1;
+    unsigned int num_fused = 0;
+    osg::Texture2D* input = m_buffers[Buffer::COLOR_BUFFER_A].get();
+    std::vector<Layer*> final_stages;
+
+    // Kazdy przebieg czyta jeden bufor koloru i pisze do drugiego, wiec
+    // dowolnie dlugi lancuch potrzebuje tylko dwoch pelnych buforow
+    auto other = [this](osg::Texture2D* buffer) {
+        return buffer == m_buffers[Buffer::COLOR_BUFFER_A].get()
+            ? m_buffers[Buffer::COLOR_BUFFER_B].get()
+            : m_buffers[Buffer::COLOR_BUFFER_A].get();
+    };
+
+    size_t i = 0;
+    while (i < active.size())
+    {
+        if (!active[i]->getStage())
+        {
+            osg::Texture2D* output = other(input);
+            active[i]->connect(input, output, this, render_order);
+            active[i]->attachTimer(
+                getTimer(std::string("PostFX ") + active[i]->getName()));
+            input = output;
+            ++i;
+            continue;
+        }
+
+        // Ciag etapow: przebiegi ma prawo miec tylko pierwsza warstwa,
+        // bo czytaja one wejscie calego ciagu
+        size_t end = i + 1;
+        while (end < active.size() && active[end]->getStage()
+               && !active[end]->hasPasses())
+        {
+            ++end;
+        }
+
+        std::vector<Layer*> stages(active.begin() + i, active.begin() + end);
+        active[i]->connect(input, nullptr, this, render_order);
+        active[i]->attachTimer(
+            getTimer(std::string("PostFX ") + active[i]->getName()));
+        num_fused += stages.size();
+
+        if (end == active.size() && !upscaler)
+        {
+            final_stages = stages;
+        }
+        else
+        {
+            osg::Texture2D* output = other(input);
+            osg::ref_ptr<osg::Camera> camera = createPassCamera();
+            osg::Geode* plane = createRenderPlane();
+            plane->setStateSet(createFusedStateSet(stages, input));
+            camera->attach(osg::Camera::COLOR_BUFFER0, output);
+            camera->setRenderOrder(osg::Camera::PRE_RENDER, render_order++);
+            camera->addChild(plane);
+            this->addChild(camera);
+            m_fused_passes.push_back(camera);
+            input = output;
+        }
+        i = end;
+    }
+
+    // Jeden zakres od pierwszego do ostatniego przebiegu laczonego:
+    // kolejne attach() zastepowalyby callbacki poprzednich kamer
+    if (!m_fused_passes.empty())
+    {
+        if (PassTimer* timer = getTimer("PostFX fused"))
+            timer->attach(m_fused_passes.front().get(),
+                          m_fused_passes.back().get());
+    }
+
+    if (upscaler)
+        m_render_plane->setStateSet(upscaler->createDirectStateSet(input));
+    else
+        m_render_plane->setStateSet(createFusedStateSet(final_stages, input));
+
+    std::cout << "[POSTFX] Lancuch: " << active.size() + (upscaler ? 1 : 0)
+              << " warstw, "
+              << render_order - 1 << " przebiegow, " << num_fused
+              << " etapow w shaderach laczonych" << std::endl;
+
+    if (m_width > 0 && m_height > 0) resize(m_width, m_height);
 }
 
 /**************************************************************************************************/
 
-void PostProcessor::resize(int width, int height)
+void PostProcessor::updateMemoryUsage(void)
 {
-    m_camera->setViewport(0, 0, width, height);
-    m_camera->resizeAttachments(width, height);
+    std::set<osg::Texture2D*> targets;
+    targets.insert(m_buffers[Buffer::COLOR_BUFFER_A].get());
+    targets.insert(m_buffers[Buffer::DEPTH_BUFFER].get());
+    for (unsigned int i = 0; i < this->getNumChildren(); ++i)
+    {
+        osg::Camera* camera = this->getChild(i)->asCamera();
+        if (!camera) continue;
+        for (const auto& attachment : camera->getBufferAttachmentMap())
+        {
+            auto* texture =
+                dynamic_cast<osg::Texture2D*>(attachment.second._texture.get());
+            if (texture) targets.insert(texture);
+        }
+    }
+
+    m_memory_usage = 0;
+    for (auto* texture : targets)
+    {
+        // RGBA8 i DEPTH24 (wyrownany do 32 bitow) to po 4 bajty na teksel
+        m_memory_usage += 4ull * texture->getTextureWidth()
+                        * texture->getTextureHeight();
+    }
+
+    std::cout << "[POSTFX] Pamiec lancucha: " << targets.size()
+              << " tekstur, " << m_memory_usage / (1024.0 * 1024.0) << " MB"
+              << std::endl;
+}
+
+/**************************************************************************************************/
+
+void PostProcessor::traverse(osg::NodeVisitor& nv)
+{
+    if (m_stats.valid() && nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR
+        && nv.getFrameStamp())
+    {
+        unsigned int frame = nv.getFrameStamp()->getFrameNumber();
+        m_stats->setAttribute(frame, "PostFX memory MB",
+                              m_memory_usage / (1024.0 * 1024.0));
+        m_stats->setAttribute(frame, "PostFX resolution scale", m_scale);
+    }
+    osg::Group::traverse(nv);
+}
+
+/**************************************************************************************************/
+
+void PostProcessor::setStats(osg::Stats* stats)
+{
+    m_stats = stats;
+    m_timers.clear();
+    rebuild();
+}
+
+/**************************************************************************************************/
+
+PassTimer* PostProcessor::getTimer(const std::string& name)
+{
+    if (!m_stats.valid()) return nullptr;
+
+    osg::ref_ptr<PassTimer>& timer = m_timers[name];
+    if (!timer) timer = new PassTimer(name, m_stats.get());
+    return timer.get();
+}
+
+/**************************************************************************************************/
+
+std::vector<PassTimer*> PostProcessor::getTimers(void)
+{
+    std::vector<PassTimer*> timers;
+    if (!m_stats.valid()) return timers;
+
+    // Takze warstwy jeszcze nieaktywne, zeby lista sie nie zmieniala
+    timers.push_back(getTimer("PostFX scene"));
     for (auto* layer : m_layers)
     {
-        layer->resize(width, height);
+        if (!layer->hasPasses()) continue;
+        timers.push_back(getTimer(std::string("PostFX ") + layer->getName()));
     }
+    timers.push_back(getTimer("PostFX fused"));
+    return timers;
 }
 
 /**************************************************************************************************/
 
-osgGA::GUIEventHandler* PostProcessor::getResizeHandler(void)
+bool PostProcessor::writeTimings(const std::string& path)
 {
-    return new ResizeHandler([this](int width, int height) -> bool {
-        this->resize(width, height);
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "[POSTFX] Nie mozna zapisac " << path << std::endl;
         return false;
-    });
+    }
+
+    file << std::left << std::setw(20) << "pass" << std::right
+         << std::setw(6) << "clock" << std::setw(9) << "frames"
+         << std::setw(10) << "avg ms" << std::setw(10) << "min ms"
+         << std::setw(10) << "max ms" << "\n";
+    file << std::fixed << std::setprecision(3);
+    for (auto* timer : getTimers())
+    {
+        PassTimer::Summary summary = timer->getSummary();
+        if (summary.frames == 0) continue;
+        file << std::left << std::setw(20) << timer->getName() << std::right
+             << std::setw(6) << (summary.gpu ? "gpu" : "cpu")
+             << std::setw(9) << summary.frames << std::setw(10)
+             << summary.total_ms / summary.frames << std::setw(10)
+             << summary.min_ms << std::setw(10) << summary.max_ms << "\n";
+    }
+
+    std::cout << "[POSTFX] Czasy przebiegow zapisane do " << path
+              << std::endl;
+    return true;
 }
 
 /**************************************************************************************************/
 
-osg::Projection* PostProcessor::getRenderPlaneProjection(void)
+void PostProcessor::setDynamicResolution(double target_fps, float min_scale,
+                                         float max_scale)
 {
-    osg::ref_ptr<osg::MatrixTransform> model_view = new osg::MatrixTransform;
-    model_view->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
-    model_view->setMatrix(osg::Matrixf::identity());
-    model_view->addChild(m_render_plane);
+    m_target_frame_time = target_fps > 0.0 ? 1.0 / target_fps : 0.0;
+    m_min_scale = std::clamp(min_scale, 0.1f, 1.0f);
+    m_max_scale = std::clamp(max_scale, m_min_scale, 1.0f);
+    m_scale = m_target_frame_time > 0.0 ? m_max_scale : 1.0f;
+    m_frame_time = m_target_frame_time;
+    m_last_time = -1.0;
+
+    // Skalowanie w gore probkuje miedzy tekselami, FXAA tez tego oczekuje
+    for (int buffer : { Buffer::COLOR_BUFFER_A, Buffer::COLOR_BUFFER_B })
+    {
+        m_buffers[buffer]->setFilter(osg::Texture::MIN_FILTER,
+                                     osg::Texture::LINEAR);
+        m_buffers[buffer]->setFilter(osg::Texture::MAG_FILTER,
+                                     osg::Texture::LINEAR);
+    }
+
+    if (!this->getUpdateCallback())
+        this->setUpdateCallback(new DynamicResolutionCallback);
+
+    std::cout << "[POSTFX] Dynamiczna rozdzielczosc: " << target_fps
+              << " FPS, skala " << m_min_scale << " - " << m_max_scale
+              << std::endl;
+    rebuild();
+}
+
+/**************************************************************************************************/
+
+void PostProcessor::updateDynamicResolution(double time)
+{
+    if (m_target_frame_time <= 0.0 || m_width <= 0 || m_height <= 0
+        || m_render_plane_projection->getNodeMask() == 0)
+    {
+        m_last_time = -1.0;
+        return;
+    }
+    if (m_last_time < 0.0)
+    {
+        m_last_time = m_last_adjust = time;
+        return;
+    }
+
+    m_frame_time += (time - m_last_time - m_frame_time) * 0.1;
+    m_last_time = time;
+
+    // Realokacja tekstur kosztuje, wiec najwyzej co pol sekundy
+    const double ADJUST_INTERVAL = 0.5;
+    if (time - m_last_adjust < ADJUST_INTERVAL) return;
+    m_last_adjust = time;
+
+    // Martwa strefa wokol celu, inaczej skala skacze w kolko
+    if (m_frame_time < m_target_frame_time * 1.05
+        && m_frame_time > m_target_frame_time * 0.85)
+        return;
+
+    // Czas klatki rosnie mniej wiecej z liczba pikseli, czyli z kwadratem
+    // skali; krok ograniczony do 25% i zaokraglony do 1/16
+    float ratio = (float)std::sqrt(m_target_frame_time / m_frame_time);
+    float scale = m_scale * std::clamp(ratio, 0.75f, 1.25f);
+    scale = std::round(scale * 16.0f) / 16.0f;
+    scale = std::clamp(scale, m_min_scale, m_max_scale);
+    if (scale == m_scale) return;
+
+    std::cout << "[POSTFX] Skala rozdzielczosci " << m_scale << " -> "
+              << scale << " (" << m_frame_time * 1000.0 << " ms/klatke)"
+              << std::endl;
+    m_scale = scale;
+    resizeTargets();
+}
+
+/**************************************************************************************************/
+
+void PostProcessor::DynamicResolutionCallback::operator()(osg::Node* node,
+                                                          osg::NodeVisitor* nv)
+{
+    if (nv->getFrameStamp())
+    {
+        static_cast<PostProcessor*>(node)->updateDynamicResolution(
+            nv->getFrameStamp()->getReferenceTime());
+    }
+    traverse(node, nv);
+}
+
+/**************************************************************************************************/
+
+osg::StateSet*
+PostProcessor::createFusedStateSet(const std::vector<Layer*>& stages,
+                                   osg::Texture2D* input)
+{
+    Layer::Inputs inputs = { { "color_texture", input } };
+    std::set<std::string> samplers = { "color_texture" };
+    for (auto* layer : stages)
+    {
+        for (const auto& stage_input : layer->getStage()->inputs)
+        {
+            if (samplers.insert(stage_input.first).second)
+                inputs.push_back(stage_input);
+        }
+    }
+
+    std::ostringstream source;
+    source << "#version 330\n\n";
+    for (const auto& sampler : inputs)
+    {
+        source << "uniform sampler2D " << sampler.first << ";\n";
+    }
+    source << "\nin vec2 tex_coord;\nout vec4 fragColor;\n";
+    for (auto* layer : stages)
+    {
+        source << "\n" << layer->getStage()->source << "\n";
+    }
+    source << "\nvoid main()\n{\n"
+           << "    vec4 color = texture(color_texture, tex_coord);\n";
+    for (auto* layer : stages)
+    {
+        source << "    color = " << layer->getStage()->function
+               << "(color);\n";
+    }
+    source << "    fragColor = color;\n}\n";
 
-    osg::Projection* projection = new osg::Projection;
-    projection->setMatrix(osg::Matrixf::ortho2D(-1.0, 1.0, -1.0, 1.0));
-    projection->addChild(model_view);
+    osg::ref_ptr<osg::Program>& program = m_programs[source.str()];
+    if (!program)
+        program = createProgramFromSource("passthrough.vert", source.str());
 
-    return projection;
+    osg::StateSet* state_set = createPlaneStateSet(program.get(), inputs);
+    for (auto* layer : stages)
+    {
+        for (const auto& uniform : layer->getStateSet()->getUniformList())
+        {
+            state_set->addUniform(uniform.second.first.get());
+        }
+    }
+    return state_set;
 }
 
 /**************************************************************************************************/
 
-PostProcessor::ResizeHandler::ResizeHandler(
-    const std::function<bool(int, int)>& handler)
-    : m_handler(handler)
-{}
+void PostProcessor::resize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    resizeTargets();
+}
 
 /**************************************************************************************************/
 
-bool PostProcessor::ResizeHandler::handle(const osgGA::GUIEventAdapter& ea,
-                                          osgGA::GUIActionAdapter& aa)
+void PostProcessor::resizeTargets(void)
 {
-    return ea.getEventType() & osgGA::GUIEventAdapter::RESIZE
-        ? m_handler(ea.getWindowWidth(), ea.getWindowHeight())
-        : false;
+    int width = std::max(1, (int)(m_width * m_scale));
+    int height = std::max(1, (int)(m_height * m_scale));
+
+    m_camera->setViewport(0, 0, width, height);
+    m_camera->resizeAttachments(width, height);
+    for (auto* layer : m_layers)
+    {
+        layer->resize(width, height);
+    }
+    for (auto& camera : m_fused_passes)
+    {
+        camera->setViewport(0, 0, width, height);
+        camera->resizeAttachments(width, height);
+        camera->dirtyAttachmentMap();
+    }
+
+    if (m_render_plane_projection->getNodeMask() != 0) updateMemoryUsage();
 }
 
 /**************************************************************************************************/
 
-PostProcessor::ActivationHandler::ActivationHandler(
-    const std::function<bool(osgGA::GUIEventAdapter::KeySymbol)>& handler)
-    : m_handler(handler)
-{}
+osgGA::GUIEventHandler* PostProcessor::getResizeHandler(void)
+{
+    return new ResizeHandler([this](int width, int height) -> bool {
+        this->resize(width, height);
+        return false;
+    });
+}
 
 /**************************************************************************************************/
 
-bool PostProcessor::ActivationHandler::handle(const osgGA::GUIEventAdapter& ea,
-                                              osgGA::GUIActionAdapter& aa)
+osg::Projection* PostProcessor::getRenderPlaneProjection(void)
 {
-    return ea.getEventType() & osgGA::GUIEventAdapter::KEYDOWN
-        ? m_handler((osgGA::GUIEventAdapter::KeySymbol)ea.getKey())
-        : false;
+    return m_render_plane_projection.get();
 }
 
 /**************************************************************************************************/
@@ -214,9 +782,19 @@ osg::Program* createProgram(const std::string& vert_filename,
 
 /**************************************************************************************************/
 
-osg::Geode* createRenderPlane(osg::ref_ptr<osg::Program>& program,
-                              osg::ref_ptr<osg::Texture2D>& color_texture,
-                              osg::ref_ptr<osg::Texture2D>& depth_texture)
+osg::Program* createProgramFromSource(const std::string& vert_filename,
+                                      const std::string& frag_source)
+{
+    osg::Program* program = new osg::Program;
+    program->addShader(osg::Shader::readShaderFile(
+        osg::Shader::VERTEX, s_shader_path + vert_filename));
+    program->addShader(new osg::Shader(osg::Shader::FRAGMENT, frag_source));
+    return program;
+}
+
+/**************************************************************************************************/
+
+osg::Geode* createRenderPlane(void)
 {
     osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
     vertices->push_back(osg::Vec3(-1.0f, -1.0f, 0.0f));
@@ -243,17 +821,64 @@ osg::Geode* createRenderPlane(osg::ref_ptr<osg::Program>& program,
     osg::Geode* plane = new osg::Geode;
     plane->addDrawable(geometry);
 
-    osg::StateSet* state_set = plane->getOrCreateStateSet();
+    return plane;
+}
+
+/**************************************************************************************************/
+
+osg::StateSet* createPlaneStateSet(osg::Program* program,
+                                   const Layer::Inputs& inputs)
+{
+    osg::StateSet* state_set = new osg::StateSet;
     state_set->setAttribute(program);
     state_set->setMode(GL_BLEND, osg::StateAttribute::OFF);
     state_set->setMode(GL_CULL_FACE, osg::StateAttribute::ON);
     state_set->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
-    state_set->addUniform(new osg::Uniform("color_texture", 0));
-    state_set->addUniform(new osg::Uniform("depth_texture", 1));
-    state_set->setTextureAttributeAndModes(0, color_texture.get());
-    state_set->setTextureAttributeAndModes(1, depth_texture.get());
 
-    return plane;
+    for (unsigned int unit = 0; unit < inputs.size(); ++unit)
+    {
+        state_set->addUniform(
+            new osg::Uniform(inputs[unit].first.c_str(), (int)unit));
+        if (inputs[unit].second)
+        {
+            state_set->setTextureAttributeAndModes(unit, inputs[unit].second);
+        }
+    }
+
+    return state_set;
+}
+
+/**************************************************************************************************/
+
+osg::Camera* createPassCamera(void)
+{
+    osg::Camera* camera = new osg::Camera;
+    camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    camera->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+    camera->setViewMatrix(osg::Matrix::identity());
+    camera->setProjectionMatrix(osg::Matrix::ortho2D(-1, 1, -1, 1));
+    camera->setAllowEventFocus(false);
+    camera->setClearMask(0);
+    camera->setInheritanceMask(camera->getInheritanceMask()
+                               & ~osg::Camera::CULL_MASK);
+    return camera;
+}
+
+/**************************************************************************************************/
+
+osg::Texture2D* createColorTexture(bool linear_filter)
+{
+    osg::Texture2D* texture = new osg::Texture2D;
+    texture->setInternalFormat(GL_RGBA);
+    texture->setFilter(osg::Texture::MIN_FILTER, linear_filter
+                                                     ? osg::Texture::LINEAR
+                                                     : osg::Texture::NEAREST);
+    texture->setFilter(osg::Texture::MAG_FILTER, linear_filter
+                                                     ? osg::Texture::LINEAR
+                                                     : osg::Texture::NEAREST);
+    texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+    return texture;
 }
 
 /**************************************************************************************************/
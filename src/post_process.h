@@ -1,14 +1,22 @@
 #pragma once
 
+#include <map>
+#include <set>
 #include <vector>
+#include <string>
+#include <utility>
 #include <functional>
 
 #include <osg/Geode>
 #include <osg/Camera>
 #include <osg/Texture2D>
+#include <osg/NodeCallback>
 #include <osg/Projection>
+#include <osg/Stats>
 #include <osgGA/GUIEventHandler>
 
+#include "pass_timer.h"
+
 namespace osgMap::postfx {
 
 /**************************************************************************************************/
@@ -17,12 +25,29 @@ class PostProcessor;
 
 class Layer {
 public:
+    // Sampler names with the textures bound to consecutive texture units
+    using Inputs = std::vector<std::pair<std::string, osg::Texture2D*>>;
+
+    /**
+     * Per-pixel part of a layer. Consecutive stages are fused by the
+     * PostProcessor into one generated shader instead of separate passes.
+     */
+    struct Stage
+    {
+        std::string source;   // uniforms and the stage function
+        std::string function; // vec4 function(vec4 color), may use tex_coord
+        Inputs inputs;        // samplers are declared by the generator
+    };
+
     Layer(osg::ref_ptr<osg::Texture2D>& in_color_texture,
           osg::ref_ptr<osg::Texture2D>& out_color_texture,
           osg::ref_ptr<osg::Texture2D>& depth_texture,
           const std::string& frag_filename, PostProcessor* parent);
     virtual ~Layer(void) = 0;
 
+    // Name used in the stats and timing reports
+    virtual const char* getName(void) const = 0;
+
     void resize(int width, int height);
     bool getActive(void)
     {
@@ -30,15 +55,69 @@ public:
         m_is_active->get(val);
         return val;
     }
-    inline void setActive(bool active) { m_is_active->set(active); }
+    void setActive(bool active);
+
+    const Stage* getStage(void) const
+    {
+        return m_stage.function.empty() ? nullptr : &m_stage;
+    }
+    bool hasPasses(void) const { return !m_passes.empty(); }
+    osg::StateSet* getStateSet(void) { return m_state_set.get(); }
+
+    /**
+     * Binds the passes to the layer input and output and adds their cameras
+     * to `group`, numbering their render order from `render_order`.
+     */
+    void connect(osg::Texture2D* input, osg::Texture2D* output,
+                 osg::Group* group, unsigned int& render_order);
+
+    /**
+     * State of the first pass reading `input`, with the layer uniforms, for
+     * drawing that pass straight into the frame buffer (render plane).
+     */
+    osg::StateSet* createDirectStateSet(osg::Texture2D* input);
+
+    // Times the passes of the layer, from the first to the last one
+    void attachTimer(PassTimer* timer);
 
 protected:
-    osg::ref_ptr<osg::Geode> m_render_plane;
+    // For layers made of several passes and/or a stage
+    Layer(PostProcessor* parent);
+
+    /**
+     * Adds a full screen pass; passes are rendered in the order of adding.
+     *
+     * @param frag_filename Fragment shader of the pass
+     * @param inputs Textures read by the pass, nullptr is the layer input
+     * @param output Render target of the pass, nullptr is the layer output
+     * @param divisor Pass resolution is the window resolution / divisor
+     * @return State set of the pass, for uniforms used only by this pass
+     */
+    osg::StateSet* addPass(const std::string& frag_filename,
+                           const Inputs& inputs, osg::Texture2D* output,
+                           int divisor = 1);
+
+    // The stage produces the layer output, passes must not write it then
+    void setStage(const std::string& filename, const std::string& function,
+                  const Inputs& inputs);
+
+    // Shared by all passes of the layer (parameter uniforms)
+    osg::ref_ptr<osg::StateSet> m_state_set;
 
 private:
-    static unsigned int s_layer_index;
-    osg::ref_ptr<osg::Camera> m_camera;
-    osg::ref_ptr<osg::Uniform> m_resolution;
+    struct Pass
+    {
+        osg::ref_ptr<osg::Camera> camera;
+        osg::ref_ptr<osg::Uniform> resolution;
+        osg::StateSet* plane_state;
+        std::vector<unsigned int> input_units; // bound to the layer input
+        bool writes_output;
+        int divisor;
+    };
+
+    PostProcessor* m_parent;
+    std::vector<Pass> m_passes;
+    Stage m_stage;
     osg::ref_ptr<osg::Uniform> m_is_active;
 };
 
@@ -50,10 +129,13 @@ public:
                 osg::ref_ptr<osg::Texture2D>& out_color_texture,
                 osg::ref_ptr<osg::Texture2D>& depth_texture,
                 PostProcessor* parent)
-        : Layer(in_color_texture, out_color_texture, depth_texture,
-                "passthrough.frag", parent)
-    {}
+        : Layer(parent)
+    {
+        setStage("passthrough.glsl", "passthrough", {});
+    }
     ~Passthrough(void) override {}
+
+    const char* getName(void) const override { return "Passthrough"; }
 };
 
 /**************************************************************************************************/
@@ -63,10 +145,13 @@ public:
     UV(osg::ref_ptr<osg::Texture2D>& in_color_texture,
        osg::ref_ptr<osg::Texture2D>& out_color_texture,
        osg::ref_ptr<osg::Texture2D>& depth_texture, PostProcessor* parent)
-        : Layer(in_color_texture, out_color_texture, depth_texture, "uv.frag",
-                parent)
-    {}
+        : Layer(parent)
+    {
+        setStage("uv.glsl", "uv", {});
+    }
     ~UV(void) override {}
+
+    const char* getName(void) const override { return "UV"; }
 };
 
 /**************************************************************************************************/
@@ -94,15 +179,16 @@ public:
           m_blur_close_distance(new osg::Uniform("u_blur_close_dist", 1.0f)),
           m_blur_far_distance(new osg::Uniform("u_blur_far_dist", 1.5f))
     {
-        osg::StateSet* state_set = m_render_plane->getOrCreateStateSet();
-        state_set->addUniform(m_edge_threshold);
-        state_set->addUniform(m_edge_threshold_min);
-        state_set->addUniform(m_edge_search_steps);
-        state_set->addUniform(m_blur_close_distance);
-        state_set->addUniform(m_blur_far_distance);
+        m_state_set->addUniform(m_edge_threshold);
+        m_state_set->addUniform(m_edge_threshold_min);
+        m_state_set->addUniform(m_edge_search_steps);
+        m_state_set->addUniform(m_blur_close_distance);
+        m_state_set->addUniform(m_blur_far_distance);
     }
     ~FXAA(void) override {}
 
+    const char* getName(void) const override { return "FXAA"; }
+
     void setParameters(const Parameters& params)
     {
         this->setEdgeThreshold(params.edge_threshold);
@@ -147,6 +233,12 @@ private:
 
 /**************************************************************************************************/
 
+/**
+ * Depth of field in three passes: the frame is downsampled to half
+ * resolution together with the circle of confusion from the depth buffer,
+ * blurred there with a gather kernel and composited at full resolution,
+ * where in-focus pixels return after a single depth read.
+ */
 class DOF final : public Layer {
 public:
     struct Parameters
@@ -158,20 +250,11 @@ public:
 
     DOF(osg::ref_ptr<osg::Texture2D>& in_color_texture,
         osg::ref_ptr<osg::Texture2D>& out_color_texture,
-        osg::ref_ptr<osg::Texture2D>& depth_texture, PostProcessor* parent)
-        : Layer(in_color_texture, out_color_texture, depth_texture, "dof.frag",
-                parent),
-          m_max_blur(new osg::Uniform("u_max_blur", 0.03f)),
-          m_blur_ramp(new osg::Uniform("u_blur_ramp", 100.0f)),
-          m_focus_range(new osg::Uniform("u_focus_range", 0.986f))
-    {
-        osg::StateSet* state_set = m_render_plane->getOrCreateStateSet();
-        state_set->addUniform(m_max_blur);
-        state_set->addUniform(m_blur_ramp);
-        state_set->addUniform(m_focus_range);
-    }
+        osg::ref_ptr<osg::Texture2D>& depth_texture, PostProcessor* parent);
     ~DOF(void) override {}
 
+    const char* getName(void) const override { return "DOF"; }
+
     void setParameters(const Parameters& params)
     {
         this->setMaxBlur(params.max_blur);
@@ -190,38 +273,36 @@ private:
     osg::ref_ptr<osg::Uniform> m_max_blur;
     osg::ref_ptr<osg::Uniform> m_blur_ramp;
     osg::ref_ptr<osg::Uniform> m_focus_range;
+
+    // half resolution frame with the CoC in alpha, and its blurred copy
+    osg::ref_ptr<osg::Texture2D> m_half;
+    osg::ref_ptr<osg::Texture2D> m_blurred;
 };
 
 /**************************************************************************************************/
 
+/**
+ * Bloom at half resolution: bright parts of the frame are thresholded into
+ * a half-res buffer, blurred with a separable Gaussian down a short mip
+ * chain and added back to the frame in one upsample-and-combine pass.
+ */
 class Bloom final : public Layer {
 public:
     struct Parameters
     {
         float threshold = 0.9f;
         float knee = 0.4f;
-        float blur_step = 0.007f;
+        float blur_step = 0.007f; // 0.007 = taps one texel apart
         float intensity = 2.0f;
     };
 
     Bloom(osg::ref_ptr<osg::Texture2D>& in_color_texture,
           osg::ref_ptr<osg::Texture2D>& out_color_texture,
-          osg::ref_ptr<osg::Texture2D>& depth_texture, PostProcessor* parent)
-        : Layer(in_color_texture, out_color_texture, depth_texture,
-                "bloom.frag", parent),
-          m_threshold(new osg::Uniform("u_threshold", 0.9f)),
-          m_knee(new osg::Uniform("u_knee", 0.4f)),
-          m_blur_step(new osg::Uniform("u_blur_step", 0.007f)),
-          m_intensity(new osg::Uniform("u_bloom_intensity", 2.0f))
-    {
-        osg::StateSet* state_set = m_render_plane->getOrCreateStateSet();
-        state_set->addUniform(m_threshold);
-        state_set->addUniform(m_knee);
-        state_set->addUniform(m_blur_step);
-        state_set->addUniform(m_intensity);
-    }
+          osg::ref_ptr<osg::Texture2D>& depth_texture, PostProcessor* parent);
     ~Bloom(void) override {}
 
+    const char* getName(void) const override { return "Bloom"; }
+
     void setParameters(const Parameters& params)
     {
         this->setThreshold(params.threshold);
@@ -232,14 +313,24 @@ public:
 
     inline void setThreshold(float threshold) { m_threshold->set(threshold); }
     inline void setKnee(float knee) { m_knee->set(knee); }
-    inline void setBlurStep(float blur_step) { m_blur_step->set(blur_step); }
+    inline void setBlurStep(float blur_step)
+    {
+        m_blur_scale->set(blur_step / 0.007f);
+    }
     inline void setIntensity(float intensity) { m_intensity->set(intensity); }
 
 private:
+    static const int MIP_LEVELS = 4;
+
     osg::ref_ptr<osg::Uniform> m_threshold;
     osg::ref_ptr<osg::Uniform> m_knee;
-    osg::ref_ptr<osg::Uniform> m_blur_step;
+    osg::ref_ptr<osg::Uniform> m_blur_scale;
     osg::ref_ptr<osg::Uniform> m_intensity;
+
+    // level i has 1/2^(i+1) of the window resolution
+    osg::ref_ptr<osg::Texture2D> m_mips[MIP_LEVELS];
+    // result of the horizontal blur of each level
+    osg::ref_ptr<osg::Texture2D> m_blurred[MIP_LEVELS];
 };
 
 /**************************************************************************************************/
@@ -259,7 +350,48 @@ public:
     osgGA::GUIEventHandler*
     getActivationHandler(osgGA::GUIEventAdapter::KeySymbol activation_key);
 
+    /**
+     * Rebuilds the pass graph from the active layers. Inactive layers are
+     * left out, runs of consecutive stages are fused into one generated
+     * pass (the last run into the render plane) and with no active layer
+     * the scene is drawn straight to the backbuffer.
+     */
+    void rebuild(void);
+
+    // GPU memory of the render targets used by the current chain
+    unsigned long long getMemoryUsage(void) const { return m_memory_usage; }
+
+    /**
+     * Stats receiving the "PostFX memory MB" attribute every frame and the
+     * pass timings: "PostFX scene", "PostFX <layer>" and "PostFX fused"
+     * (from the first to the last generated pass, with any layer passes
+     * in between), each as "<name> time taken" in seconds.
+     */
+    void setStats(osg::Stats* stats);
+
+    // Timers of the scene, the layers and the fused passes
+    std::vector<PassTimer*> getTimers(void);
+    // Writes the timing summary of every pass as a text table
+    bool writeTimings(const std::string& path);
+
+    /**
+     * Renders the chain at a fraction of the window resolution, adjusted
+     * from the measured frame time toward `target_fps`. The render plane
+     * upscales the result; if FXAA is active it is moved to the end of the
+     * chain and does the upscale itself (edge-aware).
+     */
+    void setDynamicResolution(double target_fps, float min_scale,
+                              float max_scale);
+    float getResolutionScale(void) const { return m_scale; }
+
+    void traverse(osg::NodeVisitor& nv) override;
+
 private:
+    class DynamicResolutionCallback : public osg::NodeCallback {
+    public:
+        void operator()(osg::Node* node, osg::NodeVisitor* nv) override;
+    };
+
     class ResizeHandler : public osgGA::GUIEventHandler {
     public:
         ResizeHandler(const std::function<bool(int, int)>& handler);
@@ -282,19 +414,50 @@ private:
         std::function<bool(osgGA::GUIEventAdapter::KeySymbol)> m_handler;
     };
 
+    // The scene renders into A, layers ping-pong between A and B
     enum Buffer
     {
-        FRAME_BUFFER = 0,
+        COLOR_BUFFER_A = 0,
         DEPTH_BUFFER = 1,
-        COLOR_BUFFER_A = 2,
-        COLOR_BUFFER_B = 3
+        COLOR_BUFFER_B = 2
     };
 
+    osg::StateSet* createFusedStateSet(const std::vector<Layer*>& stages,
+                                       osg::Texture2D* input);
+    void updateMemoryUsage(void);
+    // Resizes the targets to the window size times the resolution scale
+    void resizeTargets(void);
+    void updateDynamicResolution(double time);
+    // Timer by name, created on first use; nullptr without stats
+    PassTimer* getTimer(const std::string& name);
+
     std::vector<Layer*> m_layers;
 
+    osg::ref_ptr<osg::Group> m_scene;
     osg::ref_ptr<osg::Camera> m_camera;
     osg::ref_ptr<osg::Geode> m_render_plane;
+    osg::ref_ptr<osg::Projection> m_render_plane_projection;
     std::vector<osg::ref_ptr<osg::Texture2D>> m_buffers;
+
+    // passes of the fused stages in the middle of the chain
+    std::vector<osg::ref_ptr<osg::Camera>> m_fused_passes;
+    // generated uber-shaders by their fragment source
+    std::map<std::string, osg::ref_ptr<osg::Program>> m_programs;
+    int m_width;
+    int m_height;
+
+    unsigned long long m_memory_usage;
+    osg::ref_ptr<osg::Stats> m_stats;
+    std::map<std::string, osg::ref_ptr<PassTimer>> m_timers;
+
+    // dynamic resolution, off while m_target_frame_time is 0
+    double m_target_frame_time;
+    float m_min_scale;
+    float m_max_scale;
+    float m_scale;
+    double m_frame_time; // smoothed
+    double m_last_time;
+    double m_last_adjust;
 };
 
 /**************************************************************************************************/
@@ -325,22 +488,14 @@ template <typename T> void PostProcessor::pushLayer(void)
         "Template argument must be derived from osgMap::postfx::Layer class");
 
 
-    m_buffers.push_back(new osg::Texture2D);
-    m_buffers.back()->setInternalFormat(GL_RGBA);
-    m_buffers.back()->setFilter(osg::Texture::MIN_FILTER,
-                                osg::Texture::NEAREST);
-    m_buffers.back()->setFilter(osg::Texture::MAG_FILTER,
-                                osg::Texture::NEAREST);
-
-    int buffer_in = m_layers.size() > 0 ? m_layers.size() + 1 : 0;
-    int buffer_out = m_layers.size() + 2;
-
-    Layer* new_layer = new T(m_buffers[buffer_in], m_buffers[buffer_out],
-                             m_buffers[Buffer::DEPTH_BUFFER], this);
+    // Wejscie i wyjscie warstwy przydziela rebuild()
+    Layer* new_layer =
+        new T(m_buffers[Buffer::COLOR_BUFFER_A],
+              m_buffers[Buffer::COLOR_BUFFER_B],
+              m_buffers[Buffer::DEPTH_BUFFER], this);
 
     m_layers.push_back(new_layer);
-    m_render_plane->getOrCreateStateSet()->setTextureAttributeAndModes(
-        0, m_buffers[buffer_out].get());
+    rebuild();
 }
 
 /**************************************************************************************************/
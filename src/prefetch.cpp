@@ -0,0 +1,155 @@
+#include "prefetch.h"
+
+#include <osg/PagedLOD>
+#include <osg/Polytope>
+#include <osgDB/DatabasePager>
+#include <osgDB/Registry>
+
+const char* TilePrefetcher::OPTION = "prefetch";
+
+namespace {
+
+// Zadania cull maja priorytet 0..1, prefetch zawsze ponizej
+const float PRIORITY_OFFSET = -1.0f;
+
+// Children of a tile PagedLOD: child 0 is its own content
+const unsigned CHILDREN = 1;
+
+// Camera looking at the tiles, in their local frame
+struct TileView
+{
+    TileView(const osg::Matrixd& modelView, const osg::Matrixd& projection,
+             float lodScale)
+        : eye(osg::Matrixd::inverse(modelView).getTrans()), lodScale(lodScale)
+    {
+        // Bez near/far: zakres LOD i tak odcina dalekie kafle
+        frustum.setToUnitFrustum(false, false);
+        frustum.transformProvidingInverse(modelView * projection);
+    }
+
+    // Distance of a PagedLOD as the cull traversal computes it
+    float getDistance(const osg::PagedLOD& lod) const
+    {
+        return (lod.getCenter() - eye).length() * lodScale;
+    }
+
+    // Whether this view shows the children of the tile instead of it
+    bool refines(const osg::PagedLOD& lod)
+    {
+        const osg::LOD::MinMaxPair& range = lod.getRangeList()[CHILDREN];
+        float distance = getDistance(lod);
+        return distance >= range.first && distance < range.second
+               && frustum.contains(lod.getBound());
+    }
+
+    osg::Polytope frustum;
+    osg::Vec3d eye;
+    float lodScale;
+};
+
+class PrefetchVisitor : public osg::NodeVisitor {
+public:
+    PrefetchVisitor(const TileView& current, const TileView& predicted,
+                    osg::NodeVisitor::DatabaseRequestHandler* pager,
+                    const osg::FrameStamp* frameStamp,
+                    const osgDB::Options* options)
+        : osg::NodeVisitor(TRAVERSE_ACTIVE_CHILDREN), _current(current),
+          _predicted(predicted), _pager(pager), _frameStamp(frameStamp),
+          _options(options), _currentRefines(true), _numRequested(0)
+    {}
+
+    unsigned getNumRequested() const { return _numRequested; }
+
+    void apply(osg::PagedLOD& lod) override
+    {
+        if (lod.getNumRanges() <= CHILDREN
+            || lod.getFileName(CHILDREN).empty())
+            return;
+        if (!_predicted.refines(lod)) return;
+
+        // Cull dochodzi tu tylko, jesli obecny widok rozdrabnia przodkow
+        bool currentRefines = _currentRefines && _current.refines(lod);
+
+        if (lod.getNumChildren() > CHILDREN)
+        {
+            // Wczytane zawczasu: nie wygasaja, poki prognoza ich potrzebuje
+            lod.setTimeStamp(CHILDREN, _frameStamp->getReferenceTime());
+            lod.setFrameNumber(CHILDREN, _frameStamp->getFrameNumber());
+
+            bool saved = _currentRefines;
+            _currentRefines = currentRefines;
+            lod.getChild(CHILDREN)->accept(*this);
+            _currentRefines = saved;
+            return;
+        }
+
+        // O kafle obecnego widoku prosi juz cull, z wyzszym priorytetem
+        if (currentRefines || lod.getNumChildren() < CHILDREN) return;
+
+        const osg::LOD::MinMaxPair& range = lod.getRangeList()[CHILDREN];
+        float priority = (range.second - _predicted.getDistance(lod))
+                         / (range.second - range.first);
+        _pager->requestNodeFile(
+            lod.getDatabasePath() + lod.getFileName(CHILDREN), getNodePath(),
+            PRIORITY_OFFSET + priority, _frameStamp,
+            lod.getDatabaseRequest(CHILDREN), _options);
+        ++_numRequested;
+    }
+
+private:
+    TileView _current;
+    TileView _predicted;
+    osg::NodeVisitor::DatabaseRequestHandler* _pager;
+    const osg::FrameStamp* _frameStamp;
+    const osgDB::Options* _options;
+    bool _currentRefines; // the cull traversal reaches the current node
+    unsigned _numRequested;
+};
+
+} // namespace
+
+/****************************************************************************/
+
+TilePrefetcher::TilePrefetcher(osg::Node* tiles, double horizon)
+    : _tiles(tiles), _horizon(horizon), _numRequested(0)
+{
+    // Opcje rejestru (cache obrazow), jak przy zadaniach cull; kafle nie
+    // maja wlasnych opcji
+    osgDB::Registry* registry = osgDB::Registry::instance();
+    _options = registry->getOptions() ? registry->getOptions()->cloneOptions()
+                                      : new osgDB::Options;
+    _options->setOptionString(_options->getOptionString() + " " + OPTION);
+}
+
+void TilePrefetcher::update(osgViewer::Viewer* viewer,
+                            const GoogleMapsManipulator& manipulator,
+                            const osg::Matrixd& ltw)
+{
+    _numRequested = 0;
+    osg::ref_ptr<osg::Node> tiles;
+    if (_horizon <= 0.0 || !_tiles.lock(tiles)) return;
+
+    osgDB::DatabasePager* pager = viewer->getDatabasePager();
+    const osg::FrameStamp* frameStamp = viewer->getFrameStamp();
+    if (!pager || !frameStamp) return;
+
+    osg::Camera* camera = viewer->getCamera();
+    const osg::Matrixd& projection = camera->getProjectionMatrix();
+    float lodScale = camera->getLODScale();
+
+    TileView current(ltw * camera->getViewMatrix(), projection, lodScale);
+    TileView predicted(ltw * manipulator.getPredictedInverseMatrix(_horizon),
+                       projection, lodScale);
+
+    PrefetchVisitor visitor(current, predicted, pager, frameStamp,
+                            _options.get());
+    tiles->accept(visitor);
+    _numRequested = visitor.getNumRequested();
+}
+
+void TilePrefetcher::reportStats(osg::Stats* stats) const
+{
+    if (!stats) return;
+    stats->setAttribute(stats->getLatestFrameNumber(), "Tile prefetch",
+                        (double)_numRequested);
+}
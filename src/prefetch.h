@@ -0,0 +1,64 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <osg/Matrixd>
+#include <osg/Node>
+#include <osg/Referenced>
+#include <osg/Stats>
+#include <osgDB/Options>
+#include <osgViewer/Viewer>
+
+#include "camera_manip.h"
+
+/**
+ * Requests the tiles of a paged map ahead of the camera.
+ *
+ * Every frame the prefetcher looks at the tile pyramid from the camera pose
+ * GoogleMapsManipulator predicts `horizon` seconds ahead and asks the
+ * viewer's DatabasePager for the tiles that pose would need and the current
+ * one does not. The requests have a lower priority than those of the cull
+ * traversal, so they only use the pager when it has nothing more urgent,
+ * and tiles loaded ahead are kept from expiring while the prediction still
+ * wants them.
+ */
+class TilePrefetcher : public osg::Referenced {
+public:
+    /**
+     * @param tiles Node with the tile pyramid, in the local frame
+     * @param horizon How far ahead to look, in seconds
+     */
+    TilePrefetcher(osg::Node* tiles, double horizon);
+
+    void setHorizon(double seconds) { _horizon = seconds; }
+    double getHorizon() const { return _horizon; }
+
+    /**
+     * Issues the requests for the predicted pose. Call from the main loop
+     * after Viewer::frame(), while the scene graph is not traversed.
+     *
+     * @param ltw Local to world matrix of the tiles
+     */
+    void update(osgViewer::Viewer* viewer,
+                const GoogleMapsManipulator& manipulator,
+                const osg::Matrixd& ltw);
+
+    // Tiles requested by the last update
+    unsigned getNumRequested() const { return _numRequested; }
+
+    // Sets "Tile prefetch" of the latest frame
+    void reportStats(osg::Stats* stats) const;
+
+    // Option string of the requests of the prefetcher, not logged as usage
+    static const char* OPTION;
+
+protected:
+    ~TilePrefetcher() override = default;
+
+private:
+    osg::observer_ptr<osg::Node> _tiles;
+    double _horizon;
+    unsigned _numRequested;
+    osg::ref_ptr<osgDB::Options> _options; // marked with OPTION
+};
+
+#endif // PREFETCH_H
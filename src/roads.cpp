@@ -28,6 +28,8 @@
 #include <filesystem>
 
 #include "common.h"
+#include "feature_index.h"
+#include "partition.h"
 
 using namespace osg;
 
@@ -449,13 +451,16 @@ osg::Node* process_roads(osg::Matrixd& ltw, const std::string& file_path)
         return nullptr;
     }
 
-    std::string cacheFileName = "roads_" + std::to_string(fileSize) + ".osgb";
+    // v2: geometria podzielona na komorki
+    std::string cacheFileName =
+        "roads_v2_" + std::to_string(fileSize) + ".osgb";
 
     if (std::filesystem::exists(cacheFileName))
     {
         std::cout << "Znaleziono cache [" << cacheFileName
                   << "]. Pomijam generowanie..." << std::endl;
-        return osgDB::readNodeFile(cacheFileName);
+        return attachFeatureIndex(osgDB::readNodeFile(cacheFileName),
+                                  cacheFileName);
     }
 
     osg::ref_ptr<osg::Node> roads_model =
@@ -488,11 +493,13 @@ osg::Node* process_roads(osg::Matrixd& ltw, const std::string& file_path)
 
     osgUtil::Optimizer optimizer;
     optimizer.optimize(roads_model, osgUtil::Optimizer::ALL_OPTIMIZATIONS);
+    roads_model = partitionLayer(roads_model.get(), "roads");
 
     // 4. Zapisz wygenerowany model do pliku cache przed zwrceniem
     std::cout << "Zapisuje cache: " << cacheFileName << std::endl;
     osgDB::writeNodeFile(*roads_model, cacheFileName);
 
     std::cout << "Przetwarzanie zakonczone\n" << std::endl;
+    attachFeatureIndex(roads_model.get(), cacheFileName);
     return roads_model.release();
 }
\ No newline at end of file
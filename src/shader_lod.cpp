@@ -0,0 +1,93 @@
+#include "shader_lod.h"
+
+#include <osgViewer/View>
+
+#include <iostream>
+
+static const char* SCENE_TIME = "PostFX scene time taken";
+static const char* VARIANT_NAMES[] = { "auto", "pelny", "tani" };
+
+// Kolejnosc pomiaru i liczba klatek na wariant
+static const int VARIANTS[] = { SHADER_LOD_FULL, SHADER_LOD_CHEAP,
+                                SHADER_LOD_AUTO };
+static const unsigned int WARMUP_FRAMES = 10;
+static const unsigned int MEASURE_FRAMES = 120;
+// Wyniki zapytan GPU przychodza z opoznieniem kilku klatek
+static const unsigned int RESULT_DELAY = 4;
+
+osg::Uniform* setupShaderLod(osg::StateSet* ss, float distance)
+{
+    osg::Uniform* mode = new osg::Uniform("shaderLodMode", SHADER_LOD_AUTO);
+    ss->addUniform(mode);
+    ss->addUniform(new osg::Uniform("shaderLodDistance", distance));
+    return mode;
+}
+
+/****************************************************************************/
+
+ShaderLodBenchmark::ShaderLodBenchmark(osg::Uniform* mode, osg::Stats* stats)
+    : _mode(mode), _stats(stats), _variant(-1), _variantStart(0)
+{}
+
+bool ShaderLodBenchmark::handle(const osgGA::GUIEventAdapter& ea,
+                                osgGA::GUIActionAdapter& aa)
+{
+    if (ea.getEventType() == osgGA::GUIEventAdapter::KEYDOWN
+        && ea.getKey() == 'L' && _variant < 0)
+    {
+        std::cout << "[LOD] Pomiar wariantow shaderow..." << std::endl;
+        for (int i = 0; i < 3; ++i)
+        {
+            _sum[i] = 0.0;
+            _count[i] = 0;
+        }
+        _variant = 0;
+        _variantStart = 0;
+        return true;
+    }
+
+    if (ea.getEventType() == osgGA::GUIEventAdapter::FRAME && _variant >= 0)
+    {
+        osgViewer::View* view = dynamic_cast<osgViewer::View*>(&aa);
+        if (view && view->getFrameStamp())
+            frame(view->getFrameStamp()->getFrameNumber());
+    }
+    return false;
+}
+
+void ShaderLodBenchmark::frame(unsigned int frameNumber)
+{
+    if (_variantStart == 0)
+    {
+        _mode->set(VARIANTS[_variant]);
+        _variantStart = frameNumber;
+        return;
+    }
+
+    unsigned int elapsed = frameNumber - _variantStart;
+    double seconds = 0.0;
+    if (elapsed > WARMUP_FRAMES + RESULT_DELAY
+        && _stats->getAttribute(frameNumber - RESULT_DELAY, SCENE_TIME,
+                                seconds))
+    {
+        _sum[_variant] += seconds;
+        ++_count[_variant];
+    }
+    if (elapsed < WARMUP_FRAMES + RESULT_DELAY + MEASURE_FRAMES) return;
+
+    _variantStart = 0;
+    if (++_variant < 3) return;
+
+    _variant = -1;
+    _mode->set(SHADER_LOD_AUTO);
+    for (int i = 0; i < 3; ++i)
+    {
+        int mode = VARIANTS[i];
+        std::cout << "[LOD] " << VARIANT_NAMES[mode] << ": ";
+        if (_count[i] == 0)
+            std::cout << "brak pomiaru (wlacz post-processing)";
+        else
+            std::cout << _sum[i] / _count[i] * 1000.0 << " ms/klatke sceny";
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SHADER_LOD_H
+#define SHADER_LOD_H
+
+#include <osg/StateSet>
+#include <osg/Stats>
+#include <osg/Uniform>
+#include <osgGA/GUIEventHandler>
+
+/**
+ * Distance-based shader LOD of the landuse (parallax) and water materials.
+ * Their fragment shaders switch to a cheap variant for fragments farther
+ * than `shaderLodDistance` from the eye; `shaderLodMode` can force one of
+ * the variants everywhere, for measuring.
+ */
+enum ShaderLodMode
+{
+    SHADER_LOD_AUTO = 0,
+    SHADER_LOD_FULL = 1,
+    SHADER_LOD_CHEAP = 2
+};
+
+// Adds the LOD uniforms to the state set of the scene root
+osg::Uniform* setupShaderLod(osg::StateSet* ss, float distance);
+
+/**
+ * Shift+L measures the frame cost of the variants: every mode is forced
+ * in turn for a number of frames and the average scene pass time (see
+ * PassTimer) is printed per variant.
+ */
+class ShaderLodBenchmark : public osgGA::GUIEventHandler {
+public:
+    ShaderLodBenchmark(osg::Uniform* mode, osg::Stats* stats);
+
+    bool handle(const osgGA::GUIEventAdapter& ea,
+                osgGA::GUIActionAdapter& aa) override;
+
+private:
+    void frame(unsigned int frameNumber);
+
+    osg::ref_ptr<osg::Uniform> _mode;
+    osg::ref_ptr<osg::Stats> _stats;
+
+    int _variant; // -1 when not measuring
+    unsigned int _variantStart;
+    double _sum[3];
+    unsigned int _count[3];
+};
+
+#endif // SHADER_LOD_H
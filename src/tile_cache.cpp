@@ -0,0 +1,283 @@
+#include "tile_cache.h"
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/WriteFile>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_set>
+
+static const char* INDEX_FILE = "cache.lru";
+static const char* TMP_SUFFIX = ".tmp.osgb";
+// Starsze pliki tymczasowe to zapisy przerwane (np. zabity proces); mlodsze
+// moga nalezec do innego procesu z tym samym katalogiem
+static const auto TMP_MAX_AGE = std::chrono::hours(1);
+
+static bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size()
+           && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/****************************************************************************/
+
+TileCache::TileCache(const std::string& dir, uint64_t budget)
+    : _dir(dir), _budget(budget), _tmpCounter(0), _dirty(false), _quit(false)
+{
+    // Znacznik procesu w nazwach plikow tymczasowych: procesy dzielace
+    // katalog nie zapisuja do tego samego pliku
+    std::random_device random;
+    std::ostringstream token;
+    token << std::hex << random() << random();
+    _tmpToken = token.str();
+
+    std::error_code ec;
+    std::filesystem::create_directories(_dir, ec);
+    load();
+    _thread = std::thread(&TileCache::run, this);
+}
+
+TileCache::~TileCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+
+    std::vector<std::string> names;
+    for (const Entry& entry : _lru) names.push_back(entry.name);
+    save(names);
+}
+
+/****************************************************************************/
+
+void TileCache::load()
+{
+    namespace fs = std::filesystem;
+
+    // Kafle na dysku; stare pliki tymczasowe sa usuwane
+    std::unordered_map<std::string, uint64_t> files;
+    std::error_code ec;
+    auto now = fs::file_time_type::clock::now();
+    for (const auto& file : fs::directory_iterator(_dir, ec))
+    {
+        std::string name = file.path().filename().string();
+        if (endsWith(name, TMP_SUFFIX))
+        {
+            auto written = file.last_write_time(ec);
+            if (!ec && now - written > TMP_MAX_AGE) fs::remove(file.path(), ec);
+            continue;
+        }
+        if (name.compare(0, 5, "tile_") != 0 || !endsWith(name, ".osgb"))
+            continue;
+        files[name] = file.file_size(ec);
+    }
+
+    // Kolejnosc z poprzedniego uruchomienia, nieznane kafle sa najstarsze
+    std::vector<std::string> known;
+    std::unordered_set<std::string> listed;
+    std::ifstream in(_dir + "/" + INDEX_FILE);
+    for (std::string name; std::getline(in, name);)
+    {
+        if (files.count(name) && listed.insert(name).second)
+            known.push_back(name);
+    }
+
+    auto add = [this](const std::string& name, uint64_t size) {
+        _lru.push_back({ name, size });
+        _entries[name] = std::prev(_lru.end());
+        _counters.bytes += size;
+    };
+    for (const auto& file : files)
+        if (!listed.count(file.first)) add(file.first, file.second);
+    for (const std::string& name : known) add(name, files[name]);
+
+    std::cout << "[TILECACHE] " << _dir << ": " << _lru.size() << " kafli, "
+              << _counters.bytes / (1024 * 1024) << " MB";
+    if (_budget) std::cout << " (limit " << _budget / (1024 * 1024) << " MB)";
+    std::cout << std::endl;
+
+    if (_budget && _counters.bytes > _budget) evict();
+}
+
+void TileCache::save(const std::vector<std::string>& names) const
+{
+    std::string path = _dir + "/" + INDEX_FILE;
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (const std::string& name : names) out << name << '\n';
+        if (!out) return;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        std::cout << "[TILECACHE] Nie mozna zapisac " << path << std::endl;
+}
+
+/****************************************************************************/
+
+std::string TileCache::lookup(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(name);
+    if (it == _entries.end())
+    {
+        ++_counters.misses;
+        return "";
+    }
+    _lru.splice(_lru.end(), _lru, it->second);
+    ++_counters.hits;
+    _dirty = true;
+    return _dir + "/" + name;
+}
+
+bool TileCache::store(const std::string& name, osg::Node& node)
+{
+    std::string path = _dir + "/" + name;
+    std::string tmp;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        tmp = _dir + "/" + osgDB::getNameLessExtension(name) + "." + _tmpToken
+              + "." + std::to_string(++_tmpCounter) + TMP_SUFFIX;
+    }
+
+    std::error_code ec;
+    if (!osgDB::writeNodeFile(node, tmp))
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    uint64_t size = std::filesystem::file_size(tmp, ec);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+
+    auto it = _entries.find(name);
+    if (it != _entries.end())
+    {
+        _counters.bytes -= it->second->size;
+        it->second->size = size;
+        _lru.splice(_lru.end(), _lru, it->second);
+    }
+    else
+    {
+        _lru.push_back({ name, size });
+        _entries[name] = std::prev(_lru.end());
+    }
+    _counters.bytes += size;
+    _dirty = true;
+
+    bool over = _budget && _counters.bytes > _budget;
+    lock.unlock();
+    if (over) _wake.notify_one();
+    return true;
+}
+
+void TileCache::remove(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(name);
+    if (it == _entries.end()) return;
+
+    std::error_code ec;
+    std::filesystem::remove(_dir + "/" + name, ec);
+    _counters.bytes -= it->second->size;
+    _lru.erase(it->second);
+    _entries.erase(it);
+    _dirty = true;
+}
+
+/****************************************************************************/
+
+void TileCache::evict()
+{
+    // Zapas 10%, zeby nie usuwac przy kazdym nowym kaflu
+    uint64_t target = _budget - _budget / 10;
+    uint64_t freed = 0;
+    unsigned evicted = 0;
+
+    // Usuwanie pod mutexem: zapis tego samego kafla nie moze sie wcisnac
+    size_t attempts = _lru.size();
+    while (_counters.bytes > target && _lru.size() > 1 && attempts--)
+    {
+        Entry& entry = _lru.front();
+        std::error_code ec;
+        std::filesystem::remove(_dir + "/" + entry.name, ec);
+        if (ec)
+        {
+            // Plik otwarty (Windows): sprobujemy przy nastepnym przebiegu
+            _lru.splice(_lru.end(), _lru, _lru.begin());
+            continue;
+        }
+        freed += entry.size;
+        _counters.bytes -= entry.size;
+        _entries.erase(entry.name);
+        _lru.pop_front();
+        ++_counters.evictions;
+        ++evicted;
+    }
+    _dirty = true;
+
+    std::cout << "[TILECACHE] Usunieto " << evicted << " kafli ("
+              << freed / (1024 * 1024) << " MB), zostalo "
+              << _counters.bytes / (1024 * 1024) << " MB" << std::endl;
+}
+
+void TileCache::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_quit)
+    {
+        // Kolejnosc LRU jest zapisywana co kilka sekund, nie przy kazdym uzyciu
+        _wake.wait_for(lock, std::chrono::seconds(5));
+        if (_quit) break;
+
+        if (_budget && _counters.bytes > _budget) evict();
+
+        if (_dirty)
+        {
+            _dirty = false;
+            std::vector<std::string> names;
+            names.reserve(_lru.size());
+            for (const Entry& entry : _lru) names.push_back(entry.name);
+            lock.unlock();
+            save(names);
+            lock.lock();
+        }
+    }
+}
+
+/****************************************************************************/
+
+TileCache::Counters TileCache::getCounters() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Counters counters = _counters;
+    counters.files = (unsigned)_lru.size();
+    return counters;
+}
+
+void TileCache::reportStats(osg::Stats* stats) const
+{
+    if (!stats) return;
+    Counters counters = getCounters();
+    unsigned int frame = stats->getLatestFrameNumber();
+    stats->setAttribute(frame, "Tile cache MB",
+                        counters.bytes / (1024.0 * 1024.0));
+    stats->setAttribute(frame, "Tile cache hits", (double)counters.hits);
+    stats->setAttribute(frame, "Tile cache misses", (double)counters.misses);
+    stats->setAttribute(frame, "Tile cache evictions",
+                        (double)counters.evictions);
+}
@@ -0,0 +1,94 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <osg/Node>
+#include <osg/Referenced>
+#include <osg/Stats>
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Disk cache of generated tiles (tile_*.osgb), bounded in size with least
+ * recently used eviction.
+ *
+ * Tiles are written to a temporary file and renamed into place, so readers
+ * and other writers never see a partial tile. Temporary files left by
+ * interrupted writes are removed at startup once they are an hour old. The
+ * LRU order is kept in cache.lru next to the tiles and survives restarts;
+ * tiles it does not list (baked ones, for example) count as the oldest.
+ * When the cache grows over its budget, a background thread removes the
+ * least recently used tiles down to 90% of it; they are generated again
+ * when needed, so a cache without the source data needs a budget of 0.
+ */
+class TileCache : public osg::Referenced {
+public:
+    struct Counters
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t bytes = 0;
+        unsigned files = 0;
+    };
+
+    /**
+     * @param dir Cache directory, created if missing
+     * @param budget Size limit in bytes, 0 for no limit
+     */
+    TileCache(const std::string& dir, uint64_t budget);
+
+    const std::string& getDirectory() const { return _dir; }
+
+    // Path of a cached tile, marked as just used; empty if not cached
+    std::string lookup(const std::string& name);
+
+    // Writes a tile (atomically) and accounts for it
+    bool store(const std::string& name, osg::Node& node);
+
+    // Drops a tile whose file could not be read
+    void remove(const std::string& name);
+
+    Counters getCounters() const;
+
+    // Sets the counters as "Tile cache ..." attributes of the latest frame
+    void reportStats(osg::Stats* stats) const;
+
+protected:
+    ~TileCache() override;
+
+private:
+    struct Entry
+    {
+        std::string name;
+        uint64_t size;
+    };
+
+    void load();
+    void save(const std::vector<std::string>& names) const;
+    void evict(); // with _mutex held
+    void run();
+
+    std::string _dir;
+    uint64_t _budget;
+
+    mutable std::mutex _mutex;
+    std::list<Entry> _lru; // least recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> _entries;
+    Counters _counters;
+    std::string _tmpToken; // random, per process
+    unsigned _tmpCounter;
+    bool _dirty; // LRU order not saved yet
+    bool _quit;
+
+    std::condition_variable _wake;
+    std::thread _thread;
+};
+
+#endif // TILE_CACHE_H
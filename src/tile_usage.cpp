@@ -0,0 +1,165 @@
+#include "tile_usage.h"
+
+#include <osg/Timer>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+
+const char* TileWarmer::OPTION = "warmup";
+
+// Kafle, o ktore nikt nie poprosil, sa zwalniane po tym czasie [s]
+static const double WARM_TIMEOUT = 600.0;
+
+/****************************************************************************/
+
+TileUsageLog::TileUsageLog(const std::string& path)
+{
+    _out.open(path, std::ios::app);
+    if (!_out.is_open())
+        std::cout << "[TILEUSAGE] Nie mozna otworzyc " << path << std::endl;
+}
+
+void TileUsageLog::record(const std::string& tile)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_out.is_open()) return;
+    // Zapis od razu: kiosk zwykle konczy prace przez wylaczenie zasilania
+    _out << (long long)std::time(nullptr) << ' ' << tile << '\n';
+    _out.flush();
+}
+
+std::vector<std::string> TileUsageLog::readMostUsed(const std::string& path,
+                                                    unsigned count)
+{
+    std::unordered_map<std::string, unsigned> uses;
+    std::ifstream in(path);
+    for (std::string line; std::getline(in, line);)
+    {
+        std::istringstream fields(line);
+        long long time;
+        std::string tile;
+        if (fields >> time >> tile) ++uses[tile];
+    }
+
+    std::vector<std::pair<std::string, unsigned>> ranking(uses.begin(),
+                                                          uses.end());
+    std::sort(ranking.begin(), ranking.end(),
+              [](const auto& a, const auto& b) {
+                  if (a.second != b.second) return a.second > b.second;
+                  return a.first < b.first;
+              });
+    if (ranking.size() > count) ranking.resize(count);
+
+    std::vector<std::string> tiles;
+    for (const auto& entry : ranking) tiles.push_back(entry.first);
+    std::cout << "[TILEUSAGE] " << path << ": " << uses.size()
+              << " uzywanych kafli, rozgrzewane " << tiles.size()
+              << std::endl;
+    return tiles;
+}
+
+/****************************************************************************/
+
+TileWarmer::TileWarmer(const std::string& dir,
+                       const std::vector<std::string>& tiles,
+                       osgUtil::IncrementalCompileOperation* ico)
+    : _dir(dir), _tiles(tiles), _ico(ico), _quit(false)
+{
+    _worker = std::thread(&TileWarmer::run, this);
+}
+
+TileWarmer::~TileWarmer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    _worker.join();
+}
+
+osg::ref_ptr<osg::Node> TileWarmer::take(const std::string& tile)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _loaded.find(tile);
+    if (it == _loaded.end()) return nullptr;
+    osg::ref_ptr<osg::Node> node = it->second.node;
+    _memory -= it->second.memory;
+    _loaded.erase(it);
+    return node;
+}
+
+MemoryUsage TileWarmer::getMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _memory;
+}
+
+MemoryUsage TileWarmer::drop()
+{
+    std::unordered_map<std::string, Preloaded> loaded;
+    MemoryUsage memory;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        loaded.swap(_loaded);
+        std::swap(memory, _memory);
+    }
+    if (loaded.empty()) return memory;
+
+    // Skompilowane przez ICO: obiekty GL zwalniane razem z kaflami
+    for (auto& entry : loaded) entry.second.node->releaseGLObjects();
+    std::cout << "[TILEUSAGE] Zwolniono " << loaded.size()
+              << " nieuzywanych kafli (" << memory.total() / (1024 * 1024)
+              << " MB)" << std::endl;
+    return memory;
+}
+
+void TileWarmer::run()
+{
+    // Opcje rejestru (cache obrazow), oznaczone jako rozgrzewanie
+    osgDB::Registry* registry = osgDB::Registry::instance();
+    osg::ref_ptr<osgDB::Options> options =
+        registry->getOptions() ? registry->getOptions()->cloneOptions()
+                               : new osgDB::Options;
+    options->setOptionString(options->getOptionString() + " " + OPTION);
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    unsigned numLoaded = 0;
+    for (const std::string& tile : _tiles)
+    {
+        if (_quit) return;
+
+        osg::ref_ptr<osg::Node> node = osgDB::readRefNodeFile(
+            _dir + "/" + tile + ".osgmaptile", options.get());
+        if (!node.valid()) continue;
+
+        // Tekstury i bufory na GPU w kolejnych klatkach
+        osg::ref_ptr<osgUtil::IncrementalCompileOperation> ico;
+        if (_ico.lock(ico)) ico->add(node.get());
+        MemoryUsage memory = ::getMemoryUsage(*node);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _loaded[tile] = { node, memory };
+        _memory += memory;
+        ++numLoaded;
+    }
+
+    std::cout << "[TILEUSAGE] Rozgrzano " << numLoaded << " kafli w "
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms" << std::endl;
+
+    // Nieodebrane kafle nie moga zajmowac pamieci do konca pracy
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_wake.wait_for(lock, std::chrono::duration<double>(WARM_TIMEOUT),
+                           [this] { return _quit.load(); }))
+            return;
+    }
+    drop();
+}
@@ -0,0 +1,103 @@
+#ifndef TILE_USAGE_H
+#define TILE_USAGE_H
+
+#include <osg/Node>
+#include <osg/Referenced>
+#include <osgUtil/IncrementalCompileOperation>
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "memory_budget.h"
+
+/**
+ * Log of the tiles read by the DatabasePager: one "<unix time> <tile>" line
+ * per read, appended across sessions, so it shows which parts of the map
+ * are actually looked at.
+ */
+class TileUsageLog : public osg::Referenced {
+public:
+    explicit TileUsageLog(const std::string& path);
+
+    bool valid() const { return _out.is_open(); }
+
+    // Appends a read of `tile` (tile_<level>_<x>_<y>); thread safe
+    void record(const std::string& tile);
+
+    // The `count` tiles read most often according to the log in `path`
+    static std::vector<std::string> readMostUsed(const std::string& path,
+                                                 unsigned count);
+
+protected:
+    ~TileUsageLog() override = default;
+
+private:
+    std::mutex _mutex;
+    std::ofstream _out;
+};
+
+/**
+ * Preloads tiles in the background before they are needed.
+ *
+ * A worker thread reads the tiles through the .osgmaptile loader (tile
+ * cache, or generation when missing) and, with an IncrementalCompileOperation,
+ * uploads their textures and buffers to the GPU during the next frames. The
+ * tiles stay in memory until the DatabasePager asks for them; the loader
+ * then hands over the preloaded tile instead of reading it again. Tiles not
+ * asked for within 10 minutes of the end of preloading are dropped, and a
+ * MemoryBudget can drop them sooner.
+ */
+class TileWarmer : public osg::Referenced {
+public:
+    /**
+     * @param dir Tile directory
+     * @param tiles Tiles to preload (tile_<level>_<x>_<y>), in this order
+     * @param ico Compiles the tiles for the GPU, may be nullptr
+     */
+    TileWarmer(const std::string& dir, const std::vector<std::string>& tiles,
+               osgUtil::IncrementalCompileOperation* ico);
+
+    // Preloaded tile, handed over only once; nullptr if not loaded (yet)
+    osg::ref_ptr<osg::Node> take(const std::string& tile);
+
+    // Memory of the preloaded tiles not handed over yet
+    MemoryUsage getMemoryUsage() const;
+
+    // Drops the preloaded tiles not handed over yet, returns their memory
+    MemoryUsage drop();
+
+    // Option string of the reads of the warmer, not logged as usage
+    static const char* OPTION;
+
+protected:
+    ~TileWarmer() override;
+
+private:
+    void run();
+
+    std::string _dir;
+    std::vector<std::string> _tiles;
+    osg::observer_ptr<osgUtil::IncrementalCompileOperation> _ico;
+
+    struct Preloaded
+    {
+        osg::ref_ptr<osg::Node> node;
+        MemoryUsage memory;
+    };
+
+    mutable std::mutex _mutex; // _loaded, _memory, _quit for _wake
+    std::unordered_map<std::string, Preloaded> _loaded;
+    MemoryUsage _memory; // sum over _loaded
+
+    std::atomic<bool> _quit;
+    std::condition_variable _wake;
+    std::thread _worker;
+};
+
+#endif // TILE_USAGE_H
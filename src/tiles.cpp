@@ -0,0 +1,644 @@
+#include "tiles.h"
+
+#include <osg/ComputeBoundsVisitor>
+#include <osg/CoordinateSystemNode>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/PagedLOD>
+#include <osg/Texture>
+#include <osg/Timer>
+#include <osg/Transform>
+#include <osg/ValueObject>
+#include <osgDB/FileNameUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/ReaderWriter>
+#include <osgDB/Registry>
+#include <osgDB/SharedStateManager>
+#include <osgDB/WriteFile>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "prefetch.h"
+
+// Kafel-lisc ma okolo LEAF_TILE_SIZE metrow
+static const float LEAF_TILE_SIZE = 500.0f;
+static const int MAX_LEVELS = 12;
+// Najmniejszy prymityw kafla to 1/TILE_DETAIL jego boku (ok. 2 px z bliska)
+static const float TILE_DETAIL = 512.0f;
+// Wersja zawartosci kafli; starsze piramidy sa odrzucane
+static const int TILE_FORMAT = 2;
+// Dzieci kafla sa pokazywane blizej niz RANGE_FACTOR jego promieni
+static const float RANGE_FACTOR = 2.0f;
+
+// Pliki zrodlowe warstw; ich rozmiary w indeksie wiaza go z danymi, jak
+// rozmiary w nazwach plikow cache warstw
+static const char* const SOURCE_FILES[][2] = {
+    { "landuse", "gis_osm_landuse_a_free_1.shp" },
+    { "water", "gis_osm_water_a_free_1.shp" },
+    { "roads", "gis_osm_roads_free_1.shp" },
+    { "buildings", "buildings_levels.shp" },
+};
+
+// Rozmiar pliku zrodlowego jako tekst, pusty gdy pliku nie ma
+static std::string getSourceSize(const std::string& file_path,
+                                 const char* file)
+{
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(file_path + "/" + file, ec);
+    return ec ? std::string() : std::to_string(size);
+}
+
+namespace {
+
+// Obrazy z plikow zapisujemy jako nazwy: kafle nie powielaja tekstur
+class ExternalImagesVisitor : public osg::NodeVisitor {
+public:
+    ExternalImagesVisitor(): osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Node& node) override
+    {
+        if (osg::StateSet* ss = node.getStateSet())
+        {
+            for (auto& attributes : ss->getTextureAttributeList())
+            {
+                for (auto& entry : attributes)
+                {
+                    osg::Texture* texture =
+                        dynamic_cast<osg::Texture*>(entry.second.first.get());
+                    if (!texture) continue;
+                    for (unsigned i = 0; i < texture->getNumImages(); ++i)
+                    {
+                        osg::Image* image = texture->getImage(i);
+                        if (image && !image->getFileName().empty())
+                            image->setWriteHint(osg::Image::EXTERNAL_FILE);
+                    }
+                }
+            }
+        }
+        traverse(node);
+    }
+};
+
+} // namespace
+
+/****************************************************************************/
+
+TilePyramid::TilePyramid(const std::string& file_path)
+    : _source(file_path), _levels(1)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // Kolejnosc jak w scenie; landuse wyznacza uklad lokalny
+    std::vector<std::pair<std::string, osg::ref_ptr<osg::Node>>> layers;
+    layers.emplace_back("landuse", process_landuse(_ltw, _wbb, file_path));
+    layers.emplace_back("water", process_water(_ltw, file_path));
+    layers.emplace_back("roads", process_roads(_ltw, file_path));
+    layers.emplace_back("buildings", process_buildings(_ltw, file_path));
+
+    for (const auto& layer : layers)
+    {
+        if (!layer.second.valid()) continue;
+        osg::ComputeBoundsVisitor cbv;
+        layer.second->accept(cbv);
+        _extent.expandBy(cbv.getBoundingBox());
+    }
+    if (!_extent.valid())
+    {
+        std::cout << "[TILES] Brak warstw do podzialu na kafle" << std::endl;
+        return;
+    }
+
+    float size = std::max(_extent.xMax() - _extent.xMin(),
+                          _extent.yMax() - _extent.yMin());
+    _extent.xMax() = _extent.xMin() + size;
+    _extent.yMax() = _extent.yMin() + size;
+    _levels = 1 + (int)std::ceil(std::log2(std::max(size / LEAF_TILE_SIZE,
+                                                    1.0f)));
+    _levels = std::min(_levels, MAX_LEVELS);
+
+    for (const auto& layer : layers)
+    {
+        if (!layer.second.valid()) continue;
+
+        ExternalImagesVisitor eiv;
+        layer.second->accept(eiv);
+
+        // Indeks nie jest zapisywany w osgb, trafia do osobnego pliku
+        _indices.push_back(getFeatureIndex(layer.second.get()));
+        layer.second->setUserData(nullptr);
+        layer.second->setName(layer.first);
+
+        _tilers.push_back(new LayerTiler(layer.second.get(), layer.first,
+                                         _extent, _levels, TILE_DETAIL));
+        _layers.push_back(layer.second);
+    }
+
+    std::cout << "[TILES] Piramida " << _levels << " poziomow, bok "
+              << size << " m, "
+              << osg::Timer::instance()->delta_m(
+                     start, osg::Timer::instance()->tick())
+              << " ms" << std::endl;
+}
+
+TilePyramid::~TilePyramid() = default;
+
+/****************************************************************************/
+
+std::string TilePyramid::getFileName(int level, int x, int y)
+{
+    return "tile_" + std::to_string(level) + "_" + std::to_string(x) + "_"
+           + std::to_string(y) + ".osgmaptile";
+}
+
+bool TilePyramid::isEmpty(int level, int x, int y) const
+{
+    for (const auto& tiler : _tilers)
+        if (!tiler->isEmpty(level, x, y)) return false;
+    return true;
+}
+
+osg::BoundingBox TilePyramid::getTileBox(int level, int x, int y) const
+{
+    float size = (_extent.xMax() - _extent.xMin()) / (1 << level);
+    osg::BoundingBox box = _extent;
+    box.xMin() = _extent.xMin() + x * size;
+    box.yMin() = _extent.yMin() + y * size;
+    box.xMax() = box.xMin() + size;
+    box.yMax() = box.yMin() + size;
+    return box;
+}
+
+osg::Node* TilePyramid::createTileNode(int level, int x, int y) const
+{
+    std::string key = std::to_string(level) + "_" + std::to_string(x) + "_"
+                      + std::to_string(y);
+
+    osg::ref_ptr<osg::Group> content = new osg::Group;
+    content->setName("tile_" + key);
+    for (const auto& tiler : _tilers)
+    {
+        if (osg::Group* layer = tiler->createTile(level, x, y))
+            content->addChild(layer);
+    }
+    if (level + 1 == _levels) return content.release();
+
+    // Srodek i promien sa znane przed wczytaniem dzieci
+    osg::BoundingBox box = getTileBox(level, x, y);
+    float split = RANGE_FACTOR * box.radius();
+
+    osg::PagedLOD* tile = new osg::PagedLOD;
+    tile->setName("lod_" + key);
+    tile->setCenter(box.center());
+    tile->setRadius(box.radius());
+    // Obiekty w calosci wystaja poza kafel: bound obejmuje tez zawartosc
+    tile->setCenterMode(
+        osg::LOD::UNION_OF_BOUNDING_SPHERE_AND_USER_DEFINED);
+    tile->addChild(content.get(), split, FLT_MAX);
+    tile->setFileName(1, getFileName(level, x, y));
+    tile->setRange(1, 0.0f, split);
+    return tile;
+}
+
+osg::Group* TilePyramid::createChildren(int level, int x, int y) const
+{
+    osg::Group* children = new osg::Group;
+    for (int q = 0; q < 4; ++q)
+    {
+        int cx = 2 * x + (q & 1);
+        int cy = 2 * y + (q >> 1);
+        if (!isEmpty(level + 1, cx, cy))
+            children->addChild(createTileNode(level + 1, cx, cy));
+    }
+    return children;
+}
+
+osg::Group* TilePyramid::createIndex() const
+{
+    osg::Group* index = new osg::Group;
+    index->setName("tiles");
+    index->setUserValue("ltw_matrix", _ltw);
+    index->setUserValue("wbb_min", _wbb._min);
+    index->setUserValue("wbb_max", _wbb._max);
+    index->setUserValue("tile_levels", _levels);
+    index->setUserValue("tile_format", TILE_FORMAT);
+    for (const auto& source : SOURCE_FILES)
+        index->setUserValue(std::string("source_") + source[0],
+                            getSourceSize(_source, source[1]));
+
+    for (const auto& layer : _layers) index->addChild(layer.get());
+    if (!isEmpty(0, 0, 0)) index->addChild(createTileNode(0, 0, 0));
+    return index;
+}
+
+/****************************************************************************/
+
+bool TilePyramid::writeIndex(const std::string& dir) const
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec)
+    {
+        std::cout << "[TILES] Nie mozna utworzyc katalogu " << dir
+                  << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < _layers.size(); ++i)
+    {
+        std::string path = dir + "/" + _layers[i]->getName() + ".fidx";
+        if (_indices[i].valid() && !_indices[i]->write(path, ""))
+            std::cout << "[TILES] Nie mozna zapisac " << path << std::endl;
+    }
+
+    osg::ref_ptr<osg::Group> index = createIndex();
+    if (!osgDB::writeNodeFile(*index, dir + "/index.osgb"))
+    {
+        std::cout << "[TILES] Nie mozna zapisac indeksu w " << dir
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TilePyramid::write(const std::string& dir) const
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    if (!writeIndex(dir)) return false;
+
+    // Plik kafla trzyma jego dzieci, wiec liscie nie maja wlasnych plikow
+    struct Key
+    {
+        int level, x, y;
+    };
+    std::vector<Key> pending;
+    if (_levels > 1 && !isEmpty(0, 0, 0)) pending.push_back({ 0, 0, 0 });
+
+    unsigned numFiles = 0;
+    while (!pending.empty())
+    {
+        Key key = pending.back();
+        pending.pop_back();
+
+        osg::ref_ptr<osg::Group> children =
+            createChildren(key.level, key.x, key.y);
+        std::string path = dir + "/"
+                           + osgDB::getNameLessExtension(getFileName(
+                               key.level, key.x, key.y))
+                           + ".osgb";
+        if (!osgDB::writeNodeFile(*children, path))
+        {
+            std::cout << "[TILES] Nie mozna zapisac " << path << std::endl;
+            return false;
+        }
+        ++numFiles;
+
+        if (key.level + 2 >= _levels) continue;
+        for (int q = 0; q < 4; ++q)
+        {
+            Key child = { key.level + 1, 2 * key.x + (q & 1),
+                          2 * key.y + (q >> 1) };
+            if (!isEmpty(child.level, child.x, child.y))
+                pending.push_back(child);
+        }
+    }
+
+    std::cout << "[TILES] Zapisano " << numFiles << " plikow kafli w " << dir
+              << ", "
+              << osg::Timer::instance()->delta_s(
+                     start, osg::Timer::instance()->tick())
+              << " s" << std::endl;
+    return true;
+}
+
+/****************************************************************************/
+
+bool bakeTiles(const std::string& file_path, const std::string& dir)
+{
+    osg::ref_ptr<TilePyramid> pyramid = new TilePyramid(file_path);
+    return pyramid->valid() && pyramid->write(dir);
+}
+
+namespace {
+
+/**
+ * Pseudo-loader of tile_<level>_<x>_<y>.osgmaptile: reads the .osgb file of
+ * the tile from the tile cache, or generates the tile from the pyramid of
+ * the source data and stores it in the cache for the next time.
+ */
+class ReaderWriterMapTile : public osgDB::ReaderWriter {
+public:
+    ReaderWriterMapTile(): _building(false)
+    {
+        supportsExtension("osgmaptile", "osgMap tile, generated on demand");
+        supportsOption(TileWarmer::OPTION,
+                       "Preloading: not logged, not taken from the warmer");
+        supportsOption(TilePrefetcher::OPTION, "Prefetching: not logged");
+    }
+
+    ~ReaderWriterMapTile() override
+    {
+        if (_builder.joinable()) _builder.join();
+    }
+
+    const char* className() const override
+    {
+        return "osgMap tile pseudo-loader";
+    }
+
+    ReadResult readNode(const std::string& file,
+                        const osgDB::Options* options) const override
+    {
+        std::string ext = osgDB::getLowerCaseFileExtension(file);
+        if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+
+        int level, x, y;
+        if (std::sscanf(osgDB::getStrippedName(file).c_str(), "tile_%d_%d_%d",
+                        &level, &x, &y)
+            != 3)
+            return ReadResult::FILE_NOT_HANDLED;
+
+        std::string tile = osgDB::getStrippedName(file);
+        std::string optionString = options ? options->getOptionString() : "";
+        bool warmup =
+            optionString.find(TileWarmer::OPTION) != std::string::npos;
+        bool prefetch =
+            optionString.find(TilePrefetcher::OPTION) != std::string::npos;
+
+        osg::ref_ptr<TileUsageLog> log;
+        osg::ref_ptr<TileWarmer> warmer;
+        if (!warmup) getUsage(log, warmer);
+        // Prefetch czyta kafle, ktorych jeszcze nikt nie ogladal
+        if (prefetch) log = nullptr;
+
+        // Kafel wczytany zawczasu, juz skompilowany
+        osg::ref_ptr<osg::Node> node;
+        if (warmer.valid()) node = warmer->take(tile);
+        ReadResult result = node.valid()
+                                ? ReadResult(node.get())
+                                : readTile(file, tile, level, x, y, options);
+
+        // Tylko kafle oddane pagerowi, bez ponowien w czasie budowy warstw
+        if (log.valid() && result.validNode()) log->record(tile);
+        return result;
+    }
+
+    void setSource(const std::string& file_path, TileCache* cache)
+    {
+        std::lock_guard<std::mutex> buildLock(_buildMutex);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cache = cache;
+        if (file_path == _source) return;
+        _source = file_path;
+        _pyramid = nullptr;
+    }
+
+    TileCache* getCache() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _cache.get();
+    }
+
+    void setUsage(TileUsageLog* log, TileWarmer* warmer)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _log = log;
+        _warmer = warmer;
+    }
+
+    void getUsage(osg::ref_ptr<TileUsageLog>& log,
+                  osg::ref_ptr<TileWarmer>& warmer) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        log = _log;
+        warmer = _warmer;
+    }
+
+    /**
+     * Pyramid of the source data. The first call starts building it on its
+     * own thread, so that the pager thread keeps reading cached tiles.
+     *
+     * @param wait Block until the pyramid is built
+     * @return The pyramid, nullptr while it is being built or if it failed
+     */
+    osg::ref_ptr<TilePyramid> getPyramid(bool wait) const
+    {
+        std::unique_lock<std::mutex> lock(_buildMutex);
+        do
+        {
+            if (!_pyramid.valid() && !_building && !_source.empty())
+            {
+                std::cout << "[TILES] Budowanie warstw z " << _source
+                          << " dla brakujacych kafli..." << std::endl;
+                // Poprzedni watek juz skonczyl, zwolnil blokade przed wyjsciem
+                if (_builder.joinable()) _builder.join();
+                _building = true;
+                _builder =
+                    std::thread(&ReaderWriterMapTile::build, this, _source);
+            }
+            if (wait) _built.wait(lock, [this] { return !_building; });
+            // Wynik budowy dla poprzedniego zrodla zostal odrzucony
+        } while (wait && !_pyramid.valid() && !_source.empty());
+
+        if (_pyramid.valid() && _pyramid->valid()) return _pyramid;
+        return nullptr;
+    }
+
+private:
+    // Tile from the cache, or generated and stored there
+    ReadResult readTile(const std::string& file, const std::string& tile,
+                        int level, int x, int y,
+                        const osgDB::Options* options) const
+    {
+        osg::ref_ptr<TileCache> cache = getCache();
+        if (!cache.valid()) return ReadResult::FILE_NOT_FOUND;
+
+        std::string name = tile + ".osgb";
+        std::string cached = cache->lookup(name);
+        if (!cached.empty())
+        {
+            osg::ref_ptr<osg::Node> node =
+                osgDB::readRefNodeFile(cached, options);
+            if (node.valid()) return node.release();
+            std::cout << "[TILES] Nie mozna wczytac " << cached
+                      << ", generuje od nowa" << std::endl;
+            cache->remove(name);
+        }
+
+        // Warstwy buduja sie w tle; PagedLOD ponowi zadanie w kolejnych
+        // klatkach, a kafle z cache sa w tym czasie dalej czytane
+        osg::ref_ptr<TilePyramid> pyramid = getPyramid(false);
+        if (!pyramid.valid()) return ReadResult::FILE_NOT_FOUND;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        osg::ref_ptr<osg::Group> children =
+            pyramid->createChildren(level, x, y);
+        if (!cache->store(name, *children))
+            std::cout << "[TILES] Nie mozna zapisac " << name << std::endl;
+
+        // Wczytany plik dostalby katalog od czytnika osgb, tu ustawiamy go sami
+        std::string dir = osgDB::getFilePath(file);
+        for (unsigned i = 0; i < children->getNumChildren(); ++i)
+        {
+            if (osg::PagedLOD* plod =
+                    dynamic_cast<osg::PagedLOD*>(children->getChild(i)))
+                plod->setDatabasePath(dir);
+        }
+
+        std::cout << "[TILES] Wygenerowano " << osgDB::getSimpleFileName(file)
+                  << ": " << children->getNumChildren() << " kafli, "
+                  << osg::Timer::instance()->delta_m(
+                         start, osg::Timer::instance()->tick())
+                  << " ms" << std::endl;
+        return children.release();
+    }
+
+    void build(const std::string& source) const
+    {
+        osg::ref_ptr<TilePyramid> pyramid = new TilePyramid(source);
+
+        std::lock_guard<std::mutex> lock(_buildMutex);
+        _building = false;
+        // Zrodlo zmienione w trakcie budowy: wynik jest nieaktualny
+        if (source == _source)
+        {
+            _pyramid = pyramid;
+            if (!pyramid->valid()) _source.clear();
+        }
+        _built.notify_all();
+    }
+
+    mutable std::mutex _buildMutex; // _source, _pyramid, _building
+    mutable std::condition_variable _built;
+    mutable std::thread _builder;
+    mutable bool _building;
+    mutable std::string _source;
+    mutable osg::ref_ptr<TilePyramid> _pyramid;
+
+    mutable std::mutex _mutex; // _cache, _log, _warmer
+    osg::ref_ptr<TileCache> _cache;
+    osg::ref_ptr<TileUsageLog> _log;
+    osg::ref_ptr<TileWarmer> _warmer;
+};
+
+} // namespace
+
+REGISTER_OSGPLUGIN(osgmaptile, ReaderWriterMapTile)
+
+void setTileUsage(TileUsageLog* log, TileWarmer* warmer)
+{
+    ReaderWriterMapTile* loader = dynamic_cast<ReaderWriterMapTile*>(
+        osgDB::Registry::instance()->getReaderWriterForExtension(
+            "osgmaptile"));
+    if (loader) loader->setUsage(log, warmer);
+}
+
+bool hasTileSources(const std::string& file_path)
+{
+    for (const auto& source : SOURCE_FILES)
+        if (getSourceSize(file_path, source[1]).empty()) return false;
+    return true;
+}
+
+osg::Group* loadTiles(TileCache* cache, const std::string& file_path,
+                      osg::Matrixd& ltw, osg::BoundingBox& wbb)
+{
+    const std::string& dir = cache->getDirectory();
+
+    // Kafle odwoluja sie do tych samych tekstur i stanow: obrazy z cache,
+    // stany wspoldzielone przez DatabasePager, KD-drzewa do wskazywania
+    osgDB::Registry* registry = osgDB::Registry::instance();
+    osg::ref_ptr<osgDB::Options> options =
+        registry->getOptions() ? registry->getOptions()->cloneOptions()
+                               : new osgDB::Options;
+    options->setObjectCacheHint(osgDB::Options::CACHE_IMAGES);
+    registry->setOptions(options.get());
+    registry->getOrCreateSharedStateManager();
+    registry->setBuildKdTreesHint(osgDB::Options::BUILD_KDTREES);
+
+    ReaderWriterMapTile* loader = dynamic_cast<ReaderWriterMapTile*>(
+        registry->getReaderWriterForExtension("osgmaptile"));
+    if (!loader)
+    {
+        std::cout << "[TILES] Brak czytnika .osgmaptile" << std::endl;
+        return nullptr;
+    }
+    loader->setSource(file_path, cache);
+
+    // Bez indeksu: warstwy sa budowane od razu, kafle dopiero na zadanie
+    std::string indexFile = dir + "/index.osgb";
+    if (!std::filesystem::exists(indexFile))
+    {
+        osg::ref_ptr<TilePyramid> pyramid = loader->getPyramid(true);
+        if (!pyramid.valid() || !pyramid->writeIndex(dir)) return nullptr;
+    }
+
+    osg::ref_ptr<osg::Node> node = osgDB::readRefNodeFile(indexFile);
+    osg::ref_ptr<osg::Group> index = node.valid() ? node->asGroup() : nullptr;
+    if (!index.valid())
+    {
+        std::cout << "[TILES] Brak piramidy kafli w " << dir << std::endl;
+        return nullptr;
+    }
+
+    osg::Vec3f minBB, maxBB;
+    if (!index->getUserValue("ltw_matrix", ltw)
+        || !index->getUserValue("wbb_min", minBB)
+        || !index->getUserValue("wbb_max", maxBB))
+    {
+        std::cout << "[TILES] Indeks bez ukladu lokalnego: " << dir
+                  << std::endl;
+        return nullptr;
+    }
+    wbb._min = minBB;
+    wbb._max = maxBB;
+
+    // Kafle w katalogu pochodza z danych opisanych w indeksie; brakujacego
+    // zrodla nie sprawdzamy, piramida moze byc wypalona zawczasu
+    int format = 0;
+    index->getUserValue("tile_format", format);
+    if (format != TILE_FORMAT)
+    {
+        std::cout << "[TILES] Piramida w " << dir << " ma stary format, "
+                  << "usun katalog, aby zbudowac ja od nowa" << std::endl;
+        return nullptr;
+    }
+    for (const auto& source : SOURCE_FILES)
+    {
+        std::string size = getSourceSize(file_path, source[1]);
+        std::string indexed;
+        index->getUserValue(std::string("source_") + source[0], indexed);
+        if (!size.empty() && size != indexed)
+        {
+            std::cout << "[TILES] Piramida w " << dir << " zbudowana z innych "
+                      << "danych (" << source[1] << "), usun katalog albo "
+                      << "wybierz inny" << std::endl;
+            return nullptr;
+        }
+    }
+
+    // Korzenie warstw maja nazwy, indeksy obiektow sa w plikach .fidx
+    for (unsigned i = 0; i < index->getNumChildren(); ++i)
+    {
+        osg::Node* layer = index->getChild(i);
+        if (layer->getName().compare(0, 4, "lod_") == 0
+            || layer->getName().compare(0, 5, "tile_") == 0)
+            continue;
+        // Warstwa nie ma pliku .osgb: indeks sprawdzany razem z piramida
+        attachFeatureIndex(layer, dir + "/" + layer->getName() + ".osgb");
+    }
+
+    int levels = 0;
+    index->getUserValue("tile_levels", levels);
+    std::cout << "[TILES] Otwarto piramide " << dir << " (" << levels
+              << " poziomow)" << std::endl;
+    return index.release();
+}
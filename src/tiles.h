@@ -0,0 +1,119 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <osg/BoundingBox>
+#include <osg/Group>
+#include <osg/Matrixd>
+#include <osg/ref_ptr>
+
+#include <string>
+#include <vector>
+
+#include "feature_index.h"
+#include "partition.h"
+#include "tile_cache.h"
+#include "tile_usage.h"
+
+/**
+ * Quadtree pyramid of map tiles for paging with osg::PagedLOD.
+ *
+ * Every tile holds all tiled layers (landuse, water, roads, buildings) at
+ * the detail of its level. A tile other than a leaf is a PagedLOD showing
+ * its own geometry from afar and the file with its four children up close,
+ * so the DatabasePager loads and expires tiles by camera distance and only
+ * the tiles around the view stay in memory.
+ *
+ * Files of a pyramid directory:
+ *  - index.osgb: the layer roots without their geometry (state, lights)
+ *    and the root tile, with the local frame, the tile format and the
+ *    sizes of the source files as user values,
+ *  - <layer>.fidx: feature indices of the whole layers,
+ *  - tile_<level>_<x>_<y>.osgb: the children of a tile.
+ *
+ * PagedLODs name their children tile_<level>_<x>_<y>.osgmaptile. The
+ * .osgmaptile pseudo-loader reads the .osgb file of the tile from the
+ * TileCache, or if there is none, generates the tile from the source data
+ * on the pager thread and stores it there, so a pyramid does not have to
+ * be baked up front. The layers needed for that are built on a thread of
+ * their own at the first missing tile; until they are ready such tiles
+ * fail to load and their PagedLODs request them again.
+ */
+class TilePyramid : public osg::Referenced {
+public:
+    /**
+     * Builds the map layers from the data in `file_path` (through their
+     * own caches) and cuts them into tiles. All the layers are in memory
+     * while the pyramid exists.
+     */
+    explicit TilePyramid(const std::string& file_path);
+
+    bool valid() const { return !_tilers.empty(); }
+    int getNumLevels() const { return _levels; }
+
+    // Layer roots and the root tile
+    osg::Group* createIndex() const;
+
+    // Content of the file of a tile: its non-empty children
+    osg::Group* createChildren(int level, int x, int y) const;
+
+    // Writes the index and the feature indices to `dir`
+    bool writeIndex(const std::string& dir) const;
+
+    // Writes the whole pyramid (index, feature indices, tiles) to `dir`
+    bool write(const std::string& dir) const;
+
+    // File name of the children of a tile, as requested by its PagedLOD
+    static std::string getFileName(int level, int x, int y);
+
+protected:
+    ~TilePyramid() override;
+
+private:
+    bool isEmpty(int level, int x, int y) const;
+    osg::BoundingBox getTileBox(int level, int x, int y) const;
+    osg::Node* createTileNode(int level, int x, int y) const;
+
+    std::string _source; // file_path, its file sizes go to the index
+    osg::Matrixd _ltw;
+    osg::BoundingBox _wbb;
+    osg::BoundingBox _extent; // local frame, square in XY
+    int _levels;
+
+    std::vector<osg::ref_ptr<osg::Node>> _layers; // roots, geometry taken
+    std::vector<osg::ref_ptr<FeatureIndex>> _indices;
+    std::vector<osg::ref_ptr<LayerTiler>> _tilers;
+};
+
+// Builds the pyramid of the map in `file_path` and writes it to `dir`
+bool bakeTiles(const std::string& file_path, const std::string& dir);
+
+// True if all the source files of the map are in `file_path`, so tiles
+// removed from a cache can be generated again
+bool hasTileSources(const std::string& file_path);
+
+/**
+ * Opens the pyramid in the directory of a tile cache. Tiles are then loaded
+ * by the viewer's DatabasePager as the camera moves; missing tiles are
+ * generated from `file_path`. Without an index the layers are built and cut
+ * right away and only the index is written. A pyramid of another format or
+ * built from source files of other sizes is rejected.
+ *
+ * @param cache Tile cache holding the pyramid
+ * @param file_path Map source data
+ * @param[out] ltw Local to world matrix of the map
+ * @param[out] wbb World bounding box of the map
+ * @return Group with the layer roots (feature indices attached) and the
+ *         root tile, nullptr if the pyramid cannot be opened
+ */
+osg::Group* loadTiles(TileCache* cache, const std::string& file_path,
+                      osg::Matrixd& ltw, osg::BoundingBox& wbb);
+
+/**
+ * Makes the .osgmaptile loader record the tiles it hands to the pager in
+ * `log` (not those read for the warmer or the prefetcher) and hand out the
+ * tiles preloaded by `warmer` before reading them itself. Either may be
+ * nullptr; call with both nullptr before they are destroyed.
+ */
+void setTileUsage(TileUsageLog* log, TileWarmer* warmer);
+
+#endif // TILES_H
@@ -0,0 +1,40 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/**
+ * Lock-free triple buffer for handing data from one producer thread to one
+ * consumer thread. The producer fills back() and publishes it, the consumer
+ * fetches the most recently published slot and reads it through front().
+ * Neither side ever waits for the other.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer(): _middle(1), _front(0), _back(2) {}
+
+    // Producer side
+    T& back() { return _slots[_back]; }
+    void publish() { _back = _middle.exchange(_back | DIRTY) & INDEX; }
+
+    // Consumer side, returns false if nothing new was published
+    bool fetch()
+    {
+        if (!(_middle.load() & DIRTY)) return false;
+        _front = _middle.exchange(_front) & INDEX;
+        return true;
+    }
+    const T& front() const { return _slots[_front]; }
+
+private:
+    static const unsigned DIRTY = 4;
+    static const unsigned INDEX = 3;
+
+    T _slots[3];
+    std::atomic<unsigned> _middle;
+    unsigned _front;
+    unsigned _back;
+};
+
+#endif // TRIPLE_BUFFER_H
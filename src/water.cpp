@@ -11,6 +11,8 @@
 #include <iostream>
 
 #include "common.h"
+#include "feature_index.h"
+#include "partition.h"
 
 using namespace osg;
 
@@ -42,7 +44,12 @@ uniform mat4 osg_ViewMatrix;
 uniform float FresnelApproxPowFactor;                                                      
 uniform float DynamicRange1;                                                               
 uniform float DynamicRange2;                                                               
-uniform float animacja;                                  
+// Czas z osgViewer: stan wody nie potrzebuje callbacku i moze byc zapisany
+uniform float osg_FrameTime;
+
+// LOD shadera: 0 = wg odleglosci, 1 = zawsze pelny, 2 = zawsze tani
+uniform int shaderLodMode;
+uniform float shaderLodDistance;
  
 const vec4 WaterLight = vec4(0.1, 0.2, 0.5, 1.0);
 const vec4 WaterDark = vec4(0.05, 0.1, 0.3, 1.0);
@@ -88,19 +95,24 @@ void DirectionalLight(in float glos,
 
 void main (void)                                                 
 {                                                                
-  vec3 NH = texture2D(sampler0, tcw*0.5).xyz * vec3(2.0) - vec3(1.0);
-  vec3 N = normal;                                                                         
-  vec3 T = normalize(cross(vec3(0, 1, 0), N));                                             
-  N = normalize(gl_NormalMatrix * N);
-  T = normalize(gl_NormalMatrix * T);
-  vec3 B = normalize(cross(N, T));                                                         
-  mat3 tbn = mat3(T, B, N); 
-                  
-  float phase = length(gl_FragCoord.xy)*NH.y;
-  float cangle = 1.5*animacja + phase;
-  vec3 n = orientedVector(NH, 0.2 * cos(cangle), cangle);
-                             
-  N = tbn * n;                                                                            
+  vec3 N = normalize(gl_NormalMatrix * normal);
+
+  // Z daleka fale sa mniejsze od piksela: gladka tafla bez tekstury
+  // i obrotow normalnej, Fresnel i swiatlo zostaja
+  bool cheap = shaderLodMode == 2
+    || (shaderLodMode == 0 && length(ecp.xyz) > shaderLodDistance);
+  if (!cheap) {
+    vec3 NH = texture2D(sampler0, tcw*0.5).xyz * vec3(2.0) - vec3(1.0);
+    vec3 T = normalize(gl_NormalMatrix * cross(vec3(0, 1, 0), normal));
+    vec3 B = normalize(cross(N, T));
+    mat3 tbn = mat3(T, B, N);
+
+    float phase = length(gl_FragCoord.xy)*NH.y;
+    float cangle = 1.5*osg_FrameTime + phase;
+    vec3 n = orientedVector(NH, 0.2 * cos(cangle), cangle);
+
+    N = tbn * n;
+  }
   
   vec4 ambiCol = vec4(0.0), diffCol = vec4(0.0), specCol = vec4(0.0);
   float specularGlos = 0.3;
@@ -126,26 +138,9 @@ void main (void)
 }
 )";
 
-class MyUpdateCallback : public osg::NodeCallback {
-public:
-    osg::ref_ptr<osg::Uniform> _ctime;
-    MyUpdateCallback(osg::Uniform* ct): _ctime(ct) {}
-
-    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
-    {
-        static double firstTime = osg::Timer::instance()->time_s();
-        double nowTime = osg::Timer::instance()->time_s();
-
-        _ctime->set((float)osg::Timer::instance()->time_s());
-        traverse(node, nv);
-    }
-};
-
-
 osg::Node* process_water(osg::Matrixd& ltw, const std::string& file_path)
 {
     std::string water_file_path = file_path + "/gis_osm_water_a_free_1.shp";
-    osg::ref_ptr<osg::Uniform> _ctime = new osg::Uniform("animacja", 0.f);
     // load the data
     osg::ref_ptr<osg::Node> water_model =
         osgDB::readRefNodeFile(water_file_path);
@@ -161,6 +156,9 @@ osg::Node* process_water(osg::Matrixd& ltw, const std::string& file_path)
     WorldToLocalVisitor ltwv(ltw, true);
     water_model->accept(ltwv);
 
+    // Bez cache, podzial jest liczony przy kazdym starcie
+    water_model = partitionLayer(water_model.get(), "water");
+
     // GOOD LUCK!
 
     osg::ref_ptr<osg::Texture2D> texture =
@@ -173,8 +171,6 @@ osg::Node* process_water(osg::Matrixd& ltw, const std::string& file_path)
     texture->setFilter(osg::Texture::MIN_FILTER,
                        osg::Texture::LINEAR_MIPMAP_LINEAR);
 
-    water_model->setUpdateCallback(new MyUpdateCallback(_ctime.get()));
-
     osg::Shader* vshader = new osg::Shader(osg::Shader::VERTEX, water_vert);
     osg::Shader* fshader = new osg::Shader(osg::Shader::FRAGMENT, water_frag);
     osg::Program* program = new osg::Program;
@@ -189,7 +185,8 @@ osg::Node* process_water(osg::Matrixd& ltw, const std::string& file_path)
         new osg::Uniform("DynamicRange2", 0.025f));
     water_model->getOrCreateStateSet()->addUniform(
         new osg::Uniform("FresnelApproxPowFactor", 1.2f));
-    water_model->getOrCreateStateSet()->addUniform(_ctime);
 
+    // Woda nie ma cache, indeks jest budowany przy kazdym starcie
+    attachFeatureIndex(water_model.get(), "");
     return water_model.release();
 }